@@ -0,0 +1,295 @@
+#include "aof.h"
+#include "log.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+AofWriter::AofWriter()
+{
+    Node *stub = new Node();
+    head_.store(stub);
+    tail_ = stub;
+}
+
+AofWriter::~AofWriter()
+{
+    close();
+    while (Node *node = pop())
+    {
+        (void)node;
+    }
+    delete tail_;
+}
+
+bool AofWriter::parsePolicy(const std::string &name, AofFsync &out)
+{
+    if (name == "always")
+        out = AofFsync::ALWAYS;
+    else if (name == "everysec")
+        out = AofFsync::EVERYSEC;
+    else if (name == "no")
+        out = AofFsync::NO;
+    else
+        return false;
+    return true;
+}
+
+const char *AofWriter::policyName(AofFsync policy)
+{
+    switch (policy)
+    {
+    case AofFsync::ALWAYS:
+        return "always";
+    case AofFsync::EVERYSEC:
+        return "everysec";
+    default:
+        return "no";
+    }
+}
+
+bool AofWriter::open(const std::string &filename, AofFsync policy)
+{
+    close();
+
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        LOG_ERROR("Failed to open AOF file " << filename << ": " << strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    size_.store(fstat(fd_, &st) == 0 ? st.st_size : 0);
+
+    filename_ = filename;
+    policy_ = policy;
+    stop_ = false;
+    last_fsync_ = std::chrono::steady_clock::now();
+    thread_ = std::thread(&AofWriter::run, this);
+    return true;
+}
+
+void AofWriter::close()
+{
+    if (!thread_.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+
+    if (policy_ != AofFsync::NO && dirty_)
+        sync();
+    ::close(fd_);
+    fd_ = -1;
+}
+
+namespace
+{
+// One per producer thread; only used with the ALWAYS policy
+thread_local struct
+{
+    std::atomic<unsigned long long> durable{0};
+    unsigned long long appended = 0;
+} this_thread_waiter;
+} // namespace
+
+void AofWriter::append(std::string record)
+{
+    Node *node = new Node();
+    node->record = std::move(record);
+    if (policy_ == AofFsync::ALWAYS)
+    {
+        node->durable = &this_thread_waiter.durable;
+        node->ticket = ++this_thread_waiter.appended;
+    }
+
+    Node *prev = head_.exchange(node);
+    prev->next.store(node);
+    appended_.fetch_add(1);
+
+    if (sleeping_.load())
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake_.notify_one();
+    }
+}
+
+void AofWriter::waitDurable()
+{
+    if (policy_ != AofFsync::ALWAYS)
+        return;
+
+    unsigned long long ticket = this_thread_waiter.appended;
+    if (this_thread_waiter.durable.load() >= ticket)
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    progress_.wait(lock, [ticket]() { return this_thread_waiter.durable.load() >= ticket; });
+}
+
+// Waits until everything appended so far has been written
+void AofWriter::drain()
+{
+    unsigned long long target = appended_.load();
+    std::unique_lock<std::mutex> lock(mutex_);
+    progress_.wait(lock, [this, target]() { return written_.load() >= target || !thread_.joinable(); });
+}
+
+bool AofWriter::rotate(const std::string &filename)
+{
+    drain();
+
+    std::lock_guard<std::mutex> fd_lock(fd_mutex_);
+    if (fd_ < 0)
+        return false;
+
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        // Keep appending to the old segment rather than losing writes
+        LOG_ERROR("Failed to create AOF " << filename << ": " << strerror(errno));
+        return false;
+    }
+
+    // The old segment must be complete on disk before anything relies on the
+    // new one
+    if (policy_ != AofFsync::NO)
+        fdatasync(fd_);
+    ::close(fd_);
+    fd_ = fd;
+    filename_ = filename;
+    size_.store(0);
+    return true;
+}
+
+AofWriter::Stats AofWriter::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+// Consumer side of the queue. The returned node becomes the new stub and is
+// freed by the following pop().
+AofWriter::Node *AofWriter::pop()
+{
+    Node *next = tail_->next.load();
+    if (next == nullptr)
+        return nullptr;
+    delete tail_;
+    tail_ = next;
+    return next;
+}
+
+void AofWriter::sync()
+{
+    auto start = std::chrono::steady_clock::now();
+    if (fdatasync(fd_) < 0)
+    {
+        LOG_ERROR("fdatasync() on AOF failed: " << strerror(errno));
+    }
+    last_fsync_ = std::chrono::steady_clock::now();
+    dirty_ = false;
+
+    unsigned long long us = std::chrono::duration_cast<std::chrono::microseconds>(last_fsync_ - start).count();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.fsyncs++;
+    stats_.last_fsync_us = us;
+    stats_.total_fsync_us += us;
+    if (us > stats_.max_fsync_us)
+        stats_.max_fsync_us = us;
+}
+
+void AofWriter::run()
+{
+    std::string buffer;
+    std::vector<std::pair<std::atomic<unsigned long long> *, unsigned long long>> waiters;
+
+    while (true)
+    {
+        buffer.clear();
+        waiters.clear();
+        unsigned long long count = 0;
+
+        while (Node *node = pop())
+        {
+            buffer += node->record;
+            if (node->durable != nullptr)
+                waiters.emplace_back(node->durable, node->ticket);
+            count++;
+        }
+
+        if (count == 0)
+        {
+            if (policy_ == AofFsync::EVERYSEC && dirty_ &&
+                std::chrono::steady_clock::now() - last_fsync_ >= std::chrono::seconds(1))
+            {
+                std::lock_guard<std::mutex> fd_lock(fd_mutex_);
+                sync();
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (stop_)
+                break;
+
+            // Producers check sleeping_ after linking their node, and we check
+            // the queue after setting it, so one of us always sees the other
+            sleeping_.store(true);
+            wake_.wait_for(lock, std::chrono::milliseconds(100), [this]() {
+                return stop_ || tail_->next.load() != nullptr;
+            });
+            sleeping_.store(false);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> fd_lock(fd_mutex_);
+
+        size_t done = 0;
+        while (done < buffer.size())
+        {
+            ssize_t n = ::write(fd_, buffer.data() + done, buffer.size() - done);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                LOG_ERROR("Failed to write AOF: " << strerror(errno));
+                break;
+            }
+            done += n;
+        }
+        size_.fetch_add(done);
+        dirty_ = true;
+
+        if (policy_ == AofFsync::ALWAYS ||
+            (policy_ == AofFsync::EVERYSEC &&
+             std::chrono::steady_clock::now() - last_fsync_ >= std::chrono::seconds(1)))
+        {
+            sync();
+        }
+        fd_lock.unlock();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.batches++;
+            stats_.records += count;
+            stats_.last_batch = count;
+            if (count > stats_.max_batch)
+                stats_.max_batch = count;
+
+            // Records of one thread are queued in order, so the last ticket
+            // seen for a thread covers all of its earlier ones
+            for (auto &waiter : waiters)
+                waiter.first->store(waiter.second);
+            written_.fetch_add(count);
+        }
+        progress_.notify_all();
+    }
+}
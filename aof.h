@@ -0,0 +1,113 @@
+#ifndef AOF_H
+#define AOF_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// When the AOF writer calls fdatasync(), as in Redis's `appendfsync`
+enum class AofFsync
+{
+    ALWAYS,     // Before the write command returns; concurrent writers share one fsync
+    EVERYSEC,   // At most once per second
+    NO          // Never; the kernel flushes when it likes
+};
+
+// Append-only file writer. Commands append encoded records to a lock-free
+// multi-producer queue and return; a dedicated thread drains the queue,
+// writes everything it found with one write() and syncs according to the
+// fsync policy. With ALWAYS, waitDurable() blocks the calling thread until
+// its records are on disk, so every writer that queued while the previous
+// fdatasync() was running is committed by the next one.
+class AofWriter
+{
+public:
+    struct Stats
+    {
+        unsigned long long batches = 0;         // write() calls
+        unsigned long long records = 0;         // Records written
+        unsigned long long last_batch = 0;      // Records in the latest batch
+        unsigned long long max_batch = 0;
+        unsigned long long fsyncs = 0;
+        unsigned long long last_fsync_us = 0;   // Latency of the latest fdatasync()
+        unsigned long long max_fsync_us = 0;
+        unsigned long long total_fsync_us = 0;
+    };
+
+    AofWriter();
+    ~AofWriter();
+
+    // Opens (appending to) the file and starts the writer thread
+    bool open(const std::string &filename, AofFsync policy);
+    // Writes out everything queued, syncs and stops the writer thread
+    void close();
+
+    // Queues one record. Lock-free; safe from any thread.
+    void append(std::string record);
+
+    // ALWAYS policy: blocks until every record this thread appended is on
+    // disk. A no-op for the other policies.
+    void waitDurable();
+
+    // Waits for the queue to drain, then continues in `filename`, a new
+    // empty file. Callers must make sure nothing is appended concurrently.
+    bool rotate(const std::string &filename);
+
+    // Bytes in the current file, including records still being written
+    unsigned long long size() const { return size_.load(); }
+
+    AofFsync policy() const { return policy_; }
+    Stats stats() const;
+
+    static bool parsePolicy(const std::string &name, AofFsync &out);
+    static const char *policyName(AofFsync policy);
+
+private:
+    struct Node
+    {
+        std::atomic<Node *> next{nullptr};
+        std::string record;
+        // ALWAYS policy: the appending thread's durability counter, which is
+        // set to `ticket` once this record has been synced
+        std::atomic<unsigned long long> *durable = nullptr;
+        unsigned long long ticket = 0;
+    };
+
+    // Vyukov intrusive MPSC queue: producers swap themselves into head_,
+    // the writer thread pops from tail_, which always points at a consumed
+    // (or stub) node
+    std::atomic<Node *> head_;
+    Node *tail_;
+
+    std::atomic<bool> sleeping_{false};
+    std::atomic<unsigned long long> appended_{0};
+    std::atomic<unsigned long long> written_{0};
+    std::atomic<unsigned long long> size_{0};
+
+    mutable std::mutex mutex_;          // Guards the condition variables and stats_
+    std::condition_variable wake_;      // Writer thread waits for records
+    std::condition_variable progress_;  // Producers wait for written_ / durability
+    bool stop_ = false;
+
+    std::mutex fd_mutex_;               // Held while writing, syncing or swapping fd_
+    int fd_ = -1;
+    std::string filename_;
+    AofFsync policy_ = AofFsync::EVERYSEC;
+    std::thread thread_;
+    Stats stats_;
+
+    // Owned by the writer thread
+    bool dirty_ = false;                // Written since the last fdatasync()
+    std::chrono::steady_clock::time_point last_fsync_;
+
+    Node *pop();
+    void drain();
+    void run();
+    void sync();
+};
+
+#endif
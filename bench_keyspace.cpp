@@ -0,0 +1,174 @@
+// Keyspace table speed: std::unordered_map (the original keyspace), Dict and
+// SwissTable, under the lookups GET, SET and DEL make.
+//
+//   g++ -std=c++17 -O2 -o bench_keyspace bench_keyspace.cpp value.cpp listpack.cpp intset.cpp quicklist.cpp lzf.cpp
+//   ./bench_keyspace [keys ...]            (default 1000000 50000000)
+//
+// For each size, fills each table with `keys` keys (SET, key:N -> N), looks
+// every one up in a scattered order (GET) and deletes them all in another
+// (DEL), and reports nanoseconds per operation, heap bytes per key after the
+// SETs, and the longest single SET, which is where a table that resizes in
+// one step stalls. Every SET is timed for that, so the clock reads are part
+// of its ns/op for all three tables. Keys are formatted into a stack buffer
+// and looked up the way Db does: std::unordered_map through a reused
+// std::string, the others by string_view.
+#include "dict.h"
+#include "swisstable.h"
+#include "value.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// ============== Tables ==============
+
+// The keyspace before Dict: no heterogeneous lookup, so a key is copied
+// into a reused std::string first
+struct UnorderedMap
+{
+    std::unordered_map<std::string, Value> map;
+    std::string scratch;
+
+    void set(std::string_view key, Value &&value)
+    {
+        scratch.assign(key.data(), key.size());
+        map.insert_or_assign(scratch, std::move(value));
+    }
+    bool get(std::string_view key)
+    {
+        scratch.assign(key.data(), key.size());
+        return map.find(scratch) != map.end();
+    }
+    bool del(std::string_view key)
+    {
+        scratch.assign(key.data(), key.size());
+        auto it = map.find(scratch);
+        if (it == map.end())
+            return false;
+        map.erase(it);
+        return true;
+    }
+};
+
+// Dict and SwissTable, through the calls Db makes: store() is an
+// insert_or_assign, GET a const find() under a ReadLock, DEL a find() and
+// an erase()
+template <typename Table>
+struct Keyspace
+{
+    Table map;
+
+    void set(std::string_view key, Value &&value) { map.insert_or_assign(key, std::move(value)); }
+    bool get(std::string_view key) const
+    {
+        const Table &table = map;
+        return table.find(key) != table.end();
+    }
+    bool del(std::string_view key)
+    {
+        auto it = map.find(key);
+        if (it == map.end())
+            return false;
+        map.erase(it);
+        return true;
+    }
+};
+
+// ============== Measurement ==============
+
+static size_t heapInUse()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// Formats key:i into buf
+static std::string_view keyFor(char (&buf)[32], size_t i)
+{
+    std::memcpy(buf, "key:", 4);
+    auto result = std::to_chars(buf + 4, buf + sizeof(buf), i);
+    return std::string_view(buf, result.ptr - buf);
+}
+
+// A stride coprime with keys, so that i * stride % keys visits every key
+// once in an order unrelated to insertion (and so to allocation) order.
+// Taken as a fraction of keys, so that it is never small for some sizes.
+static size_t strideFor(size_t keys, double fraction)
+{
+    size_t stride = std::max<size_t>(1, static_cast<size_t>(keys * fraction));
+    while (std::gcd(stride, keys) != 1)
+        stride++;
+    return stride;
+}
+
+template <typename Map>
+static void run(const char *name, size_t keys)
+{
+    using Clock = std::chrono::steady_clock;
+    char buf[32];
+    size_t found = 0;
+
+    malloc_trim(0);
+    size_t before = heapInUse();
+    auto *map = new Map();
+
+    double worst = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < keys; i++)
+    {
+        auto op_start = Clock::now();
+        map->set(keyFor(buf, i), Value(static_cast<long long>(i)));
+        worst = std::max(worst, std::chrono::duration<double, std::milli>(Clock::now() - op_start).count());
+    }
+    double set_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / keys;
+    size_t used = heapInUse() - before;
+
+    size_t stride = strideFor(keys, 0.618034);
+    start = Clock::now();
+    for (size_t i = 0; i < keys; i++)
+        found += map->get(keyFor(buf, i * stride % keys));
+    double get_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / keys;
+
+    stride = strideFor(keys, 0.381966);
+    start = Clock::now();
+    for (size_t i = 0; i < keys; i++)
+        found += map->del(keyFor(buf, i * stride % keys));
+    double del_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / keys;
+    delete map;
+
+    if (found != 2 * keys)
+        std::fprintf(stderr, "%s: lost keys\n", name);
+    std::printf("%-14s SET %6.1f ns  GET %6.1f ns  DEL %6.1f ns  %6.1f bytes/key  longest SET %8.3f ms\n", name,
+                set_ns, get_ns, del_ns, static_cast<double>(used) / keys, worst);
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+        sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = {1000000, 50000000};
+
+    for (size_t keys : sizes)
+    {
+        if (keys == 0)
+        {
+            std::fprintf(stderr, "usage: %s [keys ...]\n", argv[0]);
+            return 1;
+        }
+        std::printf("%zu keys\n", keys);
+        run<UnorderedMap>("unordered_map", keys);
+        run<Keyspace<Dict<Value>>>("Dict", keys);
+        run<Keyspace<SwissTable<Value>>>("SwissTable", keys);
+    }
+    return 0;
+}
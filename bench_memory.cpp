@@ -0,0 +1,110 @@
+// Memory per key: the previous Value layout against the current one.
+//
+//   g++ -std=c++17 -O2 -o bench_memory bench_memory.cpp value.cpp listpack.cpp intset.cpp quicklist.cpp lzf.cpp
+//   ./bench_memory [keys] [fields]        (defaults 10000000 and 10)
+//
+// Fills a map of `keys` small string values (as SET key:N value:N would) once
+// with each layout, then a map of keys / 10 hashes of `fields` fields each,
+// and reports the heap growth per key, measured by malloc itself so the
+// numbers include allocator overhead. The map and its keys are the same in
+// both runs; only the value differs.
+#include "value.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <malloc.h>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+
+// ============== Previous layout ==============
+
+using LegacyHash = std::unordered_map<std::string, std::string>;
+
+struct LegacyValue
+{
+    ValueType type;
+    std::variant<std::string, long long, std::deque<std::string>, std::unordered_set<std::string>,
+                 std::unordered_map<std::string, std::string>>
+        data;
+    std::optional<std::chrono::steady_clock::time_point> expiration;
+
+    LegacyValue(const std::string &s) : type(ValueType::STRING), data(s) {}
+    LegacyValue(LegacyHash &&h) : type(ValueType::HASH), data(std::move(h)) {}
+};
+
+// ============== Measurement ==============
+
+static size_t heapInUse()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// make(i) builds the i-th value
+template <typename V, typename Make>
+static void run(const char *name, size_t keys, Make make)
+{
+    malloc_trim(0);
+    size_t before = heapInUse();
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::unordered_map<std::string, V> map;
+        map.reserve(keys);
+        char key[32];
+        for (size_t i = 0; i < keys; i++)
+        {
+            std::snprintf(key, sizeof(key), "key:%zu", i);
+            map.emplace(key, make(i));
+        }
+
+        size_t used = heapInUse() - before;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-8s sizeof %3zu  map %8.1f MB  %6.1f bytes/key  filled in %.2fs\n", name, sizeof(V),
+                    used / (1024.0 * 1024.0), static_cast<double>(used) / keys, seconds);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t fields = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10;
+    if (keys < 10)
+    {
+        std::fprintf(stderr, "usage: %s [keys] [fields]\n", argv[0]);
+        return 1;
+    }
+
+    auto string = [](size_t i) {
+        char value[32];
+        std::snprintf(value, sizeof(value), "value:%zu", i);
+        return std::string(value);
+    };
+    auto field = [](size_t i) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "field:%zu", i);
+        return std::string(name);
+    };
+
+    std::printf("%zu string keys\n", keys);
+    run<LegacyValue>("before", keys, [&](size_t i) { return LegacyValue(string(i)); });
+    run<Value>("after", keys, [&](size_t i) { return Value(string(i)); });
+
+    std::printf("%zu hashes of %zu fields\n", keys / 10, fields);
+    run<LegacyValue>("before", keys / 10, [&](size_t i) {
+        LegacyHash hash;
+        for (size_t f = 0; f < fields; f++)
+            hash.emplace(field(f), string(i + f));
+        return LegacyValue(std::move(hash));
+    });
+    run<Value>("after", keys / 10, [&](size_t i) {
+        Value hash(ValueType::HASH);
+        for (size_t f = 0; f < fields; f++)
+            hash.hashSet(field(f), string(i + f));
+        return hash;
+    });
+    return 0;
+}
@@ -0,0 +1,266 @@
+// AOF rewrite round trip: fills a Db with a key of each value encoding,
+// some with TTLs, rewrites the AOF with BGREWRITEAOF, starts a second Db
+// from nothing but the rewritten base, and compares every key.
+//
+//   g++ -std=c++17 -O2 -o check_rewrite check_rewrite.cpp db.cpp value.cpp listpack.cpp intset.cpp quicklist.cpp lzf.cpp resp.cpp log.cpp aof.cpp rdb.cpp clock.cpp -lpthread
+//   ./check_rewrite [dir]                  (default /tmp/check_rewrite)
+//
+// Works in dir/a and dir/b, deleting whatever files are in them. Exits 0 if
+// the reloaded keyspace matches and 1, listing the keys that differ, if not.
+#include "db.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// ============== Files ==============
+
+// Creates dir if needed and deletes the files in it
+static bool emptyDirectory(const std::string &dir)
+{
+    ::mkdir(dir.c_str(), 0755);
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr)
+        return false;
+    while (struct dirent *entry = readdir(d))
+    {
+        if (entry->d_type == DT_REG)
+            ::unlink((dir + "/" + entry->d_name).c_str());
+    }
+    closedir(d);
+    return true;
+}
+
+// Name of the newest AOF base in dir, or "" without one
+static std::string newestBase(const std::string &dir)
+{
+    std::string newest;
+    unsigned long long newest_seq = 0;
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr)
+        return newest;
+    while (struct dirent *entry = readdir(d))
+    {
+        unsigned long long seq;
+        char suffix[8];
+        if (std::sscanf(entry->d_name, "dump.aof.%llu.%7s", &seq, suffix) == 2 && std::string(suffix) == "base" &&
+            seq > newest_seq)
+        {
+            newest = entry->d_name;
+            newest_seq = seq;
+        }
+    }
+    closedir(d);
+    return newest;
+}
+
+// ============== Dataset ==============
+
+static std::string randomBytes(std::mt19937 &rng, size_t length)
+{
+    std::string bytes(length, '\0');
+    for (char &c : bytes)
+        c = static_cast<char>(rng());
+    return bytes;
+}
+
+// Writes the dataset and returns its keys. Sizes are picked against the
+// pack limits main() sets so that each key lands in the encoding its name
+// says.
+static std::vector<std::string> fill(Db &db)
+{
+    std::mt19937 rng(42);
+    std::vector<std::string> keys;
+    auto add = [&](std::string key) {
+        keys.push_back(key);
+        return key;
+    };
+
+    db.set(add("string:embstr"), "hello");
+    db.set(add("string:raw"), randomBytes(rng, 200) + std::string("\r\n\0 end", 7));
+    db.set(add("string:int"), "-1234567890123");
+    db.set(add("string:zero"), "0");
+
+    std::vector<std::string> items;
+    for (int i = 0; i < 10; i++)
+        items.push_back("item " + std::to_string(i) + "\r\n");
+    std::vector<std::string_view> views(items.begin(), items.end());
+    db.rpush(add("list:listpack"), views);
+    db.sadd(add("set:listpack"), views);
+
+    // Long lists over many 256-byte nodes: compressible items, so every node
+    // but the ends is compressed; random ones, which do not compress and
+    // stay raw; and just two nodes, both ends
+    std::string list = add("list:quicklist:compressed");
+    for (int i = 0; i < 2000; i++)
+        db.rpush(list, {"item " + std::to_string(i) + " of a long list"});
+    list = add("list:quicklist:raw");
+    for (int i = 0; i < 300; i++)
+        db.rpush(list, {randomBytes(rng, 40)});
+    list = add("list:quicklist:two-nodes");
+    for (int i = 0; i < 150; i++)
+        db.rpush(list, {std::to_string(i % 10)});
+    db.rpush(add("list:long-item"), {randomBytes(rng, 100)});
+    std::string hash = add("hash:listpack");
+    for (int i = 0; i < 10; i++)
+        db.hset(hash, "field " + std::to_string(i), randomBytes(rng, 20));
+
+    items.clear();
+    for (int i = 0; i < 1000; i++)
+        items.push_back("member:" + std::to_string(i));
+    views.assign(items.begin(), items.end());
+    db.sadd(add("set:dict"), views);
+
+    // Integer sets, small and large, then one over the intset limit
+    for (int size : {100, 300})
+    {
+        items.clear();
+        for (int i = 0; i < size; i++)
+            items.push_back(std::to_string(static_cast<long long>(rng()) * (i % 2 ? -1 : 1) * 1000003));
+        views.assign(items.begin(), items.end());
+        db.sadd(add("set:intset:" + std::to_string(size)), views);
+    }
+    items.clear();
+    for (int i = 0; i < 600; i++)
+        items.push_back(std::to_string(i * 7));
+    views.assign(items.begin(), items.end());
+    db.sadd(add("set:integers"), views);
+
+    hash = add("hash:dict");
+    for (int i = 0; i < 300; i++)
+        db.hset(hash, "field:" + std::to_string(i), "value:" + std::to_string(i));
+    db.hset(add("hash:long-value"), "field", randomBytes(rng, 100));
+
+    // TTLs on one key of each type
+    db.set(add("ttl:string"), "expiring");
+    db.pexpire("ttl:string", 100000);
+    db.pexpire("hash:dict", 200000);
+    db.expire("set:listpack", 300);
+    db.pexpire("set:intset:300", 400000);
+    db.pexpire("list:quicklist:compressed", 500000);
+    return keys;
+}
+
+// The key's type and contents, sets and hashes sorted, each element with its
+// length so that binary values compare exactly
+static std::string describe(Db &db, std::string_view key)
+{
+    std::string out(db.type(key));
+    auto append = [&](std::string_view s) {
+        out += ' ';
+        out += std::to_string(s.size());
+        out += ':';
+        out += s;
+    };
+
+    if (out == "string")
+    {
+        append(db.get(key).value);
+    }
+    else if (out == "list")
+    {
+        for (const std::string &item : db.lrange(key, 0, -1).value)
+            append(item);
+    }
+    else if (out == "set")
+    {
+        std::vector<std::string> members = db.smembers(key).value;
+        std::sort(members.begin(), members.end());
+        for (const std::string &member : members)
+            append(member);
+    }
+    else if (out == "hash")
+    {
+        std::vector<std::pair<std::string, std::string>> fields = db.hgetall(key).value;
+        std::sort(fields.begin(), fields.end());
+        for (const auto &field : fields)
+        {
+            append(field.first);
+            append(field.second);
+        }
+    }
+    return out;
+}
+
+// ============== Check ==============
+
+int main(int argc, char *argv[])
+{
+    std::string dir = argc > 1 ? argv[1] : "/tmp/check_rewrite";
+    ::mkdir(dir.c_str(), 0755);
+    if (!emptyDirectory(dir + "/a") || !emptyDirectory(dir + "/b"))
+    {
+        std::fprintf(stderr, "cannot use %s\n", dir.c_str());
+        return 1;
+    }
+
+    // Small list nodes, compressed but for the one at each end
+    PackLimits limits;
+    limits.list_node_bytes = 256;
+    limits.list_compress_depth = 1;
+    Value::setPackLimits(limits);
+
+    std::vector<std::string> keys;
+    std::vector<std::string> expected;
+    std::vector<long long> expected_ttls;
+    {
+        Db db(dir + "/a/dump.rdb", dir + "/a/dump.aof");
+        keys = fill(db);
+        if (db.bgrewriteaof() != DbStatus::OK)
+        {
+            std::fprintf(stderr, "BGREWRITEAOF did not start\n");
+            return 1;
+        }
+        while (db.saveInfo().rewrite_in_progress)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (!db.saveInfo().last_rewrite_ok)
+        {
+            std::fprintf(stderr, "BGREWRITEAOF failed\n");
+            return 1;
+        }
+        for (const std::string &key : keys)
+        {
+            expected.push_back(describe(db, key));
+            expected_ttls.push_back(db.pttl(key));
+        }
+
+        // Only the base goes into the second directory, so that is all it
+        // loads. Copied now: the snapshot taken on shutdown supersedes it.
+        std::string base = newestBase(dir + "/a");
+        if (base.empty())
+        {
+            std::fprintf(stderr, "no AOF base in %s/a\n", dir.c_str());
+            return 1;
+        }
+        std::ifstream in(dir + "/a/" + base, std::ios::binary);
+        std::ofstream out(dir + "/b/" + base, std::ios::binary);
+        out << in.rdbuf();
+    }
+
+    Db db(dir + "/b/dump.rdb", dir + "/b/dump.aof");
+    size_t bad = 0;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        // TTLs were measured after the rewrite and are rounded up in it, so
+        // the reloaded one may differ a little either way
+        long long ttl = db.pttl(keys[i]);
+        bool ttl_ok = expected_ttls[i] < 0 ? ttl == expected_ttls[i] : ttl > 0 && std::abs(ttl - expected_ttls[i]) < 5000;
+        if (describe(db, keys[i]) != expected[i] || !ttl_ok)
+        {
+            std::fprintf(stderr, "%s differs after the rewrite (TTL %lld, was %lld)\n", keys[i].c_str(), ttl,
+                         expected_ttls[i]);
+            bad++;
+        }
+    }
+    std::printf("%zu keys, %zu differ\n", keys.size(), bad);
+    return bad == 0 ? 0 : 1;
+}
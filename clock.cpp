@@ -0,0 +1,71 @@
+#include "clock.h"
+#include <atomic>
+#include <thread>
+
+namespace
+{
+// Shared by all threads. Intentionally never destroyed, like the logger:
+// the ticker thread is detached and runs until the process exits.
+struct ClockState
+{
+    std::atomic<int64_t> steady_ns{0};
+    std::atomic<int64_t> unix_ms{0};
+    std::thread ticker;
+
+    void update()
+    {
+        steady_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch()).count(),
+                        std::memory_order_relaxed);
+        unix_ms.store(std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch()).count(),
+                      std::memory_order_relaxed);
+    }
+};
+
+void tickerLoop(ClockState *state)
+{
+    while (true)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        state->update();
+    }
+}
+
+ClockState &state()
+{
+    static ClockState *instance = []() {
+        ClockState *s = new ClockState();
+        s->update();
+        s->ticker = std::thread(tickerLoop, s);
+        s->ticker.detach();
+        return s;
+    }();
+    return *instance;
+}
+} // namespace
+
+Clock::time_point Clock::now()
+{
+    return time_point(std::chrono::nanoseconds(state().steady_ns.load(std::memory_order_relaxed)));
+}
+
+int64_t Clock::unixMs()
+{
+    return state().unix_ms.load(std::memory_order_relaxed);
+}
+
+Clock::time_point Clock::fromUnixMs(int64_t unix_ms)
+{
+    const int64_t CENTURY_MS = 100LL * 365 * 24 * 3600 * 1000;
+    int64_t now_ms = unixMs();
+    int64_t delta = unix_ms > now_ms + CENTURY_MS   ? CENTURY_MS
+                    : unix_ms < now_ms - CENTURY_MS ? -CENTURY_MS
+                                                    : unix_ms - now_ms;
+    return now() + std::chrono::milliseconds(delta);
+}
+
+int64_t Clock::toUnixMs(time_point when)
+{
+    return unixMs() + std::chrono::duration_cast<std::chrono::milliseconds>(when - now()).count();
+}
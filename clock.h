@@ -0,0 +1,30 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+// Coarse server clock for expiry checks and TTL replies. A background thread
+// refreshes the cached time about once a millisecond, so hot paths read an
+// atomic instead of calling into the kernel's clock. The steady and unix
+// readings are refreshed on the same tick.
+//
+// A forked child has no ticker thread: it sees the time of the fork, which
+// is exactly the point in time its snapshot describes.
+class Clock
+{
+public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    static time_point now();
+
+    // Milliseconds since the unix epoch, as of the same tick as now()
+    static int64_t unixMs();
+
+    // Converts between steady time points and unix milliseconds. Times more
+    // than a century away are clamped, so the time point cannot overflow.
+    static time_point fromUnixMs(int64_t unix_ms);
+    static int64_t toUnixMs(time_point when);
+};
+
+#endif
@@ -0,0 +1,701 @@
+#include "command.h"
+#include "resp.h"
+#include "clock.h"
+#include <charconv>
+#include <cstdint>
+
+// Parses a whole argument as a signed 64-bit integer
+static bool parseInteger(std::string_view arg, long long &out)
+{
+    const char *end = arg.data() + arg.size();
+    auto result = std::from_chars(arg.data(), end, out);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+static const char *WRONGTYPE_ERR = "WRONGTYPE Operation against a key holding the wrong kind of value";
+static const char *NOT_INTEGER_ERR = "ERR value is not an integer or out of range";
+
+// Maps a non-OK Db status to its RESP reply
+static std::string encodeStatus(DbStatus status)
+{
+    switch (status)
+    {
+    case DbStatus::NOT_FOUND:
+        return RESP::encodeNullBulkString();
+    case DbStatus::WRONG_TYPE:
+        return RESP::encodeError(WRONGTYPE_ERR);
+    case DbStatus::NOT_INTEGER:
+        return RESP::encodeError(NOT_INTEGER_ERR);
+    case DbStatus::OVERFLOW:
+        return RESP::encodeError("ERR increment or decrement would overflow");
+    case DbStatus::NO_SUCH_KEY:
+        return RESP::encodeError("ERR no such key");
+    case DbStatus::OUT_OF_RANGE:
+        return RESP::encodeError("ERR index out of range");
+    case DbStatus::TOO_LARGE:
+        return RESP::encodeError("ERR string exceeds maximum allowed size (512MB)");
+    case DbStatus::BUSY:
+        return RESP::encodeError("ERR Background save or AOF rewrite already in progress");
+    case DbStatus::IO_ERROR:
+        return RESP::encodeError("ERR failed to save snapshot");
+    default:
+        return RESP::encodeSimpleString("OK");
+    }
+}
+
+static std::string encodeInteger(const DbResult<long long> &result)
+{
+    return result.ok() ? RESP::encodeInteger(result.value) : encodeStatus(result.status);
+}
+
+static std::string encodeBool(const DbResult<bool> &result)
+{
+    return result.ok() ? RESP::encodeInteger(result.value ? 1 : 0) : encodeStatus(result.status);
+}
+
+static std::string encodeBulk(const DbResult<std::string> &result)
+{
+    return result.ok() ? RESP::encodeBulkString(result.value) : encodeStatus(result.status);
+}
+
+static std::string encodeArray(const DbResult<std::vector<std::string>> &result)
+{
+    return result.ok() ? RESP::encodeArray(result.value) : encodeStatus(result.status);
+}
+
+// ============== Connection Commands ==============
+
+static std::string cmdPing(Db &, const CommandArgs &args)
+{
+    if (args.size() == 1)
+        return RESP::encodeSimpleString("PONG");
+    return RESP::encodeBulkString(args[1]);
+}
+
+static std::string cmdEcho(Db &, const CommandArgs &args)
+{
+    return RESP::encodeBulkString(args[1]);
+}
+
+// ============== String Commands ==============
+
+static std::string cmdSet(Db &db, const CommandArgs &args)
+{
+    if (args.size() == 3)
+    {
+        db.set(args[1], args[2]);
+        return RESP::encodeSimpleString("OK");
+    }
+
+    // Join remaining arguments as value (for plain text values with spaces)
+    std::string value;
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        if (i > 2) value += " ";
+        value += args[i];
+    }
+    db.set(args[1], value);
+    return RESP::encodeSimpleString("OK");
+}
+
+static std::string cmdGet(Db &db, const CommandArgs &args)
+{
+    std::string reply;
+    DbStatus status = db.getBulk(args[1], reply);
+    return status == DbStatus::OK ? reply : encodeStatus(status);
+}
+
+static std::string cmdIncr(Db &db, const CommandArgs &args)
+{
+    return encodeInteger(db.incr(args[1]));
+}
+
+static std::string cmdIncrby(Db &db, const CommandArgs &args)
+{
+    long long amount;
+    if (!parseInteger(args[2], amount))
+        return RESP::encodeError(NOT_INTEGER_ERR);
+    return encodeInteger(db.incrby(args[1], amount));
+}
+
+static std::string cmdDecr(Db &db, const CommandArgs &args)
+{
+    return encodeInteger(db.decr(args[1]));
+}
+
+static std::string cmdDecrby(Db &db, const CommandArgs &args)
+{
+    long long amount;
+    if (!parseInteger(args[2], amount))
+        return RESP::encodeError(NOT_INTEGER_ERR);
+    return encodeInteger(db.decrby(args[1], amount));
+}
+
+static std::string cmdAppend(Db &db, const CommandArgs &args)
+{
+    return encodeInteger(db.append(args[1], args[2]));
+}
+
+static std::string cmdStrlen(Db &db, const CommandArgs &args)
+{
+    return encodeInteger(db.strlen(args[1]));
+}
+
+static std::string cmdMget(Db &db, const CommandArgs &args)
+{
+    std::vector<std::string_view> keys(args.begin() + 1, args.end());
+    auto values = db.mget(keys);
+
+    std::string reply = RESP::encodeArrayHeader(values.size());
+    for (const auto &value : values)
+        reply += value ? RESP::encodeBulkString(*value) : RESP::encodeNullBulkString();
+    return reply;
+}
+
+static std::string cmdMset(Db &db, const CommandArgs &args)
+{
+    if (args.size() % 2 == 0)
+        return RESP::encodeError("ERR wrong number of arguments for 'mset' command");
+    std::vector<std::string_view> keyvals(args.begin() + 1, args.end());
+    db.mset(keyvals);
+    return RESP::encodeSimpleString("OK");
+}
+
+static std::string cmdGetrange(Db &db, const CommandArgs &args)
+{
+    long long start, end;
+    if (!parseInteger(args[2], start) || !parseInteger(args[3], end))
+        return RESP::encodeError(NOT_INTEGER_ERR);
+    return encodeBulk(db.getrange(args[1], start, end));
+}
+
+static std::string cmdSetrange(Db &db, const CommandArgs &args)
+{
+    long long offset;
+    if (!parseInteger(args[2], offset))
+        return RESP::encodeError(NOT_INTEGER_ERR);
+    auto result = db.setrange(args[1], offset, args[3]);
+    if (result.status == DbStatus::OUT_OF_RANGE)
+        return RESP::encodeError("ERR offset is out of range");
+    return encodeInteger(result);
+}
+
+// ============== Key Commands ==============
+
+static std::string cmdDel(Db &db, const CommandArgs &args)
+{
+    return RESP::encodeInteger(db.del(args[1]) ? 1 : 0);
+}
+
+static std::string cmdExists(Db &db, const CommandArgs &args)
+{
+    return RESP::encodeInteger(db.exists(args[1]) ? 1 : 0);
+}
+
+// Parses the time argument of EXPIRE (scale 1000), PEXPIRE (1) or PEXPIREAT
+// (0, already absolute) into unix milliseconds. Like Redis, rejects times
+// whose absolute value would overflow.
+static bool parseExpireTime(const char *name, std::string_view arg, long long scale, long long &unix_ms,
+                            std::string &error)
+{
+    long long amount;
+    if (!parseInteger(arg, amount))
+    {
+        error = RESP::encodeError(NOT_INTEGER_ERR);
+        return false;
+    }
+    if (scale == 0)
+    {
+        unix_ms = amount;
+        return true;
+    }
+
+    long long ms;
+    int64_t now = Clock::unixMs();
+    if (__builtin_mul_overflow(amount, scale, &ms) || __builtin_add_overflow(now, ms, &unix_ms))
+    {
+        error = RESP::encodeError(std::string("ERR invalid expire time in '") + name + "' command");
+        return false;
+    }
+    return true;
+}
+
+static std::string expireCommand(Db &db, const CommandArgs &args, const char *name, long long scale)
+{
+    long long unix_ms;
+    std::string error;
+    if (!parseExpireTime(name, args[2], scale, unix_ms, error))
+        return error;
+    return RESP::encodeInteger(db.pexpireat(args[1], unix_ms) ? 1 : 0);
+}
+
+static std::string cmdExpire(Db &db, const CommandArgs &args)
+{
+    return expireCommand(db, args, "expire", 1000);
+}
+
+static std::string cmdPexpire(Db &db, const CommandArgs &args)
+{
+    return expireCommand(db, args, "pexpire", 1);
+}
+
+static std::string cmdPexpireat(Db &db, const CommandArgs &args)
+{
+    return expireCommand(db, args, "pexpireat", 0);
+}
+
+static std::string cmdTtl(Db &db, const CommandArgs &args)
+{
+    return RESP::encodeInteger(db.ttl(args[1]));
+}
+
+static std::string cmdPttl(Db &db, const CommandArgs &args)
+{
+    return RESP::encodeInteger(db.pttl(args[1]));
+}
+
+static std::string cmdPersist(Db &db, const CommandArgs &args)
+{
+    return RESP::encodeInteger(db.persist(args[1]) ? 1 : 0);
+}
+
+static std::string cmdType(Db &db, const CommandArgs &args)
+{
+    return RESP::encodeSimpleString(db.type(args[1]));
+}
+
+// ============== List Commands ==============
+
+static std::string cmdLpush(Db &db, const CommandArgs &args)
+{
+    std::vector<std::string_view> values(args.begin() + 2, args.end());
+    return encodeInteger(db.lpush(args[1], values));
+}
+
+static std::string cmdRpush(Db &db, const CommandArgs &args)
+{
+    std::vector<std::string_view> values(args.begin() + 2, args.end());
+    return encodeInteger(db.rpush(args[1], values));
+}
+
+static std::string cmdLpop(Db &db, const CommandArgs &args)
+{
+    return encodeBulk(db.lpop(args[1]));
+}
+
+static std::string cmdRpop(Db &db, const CommandArgs &args)
+{
+    return encodeBulk(db.rpop(args[1]));
+}
+
+static std::string cmdLlen(Db &db, const CommandArgs &args)
+{
+    return encodeInteger(db.llen(args[1]));
+}
+
+static std::string cmdLrange(Db &db, const CommandArgs &args)
+{
+    long long start, stop;
+    if (!parseInteger(args[2], start) || !parseInteger(args[3], stop))
+        return RESP::encodeError(NOT_INTEGER_ERR);
+    return encodeArray(db.lrange(args[1], start, stop));
+}
+
+static std::string cmdLindex(Db &db, const CommandArgs &args)
+{
+    long long index;
+    if (!parseInteger(args[2], index))
+        return RESP::encodeError(NOT_INTEGER_ERR);
+    return encodeBulk(db.lindex(args[1], index));
+}
+
+static std::string cmdLset(Db &db, const CommandArgs &args)
+{
+    long long index;
+    if (!parseInteger(args[2], index))
+        return RESP::encodeError(NOT_INTEGER_ERR);
+    return encodeStatus(db.lset(args[1], index, args[3]));
+}
+
+// ============== Set Commands ==============
+
+static std::string cmdSadd(Db &db, const CommandArgs &args)
+{
+    std::vector<std::string_view> members(args.begin() + 2, args.end());
+    return encodeInteger(db.sadd(args[1], members));
+}
+
+static std::string cmdSrem(Db &db, const CommandArgs &args)
+{
+    return encodeInteger(db.srem(args[1], args[2]));
+}
+
+static std::string cmdSmembers(Db &db, const CommandArgs &args)
+{
+    return encodeArray(db.smembers(args[1]));
+}
+
+static std::string cmdSismember(Db &db, const CommandArgs &args)
+{
+    return encodeBool(db.sismember(args[1], args[2]));
+}
+
+static std::string cmdScard(Db &db, const CommandArgs &args)
+{
+    return encodeInteger(db.scard(args[1]));
+}
+
+// ============== Hash Commands ==============
+
+static std::string cmdHset(Db &db, const CommandArgs &args)
+{
+    return encodeBool(db.hset(args[1], args[2], args[3]));
+}
+
+static std::string cmdHget(Db &db, const CommandArgs &args)
+{
+    return encodeBulk(db.hget(args[1], args[2]));
+}
+
+static std::string cmdHdel(Db &db, const CommandArgs &args)
+{
+    return encodeBool(db.hdel(args[1], args[2]));
+}
+
+static std::string cmdHgetall(Db &db, const CommandArgs &args)
+{
+    auto result = db.hgetall(args[1]);
+    if (!result.ok())
+        return encodeStatus(result.status);
+
+    // Flatten pairs into array
+    std::string reply = RESP::encodeArrayHeader(result.value.size() * 2);
+    for (const auto &p : result.value)
+    {
+        reply += RESP::encodeBulkString(p.first);
+        reply += RESP::encodeBulkString(p.second);
+    }
+    return reply;
+}
+
+static std::string cmdHkeys(Db &db, const CommandArgs &args)
+{
+    return encodeArray(db.hkeys(args[1]));
+}
+
+static std::string cmdHvals(Db &db, const CommandArgs &args)
+{
+    return encodeArray(db.hvals(args[1]));
+}
+
+static std::string cmdHlen(Db &db, const CommandArgs &args)
+{
+    return encodeInteger(db.hlen(args[1]));
+}
+
+static std::string cmdHexists(Db &db, const CommandArgs &args)
+{
+    return encodeBool(db.hexists(args[1], args[2]));
+}
+
+// ============== Server Commands ==============
+
+static std::string cmdSave(Db &db, const CommandArgs &)
+{
+    return encodeStatus(db.save());
+}
+
+static std::string cmdBgsave(Db &db, const CommandArgs &)
+{
+    DbStatus status = db.bgsave();
+    if (status != DbStatus::OK)
+        return encodeStatus(status);
+    return RESP::encodeSimpleString("Background saving started");
+}
+
+static std::string cmdBgrewriteaof(Db &db, const CommandArgs &)
+{
+    DbStatus status = db.bgrewriteaof();
+    if (status == DbStatus::IO_ERROR)
+        return RESP::encodeError("ERR failed to start AOF rewrite");
+    if (status != DbStatus::OK)
+        return encodeStatus(status);
+    return RESP::encodeSimpleString("Background append only file rewriting started");
+}
+
+static std::string cmdLastsave(Db &db, const CommandArgs &)
+{
+    return RESP::encodeInteger(db.saveInfo().last_save_time);
+}
+
+// INFO [section]: the persistence and stats sections, whatever is asked for
+static std::string cmdInfo(Db &db, const CommandArgs &)
+{
+    AofWriter::Stats aof = db.aofStats();
+
+    Db::SaveInfo save = db.saveInfo();
+
+    std::string info = "# Persistence\r\n";
+    info += "rdb_changes_since_last_save:" + std::to_string(save.changes_since_last_save) + "\r\n";
+    info += "rdb_bgsave_in_progress:" + std::to_string(save.bgsave_in_progress ? 1 : 0) + "\r\n";
+    info += "rdb_last_save_time:" + std::to_string(save.last_save_time) + "\r\n";
+    info += "rdb_last_bgsave_status:" + std::string(save.last_bgsave_ok ? "ok" : "err") + "\r\n";
+    info += "rdb_last_bgsave_time_sec:" + std::to_string(save.last_bgsave_seconds) + "\r\n";
+    info += "rdb_lazy_pending_values:" + std::to_string(save.lazy_pending) + "\r\n";
+    info += "aof_rewrite_in_progress:" + std::to_string(save.rewrite_in_progress ? 1 : 0) + "\r\n";
+    info += "aof_last_bgrewrite_status:" + std::string(save.last_rewrite_ok ? "ok" : "err") + "\r\n";
+    info += "aof_last_rewrite_time_sec:" + std::to_string(save.last_rewrite_seconds) + "\r\n";
+    info += "aof_current_size:" + std::to_string(save.aof_current_size) + "\r\n";
+    info += "aof_base_size:" + std::to_string(save.aof_base_size) + "\r\n";
+    info += "aof_fsync:" + std::string(AofWriter::policyName(db.aofFsync())) + "\r\n";
+    info += "aof_writes:" + std::to_string(aof.records) + "\r\n";
+    info += "aof_batches:" + std::to_string(aof.batches) + "\r\n";
+    info += "aof_last_batch_writes:" + std::to_string(aof.last_batch) + "\r\n";
+    info += "aof_max_batch_writes:" + std::to_string(aof.max_batch) + "\r\n";
+    info += "aof_fsyncs:" + std::to_string(aof.fsyncs) + "\r\n";
+    info += "aof_last_fsync_us:" + std::to_string(aof.last_fsync_us) + "\r\n";
+    info += "aof_max_fsync_us:" + std::to_string(aof.max_fsync_us) + "\r\n";
+    info += "aof_avg_fsync_us:" + std::to_string(aof.fsyncs ? aof.total_fsync_us / aof.fsyncs : 0) + "\r\n";
+
+    Db::ExpiryInfo expiry = db.expiryInfo();
+    info += "\r\n# Stats\r\n";
+    info += "expired_keys:" + std::to_string(expiry.expired_keys) + "\r\n";
+    info += "expired_keys_per_sec:" + std::to_string(expiry.expired_per_sec) + "\r\n";
+    info += "expired_backlog:" + std::to_string(expiry.backlog) + "\r\n";
+    return RESP::encodeBulkString(info);
+}
+
+static std::string cmdCommand(Db &db, const CommandArgs &args);
+
+// ============== Command Table ==============
+
+static constexpr CommandSpec COMMAND_TABLE[] = {
+    // name        arity  flags                     keys       handler
+    {"ping",       -1,    CMD_FAST,                  0, 0, 0,  cmdPing},
+    {"echo",        2,    CMD_FAST,                  0, 0, 0,  cmdEcho},
+    {"command",    -1,    0,                         0, 0, 0,  cmdCommand},
+    {"save",        1,    CMD_ADMIN,                 0, 0, 0,  cmdSave},
+    {"bgsave",      1,    CMD_ADMIN,                 0, 0, 0,  cmdBgsave},
+    {"bgrewriteaof", 1,   CMD_ADMIN,                 0, 0, 0,  cmdBgrewriteaof},
+    {"lastsave",    1,    CMD_FAST,                  0, 0, 0,  cmdLastsave},
+    {"info",       -1,    0,                         0, 0, 0,  cmdInfo},
+
+    {"set",        -3,    CMD_WRITE,                 1, 1, 1,  cmdSet},
+    {"get",         2,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdGet},
+    {"incr",        2,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdIncr},
+    {"incrby",      3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdIncrby},
+    {"decr",        2,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdDecr},
+    {"decrby",      3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdDecrby},
+    {"append",      3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdAppend},
+    {"strlen",      2,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdStrlen},
+    {"mget",       -2,    CMD_READONLY | CMD_FAST,   1, -1, 1, cmdMget},
+    {"mset",       -3,    CMD_WRITE,                 1, -1, 2, cmdMset},
+    {"getrange",    4,    CMD_READONLY,              1, 1, 1,  cmdGetrange},
+    {"setrange",    4,    CMD_WRITE,                 1, 1, 1,  cmdSetrange},
+
+    {"del",         2,    CMD_WRITE,                 1, 1, 1,  cmdDel},
+    {"exists",      2,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdExists},
+    {"expire",      3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdExpire},
+    {"pexpire",     3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdPexpire},
+    {"pexpireat",   3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdPexpireat},
+    {"ttl",         2,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdTtl},
+    {"pttl",        2,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdPttl},
+    {"persist",     2,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdPersist},
+    {"type",        2,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdType},
+
+    {"lpush",      -3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdLpush},
+    {"rpush",      -3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdRpush},
+    {"lpop",        2,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdLpop},
+    {"rpop",        2,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdRpop},
+    {"llen",        2,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdLlen},
+    {"lrange",      4,    CMD_READONLY,              1, 1, 1,  cmdLrange},
+    {"lindex",      3,    CMD_READONLY,              1, 1, 1,  cmdLindex},
+    {"lset",        4,    CMD_WRITE,                 1, 1, 1,  cmdLset},
+
+    {"sadd",       -3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdSadd},
+    {"srem",        3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdSrem},
+    {"smembers",    2,    CMD_READONLY,              1, 1, 1,  cmdSmembers},
+    {"sismember",   3,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdSismember},
+    {"scard",       2,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdScard},
+
+    {"hset",        4,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdHset},
+    {"hget",        3,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdHget},
+    {"hdel",        3,    CMD_WRITE | CMD_FAST,      1, 1, 1,  cmdHdel},
+    {"hgetall",     2,    CMD_READONLY,              1, 1, 1,  cmdHgetall},
+    {"hkeys",       2,    CMD_READONLY,              1, 1, 1,  cmdHkeys},
+    {"hvals",       2,    CMD_READONLY,              1, 1, 1,  cmdHvals},
+    {"hlen",        2,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdHlen},
+    {"hexists",     3,    CMD_READONLY | CMD_FAST,   1, 1, 1,  cmdHexists},
+};
+
+static constexpr size_t COMMAND_COUNT = sizeof(COMMAND_TABLE) / sizeof(COMMAND_TABLE[0]);
+static constexpr size_t MAX_NAME_LEN = 16;
+
+// The lookup table has a power-of-two number of slots. At compile time we
+// search for a hash seed under which every command lands in its own slot, so
+// a lookup is one hash, one slot read and one comparison.
+static constexpr size_t SLOT_BITS = 8;
+static constexpr size_t SLOT_COUNT = size_t(1) << SLOT_BITS;
+
+static_assert(COMMAND_COUNT < SLOT_COUNT / 2, "grow SLOT_BITS when adding commands");
+
+static constexpr char foldCase(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+// FNV-1a over the lowercased name, mixed with a seed
+static constexpr uint32_t hashName(std::string_view name, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for (char c : name)
+    {
+        h ^= static_cast<unsigned char>(foldCase(c));
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    return h;
+}
+
+struct SlotTable
+{
+    uint32_t seed;
+    int8_t slots[SLOT_COUNT];   // Index into COMMAND_TABLE, -1 if empty
+};
+
+static constexpr SlotTable buildSlotTable()
+{
+    SlotTable table{};
+    for (uint32_t seed = 0; seed < 100000; seed++)
+    {
+        for (size_t i = 0; i < SLOT_COUNT; i++)
+            table.slots[i] = -1;
+
+        bool collision = false;
+        for (size_t i = 0; i < COMMAND_COUNT && !collision; i++)
+        {
+            size_t slot = hashName(COMMAND_TABLE[i].name, seed) & (SLOT_COUNT - 1);
+            if (table.slots[slot] != -1)
+                collision = true;
+            else
+                table.slots[slot] = static_cast<int8_t>(i);
+        }
+
+        if (!collision)
+        {
+            table.seed = seed;
+            return table;
+        }
+    }
+    table.seed = UINT32_MAX;
+    return table;
+}
+
+static constexpr SlotTable SLOT_TABLE = buildSlotTable();
+static_assert(SLOT_TABLE.seed != UINT32_MAX, "no perfect hash seed found for the command table");
+
+const CommandSpec *lookupCommand(std::string_view name)
+{
+    if (name.size() > MAX_NAME_LEN)
+        return nullptr;
+
+    int8_t index = SLOT_TABLE.slots[hashName(name, SLOT_TABLE.seed) & (SLOT_COUNT - 1)];
+    if (index < 0)
+        return nullptr;
+
+    const CommandSpec &spec = COMMAND_TABLE[index];
+    if (spec.name.size() != name.size())
+        return nullptr;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        if (foldCase(name[i]) != spec.name[i])
+            return nullptr;
+    }
+    return &spec;
+}
+
+std::string dispatchCommand(Db &db, const CommandArgs &args)
+{
+    if (args.empty())
+        return RESP::encodeError("ERR empty command");
+
+    const CommandSpec *spec = lookupCommand(args[0]);
+    if (spec == nullptr)
+        return RESP::encodeError("ERR unknown command '" + std::string(args[0]) + "'");
+
+    int argc = static_cast<int>(args.size());
+    if ((spec->arity > 0 && argc != spec->arity) || (spec->arity < 0 && argc < -spec->arity))
+        return RESP::encodeError("ERR wrong number of arguments for '" + std::string(spec->name) + "' command");
+
+    return spec->handler(db, args);
+}
+
+// ============== COMMAND Introspection ==============
+
+static std::string encodeCommandInfo(const CommandSpec &spec)
+{
+    static const struct
+    {
+        unsigned flag;
+        const char *name;
+    } FLAG_NAMES[] = {
+        {CMD_WRITE, "write"},
+        {CMD_READONLY, "readonly"},
+        {CMD_FAST, "fast"},
+        {CMD_ADMIN, "admin"},
+    };
+
+    std::string flags;
+    size_t flag_count = 0;
+    for (const auto &f : FLAG_NAMES)
+    {
+        if (spec.flags & f.flag)
+        {
+            flags += RESP::encodeSimpleString(f.name);
+            flag_count++;
+        }
+    }
+
+    // Same layout as Redis: name, arity, flags, first key, last key, step
+    std::string reply = RESP::encodeArrayHeader(6);
+    reply += RESP::encodeBulkString(spec.name);
+    reply += RESP::encodeInteger(spec.arity);
+    reply += RESP::encodeArrayHeader(flag_count);
+    reply += flags;
+    reply += RESP::encodeInteger(spec.first_key);
+    reply += RESP::encodeInteger(spec.last_key);
+    reply += RESP::encodeInteger(spec.key_step);
+    return reply;
+}
+
+// COMMAND, COMMAND COUNT, COMMAND INFO name [name ...]
+static std::string cmdCommand(Db &, const CommandArgs &args)
+{
+    if (args.size() == 1)
+    {
+        std::string reply = RESP::encodeArrayHeader(COMMAND_COUNT);
+        for (const CommandSpec &spec : COMMAND_TABLE)
+            reply += encodeCommandInfo(spec);
+        return reply;
+    }
+
+    std::string sub(args[1]);
+    for (char &c : sub)
+        c = foldCase(c);
+
+    if (sub == "count" && args.size() == 2)
+        return RESP::encodeInteger(COMMAND_COUNT);
+
+    if (sub == "info")
+    {
+        std::string reply = RESP::encodeArrayHeader(args.size() - 2);
+        for (size_t i = 2; i < args.size(); i++)
+        {
+            const CommandSpec *spec = lookupCommand(args[i]);
+            reply += spec ? encodeCommandInfo(*spec) : RESP::encodeNullArray();
+        }
+        return reply;
+    }
+
+    return RESP::encodeError("ERR unknown subcommand '" + std::string(args[1]) + "'");
+}
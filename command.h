@@ -0,0 +1,40 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "db.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+using CommandArgs = std::vector<std::string_view>;
+using CommandHandler = std::string (*)(Db &db, const CommandArgs &args);
+
+// Command flags, reported by COMMAND
+enum CommandFlag : unsigned
+{
+    CMD_WRITE = 1 << 0,     // May modify the keyspace
+    CMD_READONLY = 1 << 1,  // Only reads data
+    CMD_FAST = 1 << 2,      // O(1) or O(log N)
+    CMD_ADMIN = 1 << 3      // Server administration (SAVE, ...)
+};
+
+struct CommandSpec
+{
+    std::string_view name;  // Lowercase, as reported by COMMAND
+    int arity;              // Argument count including the name; -N means at least N
+    unsigned flags;
+    int first_key;          // Position of the first key argument (0 = no keys)
+    int last_key;           // Position of the last key, -1 = last argument
+    int key_step;           // Distance between key arguments
+    CommandHandler handler;
+};
+
+// Case-insensitive lookup in the command table. O(1) and allocation free:
+// the table is indexed by a perfect hash computed at compile time.
+// Returns nullptr for unknown commands.
+const CommandSpec *lookupCommand(std::string_view name);
+
+// Checks arity and runs the command, returning the encoded RESP reply
+std::string dispatchCommand(Db &db, const CommandArgs &args);
+
+#endif
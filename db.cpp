@@ -1,53 +1,27 @@
 #include "db.h"
+#include "log.h"
+#include "resp.h"
+#include "rdb.h"
+#include "clock.h"
+#include "hash.h"
 #include <cstdio>
-#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <climits>
 #include <vector>
 #include <sstream>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
-static std::string jsonEscape(const std::string &s)
-{
-    std::string out;
-    out.reserve(s.size());
-    for (unsigned char c : s)
-    {
-        switch (c)
-        {
-        case '\"':
-            out += "\\\"";
-            break;
-        case '\\':
-            out += "\\\\";
-            break;
-        case '\b':
-            out += "\\b";
-            break;
-        case '\f':
-            out += "\\f";
-            break;
-        case '\n':
-            out += "\\n";
-            break;
-        case '\r':
-            out += "\\r";
-            break;
-        case '\t':
-            out += "\\t";
-            break;
-        default:
-            if (c < 0x20)
-            {
-                char buf[7];
-                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
-                out += buf;
-            }
-            else
-            {
-                out += static_cast<char>(c);
-            }
-        }
-    }
-    return out;
-}
 static std::string jsonUnescape(const std::string &s)
 {
     std::string out;
@@ -87,115 +61,754 @@ static std::string jsonUnescape(const std::string &s)
     return out;
 }
 
-Db::Db(const std::string &rdb_file, const std::string &aof_file, int auto_save_interval)
-    : rdb_filename_(rdb_file), aof_filename_(aof_file), auto_save_interval_(auto_save_interval)
+Db::Db(const std::string &rdb_file, const std::string &aof_file, int auto_save_interval, size_t shard_count,
+       AofFsync aof_fsync, int aof_rewrite_percentage, long long aof_rewrite_min_size, bool lazy_load)
+    : shards_(shard_count > 0 ? shard_count : 1), lazy_load_(lazy_load),
+      rdb_filename_(rdb_file), aof_filename_(aof_file), aof_fsync_(aof_fsync),
+      auto_save_interval_(auto_save_interval),
+      aof_rewrite_percentage_(aof_rewrite_percentage), aof_rewrite_min_size_(aof_rewrite_min_size)
 {
-    loadRDB();
-    loadAOF();
-
-    aof_file_.open(aof_filename_, std::ios::app);
     last_save_time_ = std::chrono::steady_clock::now();
 
-    std::cout << "# Database loaded from " << rdb_filename_
-              << " and " << aof_filename_ << std::endl;
+    // Start from the snapshot unless a later AOF rewrite superseded it
+    RDB::Index index;
+    uint64_t snapshot_seq = RDB::readIndex(rdb_filename_, index) ? index.aof_seq : 0;
+    std::vector<uint64_t> bases = listAOFFiles(".base");
+    uint64_t start_seq = 0;
+
+    if (!bases.empty() && bases.back() > snapshot_seq)
+    {
+        start_seq = bases.back();
+        LOG_INFO("# Loading AOF base " << aofBaseName(start_seq));
+        replayAOF(aofBaseName(start_seq));
+    }
+    else
+    {
+        loadRDB(start_seq);
+    }
+    loadAOF(start_seq);
+    for (Shard &shard : shards_)
+        rebuildExpiryIndex(shard);
+    expire_sample_time_ = std::chrono::steady_clock::now();
+
+    aof_.open(aofSegmentName(aof_seq_), aof_fsync_);
+    updateAOFSize();
+    aof_base_size_ = aofSize();
+    last_save_unix_ = std::time(nullptr);
+    cron_ = std::thread(&Db::cronLoop, this);
+
+    LOG_INFO("# Database loaded from " << rdb_filename_
+             << " and " << aof_filename_);
 }
 
 Db::~Db()
 {
-    aof_file_.close();
-    saveRDB();
+    {
+        std::lock_guard<std::mutex> lock(cron_mutex_);
+        cron_stop_ = true;
+    }
+    cron_wake_.notify_one();
+    cron_.join();
+
+    {
+        std::lock_guard<std::mutex> save_lock(save_mutex_);
+        reapChild(true);
+        snapshot();
+    }
+    aof_.close();
+
+    LOG_INFO("# Database saved to " << rdb_filename_);
+}
+
+// Appends one command as a RESP array of bulk strings. RESP framing keeps
+// the AOF binary safe: values may contain spaces, newlines or anything else.
+static void appendCommand(std::string &out, std::initializer_list<std::string_view> args,
+                          const std::vector<std::string_view> &rest = {})
+{
+    out += RESP::encodeArrayHeader(args.size() + rest.size());
+    for (std::string_view arg : args)
+        out += RESP::encodeBulkString(arg);
+    for (std::string_view arg : rest)
+        out += RESP::encodeBulkString(arg);
+}
+
+// Queues the command for the AOF writer thread. Called with the key's shard
+// lock held, so records for one key reach the file in execution order.
+void Db::logToAOF(std::initializer_list<std::string_view> args)
+{
+    if (replaying_)
+        return;
+
+    std::string record;
+    appendCommand(record, args);
+    aof_.append(std::move(record));
+    dirty_++;
+}
+
+// Variadic commands (LPUSH, RPUSH, SADD) log all their values in one record
+void Db::logToAOF(std::string_view cmd, std::string_view key, const std::vector<std::string_view> &values)
+{
+    if (replaying_)
+        return;
 
-    std::cout << "# Database saved to " << rdb_filename_ << std::endl;
+    std::string record;
+    appendCommand(record, {cmd, key}, values);
+    aof_.append(std::move(record));
+    dirty_ += values.size();
 }
 
-void Db::logToAOF(const std::string &command)
+// Runs on the cron thread about ten times a second
+void Db::cronLoop()
 {
-    if (aof_file_.is_open())
+    std::unique_lock<std::mutex> lock(cron_mutex_);
+    while (!cron_stop_)
     {
-        aof_file_ << command << std::endl;
-        aof_file_.flush();
+        cron_wake_.wait_for(lock, std::chrono::milliseconds(100));
+        if (cron_stop_)
+            break;
+
+        lock.unlock();
+        checkAutoSave();
+        checkAutoRewrite();
+        decodeSome();
+        rehashSome();
+        expireSome();
+        sampleExpiryStats();
+        lock.lock();
     }
 }
 
+// Reaps a finished child and starts a BGSAVE once the auto-save interval has
+// passed with unsaved changes
 void Db::checkAutoSave()
 {
+    std::lock_guard<std::mutex> save_lock(save_mutex_);
+    reapChild(false);
+
+    if (child_pid_ > 0 || dirty_.load() == 0)
+    {
+        return;
+    }
+
     auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - last_save_time_).count();
+    if (now - last_save_time_ < std::chrono::seconds(auto_save_interval_))
+    {
+        return;
+    }
 
-    if (elapsed >= auto_save_interval_)
+    // Retry a failed save only after a short delay
+    if (!last_bgsave_ok_.load() && now - child_started_ < std::chrono::seconds(5))
     {
-        std::cout << "# Auto-saving..." << std::endl;
-        saveRDB();
-        startNewAOF();
-        last_save_time_ = now;
+        return;
     }
+
+    LOG_INFO("# " << dirty_.load() << " changes in " << auto_save_interval_ << " seconds. Saving...");
+    startBgsave();
 }
 
-bool Db::saveRDB()
+// Starts a rewrite once the AOF has outgrown its post-compaction size by the
+// configured percentage, as Redis's auto-aof-rewrite-percentage
+void Db::checkAutoRewrite()
 {
-    std::ofstream file(rdb_filename_);
-    if (!file.is_open())
+    if (aof_rewrite_percentage_ <= 0)
     {
-        std::cout << "(error) Failed to open RDB file for writing" << std::endl;
-        return false;
+        return;
+    }
+
+    std::lock_guard<std::mutex> save_lock(save_mutex_);
+    if (child_pid_ > 0)
+    {
+        return;
+    }
+
+    long long size = aofSize();
+    long long base = std::max(aof_base_size_.load(), 1LL);
+    if (size < aof_rewrite_min_size_ || (size - base) * 100 / base < aof_rewrite_percentage_)
+    {
+        return;
+    }
+
+    if (!last_rewrite_ok_.load() && std::chrono::steady_clock::now() - child_started_ < std::chrono::seconds(5))
+    {
+        return;
     }
 
-    file << "{\n";
+    LOG_INFO("# AOF is " << size << " bytes, " << (size - base) * 100 / base
+             << "% growth since the last compaction. Rewriting...");
+    startRewrite();
+}
 
-    bool first = true;
+// Forks a child that writes the snapshot from its copy-on-write view of the
+// keyspace while the parent keeps serving. With every shard locked, the AOF
+// moves to a new segment and the fork is taken at the same instant, so the
+// older segments hold exactly what the snapshot contains and the new one
+// everything after it. Caller must hold save_mutex_.
+DbStatus Db::startBgsave()
+{
+    if (child_pid_ > 0)
+    {
+        return DbStatus::BUSY;
+    }
 
-    for (const auto &pair : bucketstore)
+    pid_t pid;
     {
-        const std::string &key = pair.first;
-        const Value &val = pair.second;
+        std::vector<std::shared_lock<std::shared_mutex>> locks = lockAllShards();
 
-        if (val.isExpired())
+        if (!rotateAOF())
         {
-            continue;
+            return DbStatus::IO_ERROR;
+        }
+
+        pid = fork();
+        if (pid == 0)
+        {
+            // Child: only this thread survived the fork, so no locking and no
+            // logging (the logger's mutex may have been copied while held)
+            _exit(writeRDB(tempRDBName(getpid()), aof_seq_) ? 0 : 1);
+        }
+
+        if (pid < 0)
+        {
+            // The extra segment is harmless; the next save cleans it up
+            LOG_ERROR("Can't save in background: fork: " << strerror(errno));
+            last_bgsave_ok_ = false;
+            child_started_ = std::chrono::steady_clock::now();
+            return DbStatus::IO_ERROR;
+        }
+
+        dirty_at_fork_ = dirty_.load();
+        child_aof_seq_ = aof_seq_;
+    }
+
+    child_pid_ = pid;
+    child_type_ = ChildType::BGSAVE;
+    bgsave_running_ = true;
+    child_started_ = std::chrono::steady_clock::now();
+    updateAOFSize();
+    LOG_INFO("# Background saving started by pid " << pid);
+    return DbStatus::OK;
+}
+
+// Same as startBgsave(), but the child writes the keyspace as an AOF base.
+// Writes made meanwhile go to the new segment, which is replayed after the
+// base, so nothing has to be buffered and copied over at the end.
+// Caller must hold save_mutex_.
+DbStatus Db::startRewrite()
+{
+    if (child_pid_ > 0)
+    {
+        return DbStatus::BUSY;
+    }
+
+    pid_t pid;
+    {
+        std::vector<std::shared_lock<std::shared_mutex>> locks = lockAllShards();
+
+        if (!rotateAOF())
+        {
+            return DbStatus::IO_ERROR;
+        }
+
+        pid = fork();
+        if (pid == 0)
+        {
+            // Child: same rules as for BGSAVE
+            _exit(writeAOFBase(aofBaseName(aof_seq_) + ".tmp." + std::to_string(getpid())) ? 0 : 1);
         }
 
-        if (!first)
+        if (pid < 0)
         {
-            file << ",\n";
+            LOG_ERROR("Can't rewrite AOF in background: fork: " << strerror(errno));
+            last_rewrite_ok_ = false;
+            child_started_ = std::chrono::steady_clock::now();
+            return DbStatus::IO_ERROR;
         }
-        first = false;
 
-        file << "  \"" << key << "\": {\n";
+        child_aof_seq_ = aof_seq_;
+    }
+
+    child_pid_ = pid;
+    child_type_ = ChildType::REWRITE;
+    rewrite_running_ = true;
+    child_started_ = std::chrono::steady_clock::now();
+    updateAOFSize();
+    LOG_INFO("# Background append only file rewriting started by pid " << pid);
+    return DbStatus::OK;
+}
+
+// Collects the child if it has exited (or waits for it when `block`).
+// Caller must hold save_mutex_.
+void Db::reapChild(bool block)
+{
+    if (child_pid_ <= 0)
+    {
+        return;
+    }
 
-        if (val.type == ValueType::STRING)
+    int status = 0;
+    pid_t done = waitpid(child_pid_, &status, block ? 0 : WNOHANG);
+    if (done == 0 || (done < 0 && errno == EINTR))
+    {
+        return;
+    }
+
+    bool ok = done == child_pid_ && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    auto now = std::chrono::steady_clock::now();
+    long long seconds = std::chrono::duration_cast<std::chrono::seconds>(now - child_started_).count();
+
+    if (child_type_ == ChildType::BGSAVE)
+    {
+        last_bgsave_seconds_ = seconds;
+        last_bgsave_ok_ = ok;
+
+        if (ok)
         {
-            file << "    \"type\": \"string\",\n";
-            file << "    \"value\": \"" << jsonEscape(val.str()) << "\"";
+            dirty_ -= dirty_at_fork_;
+            last_save_time_ = now;
+            last_save_unix_ = std::time(nullptr);
+            LOG_INFO("# Background saving terminated with success, " << dirty_.load() << " changes since");
         }
-        else if (val.type == ValueType::INTEGER)
+        else
         {
-            file << "    \"type\": \"integer\",\n";
-            file << "    \"value\": " << val.integer();
+            // The previous snapshot and every segment after it are still in
+            // place, so there is nothing to undo
+            std::remove(tempRDBName(child_pid_).c_str());
+            LOG_WARNING("Background saving error");
         }
+        bgsave_running_ = false;
+    }
+    else
+    {
+        last_rewrite_seconds_ = seconds;
+        last_rewrite_ok_ = ok;
 
-        long long ttl = val.getTTL();
-        if (ttl >= 0)
+        if (ok)
         {
-            file << ",\n    \"ttl\": " << ttl;
+            LOG_INFO("# Background AOF rewrite terminated with success");
         }
         else
         {
-            file << ",\n    \"ttl\": -1";
+            std::remove((aofBaseName(child_aof_seq_) + ".tmp." + std::to_string(child_pid_)).c_str());
+            LOG_WARNING("Background AOF rewrite error");
         }
+        rewrite_running_ = false;
+    }
 
-        file << "\n  }";
+    if (ok)
+    {
+        removeAOFSegmentsBefore(child_aof_seq_);
+        updateAOFSize();
+        aof_base_size_ = aofSize();
     }
 
-    file << "\n}\n";
-    file.close();
+    child_pid_ = -1;
+    child_type_ = ChildType::NONE;
+}
+
+std::string Db::tempRDBName(pid_t pid) const
+{
+    return rdb_filename_ + ".tmp." + std::to_string(pid);
+}
+
+DbStatus Db::bgsave()
+{
+    std::lock_guard<std::mutex> save_lock(save_mutex_);
+    reapChild(false);
+    return startBgsave();
+}
 
-    std::cout << "OK" << std::endl;
+DbStatus Db::bgrewriteaof()
+{
+    std::lock_guard<std::mutex> save_lock(save_mutex_);
+    reapChild(false);
+    return startRewrite();
+}
+
+Db::SaveInfo Db::saveInfo() const
+{
+    SaveInfo info;
+    info.changes_since_last_save = dirty_.load();
+    info.bgsave_in_progress = bgsave_running_.load();
+    info.last_save_time = last_save_unix_.load();
+    info.last_bgsave_ok = last_bgsave_ok_.load();
+    info.last_bgsave_seconds = last_bgsave_seconds_.load();
+    info.rewrite_in_progress = rewrite_running_.load();
+    info.last_rewrite_ok = last_rewrite_ok_.load();
+    info.last_rewrite_seconds = last_rewrite_seconds_.load();
+    info.aof_current_size = aofSize();
+    info.aof_base_size = aof_base_size_.load();
+    info.lazy_pending = 0;
+    for (const Shard &shard : shards_)
+        info.lazy_pending += shard.encoded.load();
+    return info;
+}
+
+// Starts a new AOF segment and dumps the keyspace. Writers log to the AOF
+// while holding their shard lock, so keeping every shard locked across both
+// steps guarantees that the dump holds exactly the older segments' writes.
+// Caller must hold save_mutex_.
+DbStatus Db::snapshot()
+{
+    if (child_pid_ > 0)
+    {
+        return DbStatus::BUSY;
+    }
+
+    {
+        std::vector<std::shared_lock<std::shared_mutex>> locks = lockAllShards();
+        if (!rotateAOF())
+        {
+            return DbStatus::IO_ERROR;
+        }
+        if (!writeRDB(tempRDBName(getpid()), aof_seq_))
+        {
+            LOG_ERROR("Failed to write RDB file " << rdb_filename_);
+            return DbStatus::IO_ERROR;
+        }
+    }
+
+    removeAOFSegmentsBefore(aof_seq_);
+    updateAOFSize();
+    aof_base_size_ = aofSize();
+    dirty_ = 0;
+    last_save_time_ = std::chrono::steady_clock::now();
+    last_save_unix_ = std::time(nullptr);
+    return DbStatus::OK;
+}
+
+DbStatus Db::save()
+{
+    std::lock_guard<std::mutex> save_lock(save_mutex_);
+    reapChild(false);
+    return snapshot();
+}
+
+// Shared locks on every shard, acquired in index order
+std::vector<std::shared_lock<std::shared_mutex>> Db::lockAllShards() const
+{
+    std::vector<std::shared_lock<std::shared_mutex>> locks;
+    locks.reserve(shards_.size());
+    for (const Shard &shard : shards_)
+        locks.emplace_back(shard.mutex);
+    return locks;
+}
+
+// fsync() on a directory makes renames and newly created files in it durable
+static bool syncDirectory(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+// Writes the snapshot to tmp_filename, syncs it and renames it over the RDB
+// file, so a crash at any point leaves either the old or the new snapshot.
+// Caller must hold a lock on every shard (or be the BGSAVE child). Does not
+// log, so that it is safe to call in a forked child.
+bool Db::writeRDB(const std::string &tmp_filename, uint64_t aof_seq) const
+{
+    RDBWriter writer;
+    if (!writer.open(tmp_filename))
+    {
+        return false;
+    }
+
+    // Snapshots store expirations as unix milliseconds, because steady_clock
+    // time points do not survive a restart
+    auto steady_now = Clock::now();
+    int64_t unix_now = Clock::unixMs();
+
+    for (const Shard &shard : shards_)
+    {
+        for (const auto &pair : shard.bucketstore)
+        {
+            const Value &val = pair.second;
+            int64_t expire_at = 0;
+
+            if (const auto *when = expirationOf(shard, pair))
+            {
+                if (*when <= steady_now)
+                    continue;
+                expire_at = unix_now + std::chrono::duration_cast<std::chrono::milliseconds>(
+                    *when - steady_now).count() + 1;
+            }
+
+            writer.add(pair.first, val, expire_at);
+        }
+    }
+
+    if (!writer.finish(aof_seq) || std::rename(tmp_filename.c_str(), rdb_filename_.c_str()) != 0)
+    {
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    return syncDirectory(rdb_filename_);
+}
+
+// Writes the shortest command list that rebuilds the keyspace to
+// tmp_filename and renames it to the base of segment aof_seq_, with the same
+// durability steps as writeRDB(). Same locking and logging rules, too.
+bool Db::writeAOFBase(const std::string &tmp_filename) const
+{
+    // Large collections are split so no single command gets huge, like
+    // Redis's AOF_REWRITE_ITEMS_PER_CMD
+    const size_t ITEMS_PER_CMD = 64;
+    const size_t FLUSH_SIZE = 1 << 20;
+
+    int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    std::string buffer;
+    bool ok = true;
+    auto flush = [&]() {
+        for (size_t done = 0; ok && done < buffer.size();)
+        {
+            ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+            if (n > 0)
+                done += n;
+            else if (errno != EINTR)
+                ok = false;
+        }
+        buffer.clear();
+    };
+
+    auto steady_now = Clock::now();
+    int64_t unix_now = Clock::unixMs();
+
+    // Emits one command per ITEMS_PER_CMD elements of a collection. Each
+    // item is encoded into `items` as it arrives: the views the iteration
+    // callbacks pass are only valid during the call.
+    std::string items;
+    size_t item_count = 0;
+    auto finishBatch = [&](std::string_view cmd, std::string_view key) {
+        if (item_count == 0)
+            return;
+        buffer += RESP::encodeArrayHeader(2 + item_count);
+        buffer += RESP::encodeBulkString(cmd);
+        buffer += RESP::encodeBulkString(key);
+        buffer += items;
+        items.clear();
+        item_count = 0;
+    };
+    auto batch = [&](std::string_view cmd, std::string_view key, std::string_view item) {
+        items += RESP::encodeBulkString(item);
+        if (++item_count == ITEMS_PER_CMD)
+            finishBatch(cmd, key);
+    };
+
+    for (const Shard &shard : shards_)
+    {
+        for (const auto &pair : shard.bucketstore)
+        {
+            const std::string &key = pair.first;
+            const auto *when = expirationOf(shard, pair);
+
+            if (when != nullptr && *when <= steady_now)
+                continue;
+
+            // Lazily loaded values are decoded into a copy; this may be the
+            // forked child, which must not touch the shared counters
+            Value decoded;
+            if (pair.second.isEncoded())
+            {
+                EncodedValue encoded = pair.second.encoded();
+                if (!RDB::decodeValue(encoded.data, encoded.length, pair.second.type(), decoded))
+                    continue;
+            }
+            const Value &val = pair.second.isEncoded() ? decoded : pair.second;
+
+            switch (val.type())
+            {
+            case ValueType::STRING:
+                appendCommand(buffer, {"SET", key, val.str()});
+                break;
+            case ValueType::INTEGER:
+            {
+                // SET loads it back as an integer
+                Value::IntegerBuffer buf;
+                appendCommand(buffer, {"SET", key, val.text(buf)});
+                break;
+            }
+            case ValueType::LIST:
+                val.forEachMember([&](std::string_view item) { batch("RPUSH", key, item); });
+                finishBatch("RPUSH", key);
+                break;
+            case ValueType::SET:
+                val.forEachMember([&](std::string_view member) { batch("SADD", key, member); });
+                finishBatch("SADD", key);
+                break;
+            case ValueType::HASH:
+                val.forEachField([&](std::string_view field, std::string_view value) {
+                    appendCommand(buffer, {"HSET", key, field, value});
+                });
+                break;
+            }
+
+            if (when != nullptr)
+            {
+                // Absolute, as everywhere else in the AOF, so a replay does
+                // not restart the TTL; round up so the key never expires early
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(*when - steady_now).count();
+                appendCommand(buffer, {"PEXPIREAT", key, std::to_string(unix_now + ms + 1)});
+            }
+
+            if (buffer.size() >= FLUSH_SIZE)
+                flush();
+        }
+    }
+    flush();
+
+    ok = ok && fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || std::rename(tmp_filename.c_str(), aofBaseName(aof_seq_).c_str()) != 0)
+    {
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    return syncDirectory(aof_filename_);
+}
+
+// Loads the snapshot and reports the first AOF segment it does not cover
+// (0 if there is no snapshot or it predates segments). Exits the process if
+// the snapshot is corrupt.
+bool Db::loadRDB(uint64_t &aof_seq)
+{
+    aof_seq = 0;
+
+    std::string filename = rdb_filename_;
+
+    // Older versions wrote a JSON dump next to where the snapshot now lives
+    if (!std::ifstream(filename).is_open())
+    {
+        size_t dot = filename.rfind('.');
+        filename = filename.substr(0, dot) + ".json";
+        if (filename == rdb_filename_ || !std::ifstream(filename).is_open())
+            return false;
+    }
+
+    if (!RDB::isSnapshot(filename))
+    {
+        LOG_INFO("# Loading legacy JSON snapshot " << filename);
+        return loadLegacyRDB(filename);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto steady_now = Clock::now();
+    int64_t unix_now = Clock::unixMs();
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Decoding workers sort entries into buckets of their own, one per
+    // destination shard, so they never contend on a map
+    struct Entry
+    {
+        std::string key;
+        Value value;
+        int64_t expire_at;
+    };
+    std::vector<std::vector<std::vector<Entry>>> buckets(threads, std::vector<std::vector<Entry>>(shards_.size()));
+
+    auto add = [&](size_t worker, std::string &&key, Value &&value, int64_t expire_at) {
+        if (expire_at != 0 && expire_at <= unix_now)
+        {
+            return;
+        }
+        size_t shard = shardIndex(key);
+        buckets[worker][shard].push_back({std::move(key), std::move(value), expire_at});
+    };
+
+    RDB::Index index;
+    bool ok;
+    if (lazy_load_)
+    {
+        // Values stay in the mapping; only keys, types and expirations are
+        // read now
+        mapping_ = std::make_unique<RDBMapping>();
+        ok = mapping_->open(filename) &&
+             RDB::scan(*mapping_, threads, [&](size_t worker, std::string_view key, ValueType type, int64_t expire_at,
+                                               const char *data, size_t length) {
+                 add(worker, std::string(key), Value::fromEncoded(type, data, length), expire_at);
+             }, index);
+    }
+    else
+    {
+        ok = RDB::load(filename, threads, add, index);
+    }
+    aof_seq = index.aof_seq;
+    if (!ok)
+    {
+        // Like Redis, refuse to start rather than serve the entries decoded
+        // before the corrupt block, with the AOF replayed on top of them
+        LOG_ERROR("# Snapshot " << filename << " is corrupt, refusing to start. Restore it or move it aside.");
+        std::exit(1);
+    }
+
+    // Then each shard's map is sized once and filled by a single thread.
+    // Startup only: nothing else touches the shards yet.
+    std::atomic<size_t> next_shard{0};
+    std::atomic<size_t> keys{0};
+    auto fill = [&]() {
+        size_t s;
+        while ((s = next_shard.fetch_add(1)) < shards_.size())
+        {
+            Keyspace &bucketstore = shards_[s].bucketstore;
+            size_t count = 0;
+            for (auto &worker : buckets)
+                count += worker[s].size();
+            bucketstore.reserve(bucketstore.size() + count);
+
+            for (auto &worker : buckets)
+            {
+                for (Entry &entry : worker[s])
+                {
+                    auto it = bucketstore.insert_or_assign(std::move(entry.key), std::move(entry.value)).first;
+                    if (entry.expire_at != 0)
+                    {
+                        recordExpiration(shards_[s], it,
+                                         steady_now + std::chrono::milliseconds(entry.expire_at - unix_now));
+                    }
+                }
+                std::vector<Entry>().swap(worker[s]);
+            }
+            if (lazy_load_)
+                shards_[s].encoded += count;
+            keys += count;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < std::min(threads, shards_.size()); t++)
+        pool.emplace_back(fill);
+    fill();
+    for (std::thread &thread : pool)
+        thread.join();
+
+    if (lazy_load_ && keys.load() > 0)
+    {
+        mapped_ = true;
+    }
+
+    double seconds = std::max(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), 1e-6);
+    double mb = index.file_size / (1024.0 * 1024.0);
+    threads = std::max<size_t>(1, std::min(threads, index.blocks.size()));
+    LOG_INFO("# " << (lazy_load_ ? "Indexed " : "Loaded ") << keys.load() << " keys (" << std::fixed << std::setprecision(1) << mb << " MB) from "
+             << filename << " in " << std::setprecision(3) << seconds << "s with " << threads << " threads: "
+             << std::setprecision(1) << mb / seconds << " MB/s, " << std::setprecision(0) << keys.load() / seconds
+             << " keys/s");
     return true;
 }
 
-bool Db::loadRDB()
+// Reads the JSON dumps written before the binary format existed
+bool Db::loadLegacyRDB(const std::string &filename)
 {
-    std::ifstream file(rdb_filename_);
+    std::ifstream file(filename);
     if (!file.is_open())
     {
         return false;
@@ -277,13 +890,13 @@ bool Db::loadRDB()
                     v = Value(valueInt);
                 }
 
+                Shard &shard = shardFor(currentKey);
+                auto it = shard.bucketstore.insert_or_assign(currentKey, std::move(v)).first;
                 if (ttl > 0)
                 {
-                    v.setExpiration(ttl);
+                    setExpiration(shard, it, Clock::now() + std::chrono::seconds(ttl));
                 }
 
-                bucketstore[currentKey] = v;
-
                 currentKey.clear();
                 valueType.clear();
                 valueStr.clear();
@@ -297,22 +910,77 @@ bool Db::loadRDB()
     return true;
 }
 
-bool Db::loadAOF()
+static bool parseLong(std::string_view s, long long &out)
 {
-    std::ifstream file(aof_filename_);
-    if (!file.is_open())
+    auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+    return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+// Re-executes one logged command. Runs with replaying_ set, so nothing is
+// logged again.
+void Db::replayCommand(const std::vector<std::string_view> &args)
+{
+    std::string_view cmd = args[0];
+    size_t argc = args.size();
+    long long n = 0;
+
+    if (cmd == "SET" && argc == 3)
+        set(args[1], args[2]);
+    else if (cmd == "DEL" && argc == 2)
+        del(args[1]);
+    else if (cmd == "INCRBY" && argc == 3 && parseLong(args[2], n))
+        incrby(args[1], n);
+    else if (cmd == "APPEND" && argc == 3)
+        append(args[1], args[2]);
+    else if (cmd == "SETRANGE" && argc == 4 && parseLong(args[2], n))
+        setrange(args[1], n, args[3]);
+    else if (cmd == "PEXPIREAT" && argc == 3 && parseLong(args[2], n))
+        pexpireat(args[1], n);
+    else if (cmd == "EXPIRE" && argc == 3 && parseLong(args[2], n))
+        expire(args[1], n);     // Written by older versions
+    else if (cmd == "PERSIST" && argc == 2)
+        persist(args[1]);
+    else if (cmd == "LPUSH" && argc >= 3)
+        lpush(args[1], std::vector<std::string_view>(args.begin() + 2, args.end()));
+    else if (cmd == "RPUSH" && argc >= 3)
+        rpush(args[1], std::vector<std::string_view>(args.begin() + 2, args.end()));
+    else if (cmd == "LPOP" && argc == 2)
+        lpop(args[1]);
+    else if (cmd == "RPOP" && argc == 2)
+        rpop(args[1]);
+    else if (cmd == "LSET" && argc == 4 && parseLong(args[2], n))
+        lset(args[1], n, args[3]);
+    else if (cmd == "SADD" && argc >= 3)
+        sadd(args[1], std::vector<std::string_view>(args.begin() + 2, args.end()));
+    else if (cmd == "SREM" && argc == 3)
+        srem(args[1], args[2]);
+    else if (cmd == "HSET" && argc == 4)
+        hset(args[1], args[2], args[3]);
+    else if (cmd == "HDEL" && argc == 3)
+        hdel(args[1], args[2]);
+    else
+        LOG_WARNING("Skipping unknown AOF command " << cmd);
+}
+
+// One-time upgrade of an AOF written before RESP framing (one space-joined
+// command per line) to RESP. Lines are split exactly like the old loader did,
+// including joining everything after the key of a SET back into one value.
+bool Db::convertLegacyAOF(const std::string &filename)
+{
+    std::ifstream in(filename);
+    std::string tmp_filename = filename + ".tmp";
+    std::ofstream out(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!in.is_open() || !out.is_open())
     {
-        return false; // no aof yet
+        LOG_ERROR("Failed to convert legacy AOF " << filename);
+        return false;
     }
 
     std::string line;
-    int commands_replayed = 0;
+    size_t converted = 0;
 
-    while (std::getline(file, line))
+    while (std::getline(in, line))
     {
-        if (line.empty())
-            continue;
-
         std::istringstream iss(line);
         std::vector<std::string> tokens;
         std::string word;
@@ -320,570 +988,1024 @@ bool Db::loadAOF()
         while (iss >> word)
             tokens.push_back(word);
 
-        if (tokens.empty())
+        if (tokens.size() < 2)
             continue;
 
-        const std::string &cmd = tokens[0];
-
-        // --------------------------------------------------------------------
-        // SET key value...
-        // --------------------------------------------------------------------
-        if (cmd == "SET" && tokens.size() >= 3)
+        if (tokens[0] == "SET" && tokens.size() > 3)
         {
-            std::string key = tokens[1];
-            std::string value;
+            for (size_t i = 3; i < tokens.size(); i++)
+                tokens[2] += " " + tokens[i];
+            tokens.resize(3);
+        }
 
-            for (size_t i = 2; i < tokens.size(); i++)
-            {
-                if (i > 2)
-                    value += " ";
-                value += tokens[i];
-            }
+        out << RESP::encodeArray(tokens);
+        converted++;
+    }
 
-            bucketstore[key] = Value(value);
-        }
+    in.close();
+    out.close();
+    if (!out || std::rename(tmp_filename.c_str(), filename.c_str()) != 0)
+    {
+        LOG_ERROR("Failed to replace legacy AOF " << filename);
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+
+    LOG_INFO("# Converted " << converted << " commands in legacy AOF to RESP format");
+    return true;
+}
+
+// Replays the segments the snapshot (or AOF base) does not cover, in order,
+// and leaves aof_seq_ at the one to continue appending to
+void Db::loadAOF(uint64_t snapshot_seq)
+{
+    uint64_t first = std::max<uint64_t>(snapshot_seq, 1);
+    std::vector<uint64_t> segments = listAOFFiles("");
 
-        // --------------------------------------------------------------------
-        // DEL key
-        // --------------------------------------------------------------------
-        else if (cmd == "DEL" && tokens.size() >= 2)
+    // Before segments existed the AOF was one file holding every write since
+    // the snapshot; it becomes the first segment
+    if (std::ifstream(aof_filename_).is_open())
+    {
+        if (segments.empty() && std::rename(aof_filename_.c_str(), aofSegmentName(first).c_str()) == 0)
         {
-            bucketstore.erase(tokens[1]);
+            LOG_INFO("# Moved " << aof_filename_ << " to " << aofSegmentName(first));
+            segments.push_back(first);
         }
-
-        // --------------------------------------------------------------------
-        // INCR key
-        // --------------------------------------------------------------------
-        else if (cmd == "INCR" && tokens.size() >= 2)
+        else
         {
-            auto it = bucketstore.find(tokens[1]);
-
-            if (it == bucketstore.end())
-            {
-                bucketstore[tokens[1]] = Value(1);
-            }
-            else if (it->second.type == ValueType::INTEGER)
-            {
-                it->second.integer() += 1;
-            }
+            LOG_WARNING("Ignoring " << aof_filename_ << ": AOF segments already exist");
         }
+    }
 
-        // --------------------------------------------------------------------
-        // INCRBY key amount
-        // --------------------------------------------------------------------
-        else if (cmd == "INCRBY" && tokens.size() >= 3)
+    aof_seq_ = first;
+    uint64_t expected = first;
+    for (uint64_t seq : segments)
+    {
+        if (seq < first)
         {
-            long long amount = std::stoll(tokens[2]);
-            auto it = bucketstore.find(tokens[1]);
-
-            if (it == bucketstore.end())
-            {
-                bucketstore[tokens[1]] = Value(amount);
-            }
-            else if (it->second.type == ValueType::INTEGER)
-            {
-                it->second.integer() += amount;
-            }
+            // Left behind by a crash between writing a snapshot and cleaning
+            // up; the snapshot already contains these writes
+            std::remove(aofSegmentName(seq).c_str());
+            continue;
         }
-
-        // --------------------------------------------------------------------
-        // DECR key
-        // --------------------------------------------------------------------
-        else if (cmd == "DECR" && tokens.size() >= 2)
+        if (seq != expected)
         {
-            auto it = bucketstore.find(tokens[1]);
-
-            if (it == bucketstore.end())
-            {
-                bucketstore[tokens[1]] = Value(-1);
-            }
-            else if (it->second.type == ValueType::INTEGER)
-            {
-                it->second.integer() -= 1;
-            }
+            LOG_WARNING("AOF segments " << expected << " to " << seq - 1 << " are missing");
         }
+        replayAOF(aofSegmentName(seq));
+        aof_seq_ = seq;
+        expected = seq + 1;
+    }
 
-        // --------------------------------------------------------------------
-        // DECRBY key amount
-        // --------------------------------------------------------------------
-        else if (cmd == "DECRBY" && tokens.size() >= 3)
-        {
-            long long amount = std::stoll(tokens[2]);
-            auto it = bucketstore.find(tokens[1]);
+    // Bases superseded by the snapshot
+    for (uint64_t seq : listAOFFiles(".base"))
+    {
+        if (seq < first)
+            std::remove(aofBaseName(seq).c_str());
+    }
+}
 
-            if (it == bucketstore.end())
-            {
-                bucketstore[tokens[1]] = Value(-amount);
-            }
-            else if (it->second.type == ValueType::INTEGER)
-            {
-                it->second.integer() -= amount;
-            }
-        }
+bool Db::replayAOF(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
 
-        // --------------------------------------------------------------------
-        // APPEND key value
-        // --------------------------------------------------------------------
-        else if (cmd == "APPEND" && tokens.size() >= 3)
-        {
-            auto it = bucketstore.find(tokens[1]);
-            if (it == bucketstore.end())
-            {
-                bucketstore[tokens[1]] = Value(tokens[2]);
-            }
-            else if (it->second.type == ValueType::STRING)
-            {
-                it->second.str().append(tokens[2]);
-            }
-        }
+    // RESP-framed AOFs start with an array header; anything else predates it
+    int first = file.peek();
+    if (first == std::char_traits<char>::eof())
+    {
+        return true;
+    }
+    if (first != '*')
+    {
+        file.close();
+        if (!convertLegacyAOF(filename))
+            return false;
+        file.open(filename, std::ios::binary);
+    }
 
-        // --------------------------------------------------------------------
-        // SETRANGE key offset value
-        // --------------------------------------------------------------------
-        else if (cmd == "SETRANGE" && tokens.size() >= 4)
-        {
-            long long offset = std::stoll(tokens[2]);
-            const std::string &value = tokens[3];
-            auto it = bucketstore.find(tokens[1]);
+    // Same streaming decoder as the network path: read straight into its
+    // buffer and replay every complete frame
+    const size_t READ_CHUNK = 1 << 20;
+    RESPDecoder decoder;
+    std::vector<std::string_view> args;
+    int commands_replayed = 0;
+    bool corrupt = false;
+    off_t bytes_read = 0;
 
-            if (it == bucketstore.end())
-            {
-                std::string newStr(offset + value.length(), '\0');
-                for (size_t i = 0; i < value.length(); i++)
-                {
-                    newStr[offset + i] = value[i];
-                }
-                bucketstore[tokens[1]] = Value(newStr);
-            }
-            else if (it->second.type == ValueType::STRING)
-            {
-                if (offset + value.length() > it->second.str().length())
-                {
-                    it->second.str().resize(offset + value.length(), '\0');
-                }
-                for (size_t i = 0; i < value.length(); i++)
-                {
-                    it->second.str()[offset + i] = value[i];
-                }
-            }
-        }
+    replaying_ = true;
+
+    while (!corrupt && file)
+    {
+        file.read(decoder.prepare(READ_CHUNK), READ_CHUNK);
+        decoder.commit(file.gcount());
+        bytes_read += file.gcount();
 
-        // --------------------------------------------------------------------
-        // EXPIRE key seconds
-        // --------------------------------------------------------------------
-        else if (cmd == "EXPIRE" && tokens.size() >= 3)
+        RESPDecoder::Status status;
+        while ((status = decoder.next(args)) == RESPDecoder::Status::COMPLETE)
         {
-            auto it = bucketstore.find(tokens[1]);
-            if (it != bucketstore.end())
-            {
-                long long seconds = std::stoll(tokens[2]);
-                it->second.setExpiration(seconds);
-            }
+            replayCommand(args);
+            commands_replayed++;
         }
 
-        // --------------------------------------------------------------------
-        // PERSIST key
-        // --------------------------------------------------------------------
-        else if (cmd == "PERSIST" && tokens.size() >= 2)
+        if (status == RESPDecoder::Status::ERROR)
         {
-            auto it = bucketstore.find(tokens[1]);
-            if (it != bucketstore.end())
-            {
-                it->second.persist();
-            }
+            LOG_ERROR("Corrupt AOF " << filename << ": " << decoder.error());
+            corrupt = true;
         }
-
-        commands_replayed++;
     }
 
-    file.close();
+    replaying_ = false;
+
+    if (!corrupt && decoder.buffered() > 0)
+    {
+        // A crash mid-write leaves half a frame; cut it off so new records
+        // are not appended behind it
+        LOG_WARNING("# AOF " << filename << " ends with a truncated command (" << decoder.buffered()
+                    << " bytes), discarding it");
+        file.close();
+        if (::truncate(filename.c_str(), bytes_read - decoder.buffered()) != 0)
+            LOG_ERROR("Failed to truncate AOF " << filename);
+    }
 
     if (commands_replayed > 0)
-        std::cout << "# Replayed " << commands_replayed << " commands from AOF" << std::endl;
+        LOG_INFO("# Replayed " << commands_replayed << " commands from " << filename);
+
+    return !corrupt;
+}
+
+std::string Db::aofSegmentName(uint64_t seq) const
+{
+    return aof_filename_ + "." + std::to_string(seq);
+}
+
+std::string Db::aofBaseName(uint64_t seq) const
+{
+    return aofSegmentName(seq) + ".base";
+}
+
+// Sequence numbers of the AOF files on disk named aof_filename_ + "." + seq
+// + suffix, ascending
+std::vector<uint64_t> Db::listAOFFiles(std::string_view suffix) const
+{
+    size_t slash = aof_filename_.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : aof_filename_.substr(0, slash + 1);
+    std::string prefix = (slash == std::string::npos ? aof_filename_ : aof_filename_.substr(slash + 1)) + ".";
 
+    std::vector<uint64_t> seqs;
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr)
+    {
+        return seqs;
+    }
+    while (struct dirent *entry = readdir(d))
+    {
+        std::string_view name(entry->d_name);
+        if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.substr(name.size() - suffix.size()) != suffix)
+            continue;
+
+        std::string_view digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        uint64_t seq;
+        auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), seq);
+        if (ec == std::errc() && end == digits.data() + digits.size())
+            seqs.push_back(seq);
+    }
+    closedir(d);
+
+    std::sort(seqs.begin(), seqs.end());
+    return seqs;
+}
+
+// Deletes the segments and bases that a snapshot or base on disk has made
+// redundant
+void Db::removeAOFSegmentsBefore(uint64_t seq)
+{
+    for (uint64_t old : listAOFFiles(""))
+    {
+        if (old >= seq)
+            break;
+        std::remove(aofSegmentName(old).c_str());
+    }
+    for (uint64_t old : listAOFFiles(".base"))
+    {
+        if (old >= seq)
+            break;
+        std::remove(aofBaseName(old).c_str());
+    }
+}
+
+// Recomputes the size of the live AOF files other than the current segment.
+// Caller must hold save_mutex_ (or be the constructor).
+void Db::updateAOFSize()
+{
+    long long size = 0;
+    struct stat st;
+    for (uint64_t seq : listAOFFiles(""))
+    {
+        if (seq < aof_seq_ && stat(aofSegmentName(seq).c_str(), &st) == 0)
+            size += st.st_size;
+    }
+    for (uint64_t seq : listAOFFiles(".base"))
+    {
+        if (stat(aofBaseName(seq).c_str(), &st) == 0)
+            size += st.st_size;
+    }
+    aof_older_size_ = size;
+}
+
+long long Db::aofSize() const
+{
+    return aof_older_size_.load() + static_cast<long long>(aof_.size());
+}
+
+// Continues the AOF in the next segment. Callers must hold save_mutex_ and
+// every shard lock, so the switch falls between two writes.
+bool Db::rotateAOF()
+{
+    if (!aof_.rotate(aofSegmentName(aof_seq_ + 1)))
+    {
+        return false;
+    }
+    aof_seq_++;
+    syncDirectory(aofSegmentName(aof_seq_));
+    return true;
+}
+
+void Db::set(std::string_view key, std::string_view value)
+{
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    store(shard, key, Value::fromString(value));
+    logToAOF({"SET", key, value});
+}
+
+DbResult<std::string> Db::get(std::string_view key)
+{
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
+    if (it == shard.bucketstore.end())
+    {
+        return {DbStatus::NOT_FOUND};
+    }
+
+    const Value &v = it->second;
+
+    if (v.type() != ValueType::STRING && v.type() != ValueType::INTEGER)
+    {
+        return {DbStatus::WRONG_TYPE};
+    }
+    Value::IntegerBuffer buf;
+    return {DbStatus::OK, std::string(v.text(buf))};
+}
+
+DbStatus Db::getBulk(std::string_view key, std::string &reply)
+{
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
+    if (it == shard.bucketstore.end())
+    {
+        return DbStatus::NOT_FOUND;
+    }
+
+    const Value &v = it->second;
+
+    if (v.type() == ValueType::STRING)
+    {
+        RESP::appendBulkString(reply, v.str());
+    }
+    else if (v.type() == ValueType::INTEGER)
+    {
+        RESP::appendBulkInteger(reply, v.integer());
+    }
+    else
+    {
+        return DbStatus::WRONG_TYPE;
+    }
+    return DbStatus::OK;
+}
+
+bool Db::del(std::string_view key)
+{
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
+    if (it == shard.bucketstore.end())
+    {
+        return false;
+    }
+
+    eraseKey(shard, it);
+
+    logToAOF({"DEL", key});
     return true;
 }
 
-void Db::startNewAOF()
+bool Db::exists(std::string_view key)
+{
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    return find(shard, key) != shard.bucketstore.end();
+}
+
+DbResult<long long> Db::incr(std::string_view key)
+{
+    return incrby(key, 1);
+}
+
+DbResult<long long> Db::incrby(std::string_view key, long long amount)
+{
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
+
+    if (it == shard.bucketstore.end())
+    {
+        shard.bucketstore[std::string(key)] = Value(amount);
+        logToAOF({"INCRBY", key, std::to_string(amount)});
+        return {DbStatus::OK, amount};
+    }
+
+    Value &v = it->second;
+
+    if (v.type() == ValueType::STRING)
+    {
+        // Built by APPEND or SETRANGE, or loaded as a string: parsed once,
+        // then kept as an integer
+        long long n;
+        if (!Value::parseInteger(v.str(), n))
+        {
+            return {DbStatus::NOT_INTEGER};
+        }
+        v.setInteger(n);
+    }
+    else if (v.type() != ValueType::INTEGER)
+    {
+        return {DbStatus::WRONG_TYPE};
+    }
+
+    long long result;
+    if (__builtin_add_overflow(v.integer(), amount, &result))
+    {
+        return {DbStatus::OVERFLOW};
+    }
+
+    v.setInteger(result);
+    logToAOF({"INCRBY", key, std::to_string(amount)});
+    return {DbStatus::OK, result};
+}
+
+DbResult<long long> Db::decr(std::string_view key)
+{
+    return incrby(key, -1);
+}
+
+DbResult<long long> Db::decrby(std::string_view key, long long amount)
+{
+    if (amount == LLONG_MIN)
+    {
+        return {DbStatus::OVERFLOW};
+    }
+    return incrby(key, -amount);
+}
+
+std::string_view Db::type(std::string_view key)
+{
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
+    if (it == shard.bucketstore.end())
+    {
+        return "none";
+    }
+
+    switch (it->second.type())
+    {
+    case ValueType::STRING:
+    case ValueType::INTEGER:    // Redis returns "string" for integers too
+        return "string";
+    case ValueType::LIST:
+        return "list";
+    case ValueType::SET:
+        return "set";
+    case ValueType::HASH:
+        return "hash";
+    default:
+        return "none";
+    }
+}
+
+// Finds a key, lazily deleting it if it has expired. The caller must hold the
+// shard's lock exclusively.
+Db::Keyspace::iterator Db::lookup(Shard &shard, std::string_view key)
 {
-
-    if (aof_file_.is_open())
+    auto it = shard.bucketstore.find(key);
+    if (it == shard.bucketstore.end())
     {
-        aof_file_.close();
+        return it;
     }
-
-    std::remove(aof_filename_.c_str());
-
-    aof_file_.open(aof_filename_, std::ios::app);
-
-    std::cout << "# Started new AOF" << std::endl;
+    if (isExpired(shard, *it))
+    {
+        eraseKey(shard, it);
+        expired_keys_++;
+        return shard.bucketstore.end();
+    }
+    decodeInPlace(shard, it->second);
+    return it;
 }
 
-void Db::set(const std::string &key, const std::string &value)
+// Read-only variant of lookup() for callers holding a ReadLock: an expired
+// key is reported as missing and left for the next writer to delete, and a
+// resizing table is left for the next writer to rehash.
+Db::Keyspace::const_iterator Db::find(const Shard &shard, std::string_view key) const
 {
-    bucketstore[key] = Value(value);
-    logToAOF("SET " + key + " " + value);
-    checkAutoSave();
-    std::cout << "OK" << std::endl;
+    auto it = shard.bucketstore.find(key);
+    if (it == shard.bucketstore.end() || isExpired(shard, *it))
+    {
+        return shard.bucketstore.end();
+    }
+    if (it->second.isEncoded())
+    {
+        // The ReadLock is exclusive while the shard has encoded values
+        decodeInPlace(const_cast<Shard &>(shard), const_cast<Value &>(it->second));
+    }
+    return it;
 }
 
-bool Db::get(const std::string &key)
+// Sets key to value, replacing whatever was there. Caller holds the shard
+// lock exclusively.
+void Db::store(Shard &shard, std::string_view key, Value &&value)
 {
-    cleanupIfExpired(key);
-    auto it = bucketstore.find(key);
-    if (it == bucketstore.end())
+    auto [it, inserted] = shard.bucketstore.try_emplace(key);
+    if (!inserted)
     {
-        std::cout << "nil" << std::endl;
-        return false;
+        if (it->second.isEncoded())
+            shard.encoded.fetch_sub(1, std::memory_order_release);
+        if (it->second.hasExpiry())
+            dropExpiration(shard, it->first);
     }
+    it->second = std::move(value);
+}
 
-    Value &v = it->second;
+// Deletes a key along with its expiration. Caller holds the shard lock
+// exclusively.
+void Db::eraseKey(Shard &shard, Keyspace::iterator it)
+{
+    if (it->second.isEncoded())
+        shard.encoded.fetch_sub(1, std::memory_order_release);
+    if (it->second.hasExpiry())
+        dropExpiration(shard, it->first);
+    shard.bucketstore.erase(it);
+}
 
-    if (v.type == ValueType::STRING)
+const std::chrono::steady_clock::time_point *Db::expirationOf(const Shard &shard,
+                                                             const Keyspace::value_type &entry) const
+{
+    if (!entry.second.hasExpiry())
     {
-        std::cout << v.str() << std::endl;
-        return true;
+        return nullptr;
     }
-    else if (v.type == ValueType::INTEGER)
+    if (!shard.colliding_expires.empty())
     {
-        std::cout << v.integer() << std::endl;
-        return true;
+        auto it = shard.colliding_expires.find(entry.first);
+        if (it != shard.colliding_expires.end())
+            return &it->second;
     }
-    return false;
+    auto it = shard.expires.find(hashString(entry.first));
+    return it == shard.expires.end() ? nullptr : &it->second;
 }
 
-bool Db::del(const std::string &key)
+// Never while loading the AOF: its records carry absolute deadlines, so a
+// write replayed after a key's deadline must still find the key, as it did
+// when it ran, rather than start a new one without the TTL. Like Redis, the
+// keys are left for the active expirer once loading is done.
+bool Db::isExpired(const Shard &shard, const Keyspace::value_type &entry) const
 {
-    cleanupIfExpired(key);
-    auto it = bucketstore.find(key);
-    if (it == bucketstore.end())
+    if (replaying_)
     {
-        std::cout << "(integer) 0" << std::endl;
         return false;
     }
+    const auto *when = expirationOf(shard, entry);
+    return when != nullptr && Clock::now() >= *when;
+}
 
-    bucketstore.erase(it);
-
-    logToAOF("DEL " + key);
-    checkAutoSave();
-    std::cout << "(integer) 1" << std::endl;
-    return true;
+// Caller holds the shard lock exclusively
+void Db::setExpiration(Shard &shard, Keyspace::iterator it, std::chrono::steady_clock::time_point when)
+{
+    recordExpiration(shard, it, when);
+    scheduleExpiry(shard, hashString(it->first), when);
 }
 
-bool Db::exists(const std::string &key)
+void Db::recordExpiration(Shard &shard, Keyspace::iterator it, std::chrono::steady_clock::time_point when)
 {
-    cleanupIfExpired(key);
-    if (bucketstore.find(key) == bucketstore.end())
+    size_t hash = hashString(it->first);
+    if (it->second.hasExpiry())
     {
-        std::cout << "(integer) 0" << std::endl;
-        return false;
+        auto colliding = shard.colliding_expires.find(it->first);
+        (colliding != shard.colliding_expires.end() ? colliding->second : shard.expires[hash]) = when;
+        return;
     }
-
-    std::cout << "(integer) 1" << std::endl;
-    return true;
+    // An entry for the hash that is already there belongs to another key
+    if (!shard.expires.try_emplace(hash, when).second)
+        shard.colliding_expires.emplace(it->first, when);
+    it->second.setHasExpiry(true);
 }
 
-bool Db::incr(const std::string &key)
+void Db::dropExpiration(Shard &shard, const std::string &key)
 {
-    cleanupIfExpired(key);
-    auto it = bucketstore.find(key);
+    if (!shard.colliding_expires.empty() && shard.colliding_expires.erase(key) > 0)
+        return;
+    shard.expires.erase(hashString(key));
+}
 
-    if (it == bucketstore.end())
+void Db::clearExpiration(Shard &shard, Keyspace::iterator it)
+{
+    if (it->second.hasExpiry())
     {
-        bucketstore[key] = Value(1);
-        std::cout << "(integer) 1" << std::endl;
-        logToAOF("INCR " + key);
-        checkAutoSave();
-        return true;
+        dropExpiration(shard, it->first);
+        it->second.setHasExpiry(false);
     }
+}
 
-    Value &v = it->second;
-
-    if (v.type != ValueType::INTEGER)
+// Decodes a value still pointing into the snapshot mapping. Caller holds the
+// shard lock exclusively.
+void Db::decodeInPlace(Shard &shard, Value &value) const
+{
+    if (!value.isEncoded())
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return false;
+        return;
     }
 
-    v.integer() += 1;
-    std::cout << "(integer) " << v.integer() << std::endl;
-    logToAOF("INCR " + key);
-    checkAutoSave();
-
-    return true;
+    EncodedValue encoded = value.encoded();
+    if (!RDB::decodeValue(encoded.data, encoded.length, value.type(), value))
+    {
+        // Cannot happen for a snapshot that passed its checksums and scan
+        LOG_ERROR("Failed to decode a lazily loaded value, replacing it with an empty string");
+        bool has_expiry = value.hasExpiry();
+        value = Value();
+        value.setHasExpiry(has_expiry);
+    }
+    shard.encoded.fetch_sub(1, std::memory_order_release);
 }
 
-bool Db::incrby(const std::string &key, long long amount)
+// Runs on the cron thread: decodes values nobody has touched yet, within a
+// small time budget per tick, and releases the mapping once none are left
+void Db::decodeSome()
 {
-    cleanupIfExpired(key);
-    auto it = bucketstore.find(key);
+    if (!mapped_.load())
+    {
+        return;
+    }
+
+    const auto BUDGET = std::chrono::milliseconds(10);
+    auto deadline = std::chrono::steady_clock::now() + BUDGET;
+    bool done = true;
 
-    if (it == bucketstore.end())
+    for (Shard &shard : shards_)
     {
-        bucketstore[key] = Value(amount);
-        logToAOF("INCRBY " + key + " " + std::to_string(amount));
-        checkAutoSave();
+        if (shard.encoded.load(std::memory_order_acquire) == 0)
+        {
+            continue;
+        }
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            done = false;
+            break;
+        }
 
-        std::cout << "(integer) " << amount << std::endl;
-        return true;
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        while (shard.encoded.load() > 0 && std::chrono::steady_clock::now() < deadline)
+        {
+            shard.decode_cursor = shard.bucketstore.scan(
+                shard.decode_cursor, [&](Keyspace::value_type &entry) { decodeInPlace(shard, entry.second); });
+        }
+        if (shard.encoded.load() > 0)
+        {
+            done = false;
+        }
     }
 
-    Value &v = it->second;
-
-    if (v.type != ValueType::INTEGER)
+    if (done)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return false;
+        // Nothing points into the mapping anymore, and only this thread
+        // touches it after startup
+        mapping_.reset();
+        mapped_ = false;
+        LOG_INFO("# All lazily loaded values decoded, snapshot unmapped");
     }
+}
 
-    v.integer() += amount;
-    logToAOF("INCRBY " + key + " " + std::to_string(amount));
-    checkAutoSave();
-    std::cout << "(integer) " << v.integer() << std::endl;
-    return true;
+// ============== Incremental Rehashing ==============
+
+// Runs on the cron thread: moves buckets of shards whose table is resizing,
+// within a small time budget per tick, so that a shard that stops taking
+// writes halfway through does not keep two tables around
+void Db::rehashSome()
+{
+    const auto BUDGET = std::chrono::milliseconds(1);
+    const size_t BATCH = 100;   // Buckets per lock acquisition
+    auto deadline = std::chrono::steady_clock::now() + BUDGET;
+
+    for (Shard &shard : shards_)
+    {
+        bool rehashing = true;
+        while (rehashing)
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+                return;
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            rehashing = shard.bucketstore.rehashStep(BATCH);
+        }
+    }
 }
 
-bool Db::decr(const std::string &key)
+// ============== Active Expiry ==============
+
+// Queues the key with this hash for the active expirer. Caller holds the
+// shard lock exclusively.
+void Db::scheduleExpiry(Shard &shard, size_t hash, std::chrono::steady_clock::time_point when)
 {
+    shard.expiry_heap.push_back({when, hash});
+    std::push_heap(shard.expiry_heap.begin(), shard.expiry_heap.end(), std::greater<ExpiryEntry>());
+}
 
-    return incrby(key, -1);
+// Rebuilds the heap from the expires table, dropping stale entries. Caller
+// holds the shard lock exclusively.
+void Db::rebuildExpiryIndex(Shard &shard)
+{
+    std::vector<ExpiryEntry> heap;
+    heap.reserve(shard.expires.size() + shard.colliding_expires.size());
+    for (const auto &pair : shard.expires)
+        heap.push_back({pair.second, pair.first});
+    for (const auto &pair : shard.colliding_expires)
+        heap.push_back({pair.second, hashString(pair.first)});
+    std::make_heap(heap.begin(), heap.end(), std::greater<ExpiryEntry>());
+    shard.expiry_heap.swap(heap);
 }
-bool Db::decrby(const std::string &key, long long amount)
+
+// Runs on the cron thread: deletes keys whose TTL has passed, spending at
+// most a quarter of each tick. Shards are visited round-robin from where the
+// previous tick ran out of time, so a large backlog in one shard does not
+// starve the others.
+void Db::expireSome()
 {
+    const auto BUDGET = std::chrono::milliseconds(25);
+    const size_t BATCH = 32;    // Entries per lock acquisition
+    auto deadline = std::chrono::steady_clock::now() + BUDGET;
 
-    return incrby(key, -amount);
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+        size_t index = (expire_cursor_ + i) % shards_.size();
+        Shard &shard = shards_[index];
+        bool due = true;
+
+        while (due)
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                expire_cursor_ = index;
+                return;
+            }
+            auto now = Clock::now();
+
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            std::vector<ExpiryEntry> &heap = shard.expiry_heap;
+
+            // Stale entries pile up when TTLs are reset over and over
+            if (heap.size() > 2 * (shard.expires.size() + shard.colliding_expires.size()) + 1024)
+                rebuildExpiryIndex(shard);
+
+            for (size_t n = 0; n < BATCH; n++)
+            {
+                if (heap.empty() || heap.front().when > now)
+                {
+                    due = false;
+                    break;
+                }
+                std::pop_heap(heap.begin(), heap.end(), std::greater<ExpiryEntry>());
+                size_t hash = heap.back().hash;
+                heap.pop_back();
+
+                // Stale unless a key with the hash is due: the owner of its
+                // expires entry, or one of the rare colliding keys
+                auto expiry = shard.expires.find(hash);
+                if ((expiry == shard.expires.end() || expiry->second > now) && shard.colliding_expires.empty())
+                    continue;
+
+                auto due = [&](const Keyspace::value_type &entry) {
+                    const auto *when = expirationOf(shard, entry);
+                    return when != nullptr && *when <= now;
+                };
+                for (auto it = shard.bucketstore.findHash(hash, due); it != shard.bucketstore.end();
+                     it = shard.bucketstore.findHash(hash, due))
+                {
+                    eraseKey(shard, it);
+                    expired_keys_++;
+                }
+            }
+        }
+    }
+    expire_cursor_ = (expire_cursor_ + 1) % shards_.size();
+}
+
+// Number of heap entries that are due, visiting only those and their
+// children
+size_t Db::countDue(const std::vector<ExpiryEntry> &heap, std::chrono::steady_clock::time_point now)
+{
+    size_t count = 0;
+    std::vector<size_t> pending;
+    if (!heap.empty())
+        pending.push_back(0);
+    while (!pending.empty())
+    {
+        size_t i = pending.back();
+        pending.pop_back();
+        if (heap[i].when > now)
+            continue;
+        count++;
+        for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap.size(); child++)
+            pending.push_back(child);
+    }
+    return count;
 }
 
-std::string Db::type(const std::string &key)
+// Refreshes the expiry rate and backlog about once a second
+void Db::sampleExpiryStats()
 {
-    cleanupIfExpired(key);
-    auto it = bucketstore.find(key);
-    if (it == bucketstore.end())
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - expire_sample_time_).count();
+    if (elapsed < 1000)
     {
-        std::cout << "none" << std::endl;
-        return "none";
+        return;
     }
 
-    Value &v = it->second;
+    long long expired = expired_keys_.load();
+    expired_per_sec_ = (expired - expired_at_sample_) * 1000 / elapsed;
+    expired_at_sample_ = expired;
+    expire_sample_time_ = now;
 
-    switch (v.type)
+    long long backlog = 0;
+    for (const Shard &shard : shards_)
     {
-    case ValueType::STRING:
-        std::cout << "string" << std::endl;
-        return "string";
-    case ValueType::INTEGER:
-        std::cout << "string" << std::endl;  // Redis returns "string" for integers too
-        return "string";
-    case ValueType::LIST:
-        std::cout << "list" << std::endl;
-        return "list";
-    case ValueType::SET:
-        std::cout << "set" << std::endl;
-        return "set";
-    case ValueType::HASH:
-        std::cout << "hash" << std::endl;
-        return "hash";
-    default:
-        std::cout << "none" << std::endl;
-        return "none";
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        backlog += countDue(shard.expiry_heap, Clock::now());
     }
+    expired_backlog_ = backlog;
 }
 
-void Db::cleanupIfExpired(const std::string &key)
+Db::ExpiryInfo Db::expiryInfo() const
 {
-    auto it = bucketstore.find(key);
-    if (it != bucketstore.end() && it->second.isExpired())
-    {
-        bucketstore.erase(it);
-    }
+    ExpiryInfo info;
+    info.expired_keys = expired_keys_.load();
+    info.expired_per_sec = expired_per_sec_.load();
+    info.backlog = expired_backlog_.load();
+    return info;
+}
+
+size_t Db::shardIndex(std::string_view key) const
+{
+    return std::hash<std::string_view>{}(key) % shards_.size();
+}
+
+// Distinct shards owning keys[0], keys[step], ... in ascending order, which is
+// the order multi-key commands must lock them in to avoid deadlocks
+std::vector<size_t> Db::shardIndexes(const std::vector<std::string_view> &keys, size_t step) const
+{
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < keys.size(); i += step)
+        indexes.push_back(shardIndex(keys[i]));
+    std::sort(indexes.begin(), indexes.end());
+    indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+    return indexes;
 }
 
-bool Db::expire(const std::string &key, long long seconds)
+// Unix time `amount` units of `scale` milliseconds from now, saturating
+static long long unixMsAfter(long long amount, long long scale)
 {
-    cleanupIfExpired(key);
+    long long ms, at;
+    if (__builtin_mul_overflow(amount, scale, &ms) || __builtin_add_overflow(Clock::unixMs(), ms, &at))
+        return amount < 0 ? LLONG_MIN : LLONG_MAX;
+    return at;
+}
+
+bool Db::expire(std::string_view key, long long seconds)
+{
+    return pexpireat(key, unixMsAfter(seconds, 1000));
+}
 
-    auto it = bucketstore.find(key);
-    if (it == bucketstore.end())
+bool Db::pexpire(std::string_view key, long long milliseconds)
+{
+    return pexpireat(key, unixMsAfter(milliseconds, 1));
+}
+
+bool Db::pexpireat(std::string_view key, long long unix_ms)
+{
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) 0" << std::endl;
         return false;
     }
 
-    it->second.setExpiration(seconds);
-    logToAOF("EXPIRE " + key + " " + std::to_string(seconds));
-    checkAutoSave();
-    std::cout << "(integer) 1" << std::endl;
+    setExpiration(shard, it, Clock::fromUnixMs(unix_ms));
+    logToAOF({"PEXPIREAT", key, std::to_string(unix_ms)});
     return true;
 }
 
-long long Db::ttl(const std::string &key)
+long long Db::ttl(std::string_view key)
 {
-    cleanupIfExpired(key);
-
-    auto it = bucketstore.find(key);
-    if (it == bucketstore.end())
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) -2" << std::endl;
         return -2;
     }
 
-    long long ttl_value = it->second.getTTL();
-    std::cout << "(integer) " << ttl_value << std::endl;
-    return ttl_value;
+    const auto *when = expirationOf(shard, *it);
+    if (when == nullptr)
+    {
+        return -1;
+    }
+    return std::max<long long>(0, std::chrono::duration_cast<std::chrono::seconds>(*when - Clock::now()).count());
 }
 
-bool Db::persist(const std::string &key)
+long long Db::pttl(std::string_view key)
 {
-    cleanupIfExpired(key);
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
+    if (it == shard.bucketstore.end())
+    {
+        return -2;
+    }
 
-    auto it = bucketstore.find(key);
-    if (it == bucketstore.end())
+    const auto *when = expirationOf(shard, *it);
+    if (when == nullptr)
     {
-        std::cout << "(integer) 0" << std::endl;
-        return false;
+        return -1;
     }
-    if (it->second.getTTL() == -1)
+    return std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(*when - Clock::now()).count());
+}
 
+bool Db::persist(std::string_view key)
+{
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
+    if (it == shard.bucketstore.end() || !it->second.hasExpiry())
     {
-        std::cout << "(integer) 0" << std::endl;
         return false;
     }
 
-    it->second.persist();
-    logToAOF("PERSIST " + key);
-    checkAutoSave();
-    std::cout << "(integer) 1" << std::endl;
+    clearExpiration(shard, it);
+    logToAOF({"PERSIST", key});
     return true;
 }
 
-long long Db::append(const std::string &key, const std::string &value)
+DbResult<long long> Db::append(std::string_view key, std::string_view value)
 {
-    cleanupIfExpired(key);
-    auto it = bucketstore.find(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
 
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        bucketstore[key] = Value(value);
-        logToAOF("APPEND " + key + " " + value);
-        checkAutoSave();
-
-        std::cout << "(integer) " << value.length() << std::endl;
-        return value.length();
+        shard.bucketstore[std::string(key)] = Value(std::string(value));
+        logToAOF({"APPEND", key, value});
+        return {DbStatus::OK, static_cast<long long>(value.length())};
     }
 
     Value &v = it->second;
 
-    if (v.type != ValueType::STRING)
+    if (v.type() != ValueType::STRING && v.type() != ValueType::INTEGER)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
+        return {DbStatus::WRONG_TYPE};
+    }
+
+    v.makeString();
+    if (v.str().length() + value.length() > Value::MAX_STRING)
+    {
+        return {DbStatus::TOO_LARGE};
     }
 
-    v.str().append(value);
-    logToAOF("APPEND " + key + " " + value);
-    checkAutoSave();
-    std::cout << "(integer) " << v.str().length() << std::endl;
-    return v.str().length();
+    v.append(value);
+    logToAOF({"APPEND", key, value});
+    return {DbStatus::OK, static_cast<long long>(v.str().length())};
 }
 
-long long Db::strlen(const std::string &key)
+DbResult<long long> Db::strlen(std::string_view key)
 {
-    cleanupIfExpired(key);
-
-    auto it = bucketstore.find(key);
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
 
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) 0" << std::endl;
-        return 0;
+        return {DbStatus::OK, 0};
     }
 
-    Value &v = it->second;
+    const Value &v = it->second;
 
-    if (v.type != ValueType::STRING)
+    if (v.type() != ValueType::STRING && v.type() != ValueType::INTEGER)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
+        return {DbStatus::WRONG_TYPE};
     }
 
-    std::cout << "(integer) " << v.str().length() << std::endl;
-    return v.str().length();
+    Value::IntegerBuffer buf;
+    return {DbStatus::OK, static_cast<long long>(v.text(buf).length())};
 }
 
-void Db::mget(const std::vector<std::string> &keys)
+std::vector<std::optional<std::string>> Db::mget(const std::vector<std::string_view> &keys)
 {
-    for (size_t i = 0; i < keys.size(); i++)
-    {
-        cleanupIfExpired(keys[i]);
+    std::vector<ReadLock> locks;
+    for (size_t index : shardIndexes(keys, 1))
+        locks.emplace_back(shards_[index]);
 
-        auto it = bucketstore.find(keys[i]);
+    std::vector<std::optional<std::string>> result;
+    result.reserve(keys.size());
 
-        std::cout << (i + 1) << ") ";
+    for (std::string_view key : keys)
+    {
+        const Shard &shard = shardFor(key);
+        auto it = find(shard, key);
 
-        if (it == bucketstore.end())
+        if (it == shard.bucketstore.end())
         {
-            std::cout << "(nil)" << std::endl;
+            result.emplace_back();
             continue;
         }
 
-        Value &v = it->second;
+        const Value &v = it->second;
 
-        if (v.type == ValueType::STRING)
-        {
-            std::cout << "\"" << v.str() << "\"" << std::endl;
-        }
-        else if (v.type == ValueType::INTEGER)
+        if (v.type() == ValueType::STRING || v.type() == ValueType::INTEGER)
         {
-            std::cout << v.integer() << std::endl;
+            Value::IntegerBuffer buf;
+            result.emplace_back(v.text(buf));
         }
         else
         {
-            std::cout << "(nil)" << std::endl;
+            result.emplace_back();
         }
     }
+    return result;
 }
 
-void Db::mset(const std::vector<std::string> &keyvals)
+bool Db::mset(const std::vector<std::string_view> &keyvals)
 {
     if (keyvals.size() % 2 != 0)
     {
-        std::cout << "(error) wrong number of arguments" << std::endl;
-        return;
+        return false;
     }
 
+    AfterWrite after_write{*this};
+    std::vector<std::unique_lock<std::shared_mutex>> locks;
+    for (size_t index : shardIndexes(keyvals, 2))
+        locks.emplace_back(shards_[index].mutex);
+
     for (size_t i = 0; i < keyvals.size(); i += 2)
     {
-        const std::string &key = keyvals[i];
-        const std::string &value = keyvals[i + 1];
+        std::string_view key = keyvals[i];
+        std::string_view value = keyvals[i + 1];
 
-        bucketstore[key] = Value(value);
+        store(shardFor(key), key, Value::fromString(value));
 
-        logToAOF("SET " + key + " " + value);
-        checkAutoSave();
+        logToAOF({"SET", key, value});
     }
-
-    std::cout << "OK" << std::endl;
+    return true;
 }
 
-std::string Db::getrange(const std::string &key, long long start, long long end)
+DbResult<std::string> Db::getrange(std::string_view key, long long start, long long end)
 {
-    cleanupIfExpired(key);
-
-    auto it = bucketstore.find(key);
-    if (it == bucketstore.end())
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "\"\"" << std::endl;
-        return "";
+        return {DbStatus::OK, ""};
     }
-    Value &v = it->second;
+    const Value &v = it->second;
 
-    if (v.type != ValueType::STRING)
+    if (v.type() != ValueType::STRING && v.type() != ValueType::INTEGER)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return "";
+        return {DbStatus::WRONG_TYPE};
     }
 
-    long long len = v.str().length();
+    Value::IntegerBuffer buf;
+    std::string_view str = v.text(buf);
+    long long len = str.length();
 
     if (start < 0)
         start = len + start;
@@ -895,261 +2017,212 @@ std::string Db::getrange(const std::string &key, long long start, long long end)
         end = len - 1;
     if (start > end || start >= len)
     {
-        std::cout << "\"\"" << std::endl;
-        return "";
+        return {DbStatus::OK, ""};
     }
 
-    std::string result = v.str().substr(start, end - start + 1);
-    std::cout << "\"" << result << "\"" << std::endl;
-    return result;
+    return {DbStatus::OK, std::string(str.substr(start, end - start + 1))};
 }
 
-long long Db::setrange(const std::string &key, long long offset, const std::string &value)
+DbResult<long long> Db::setrange(std::string_view key, long long offset, std::string_view value)
 {
-    cleanupIfExpired(key);
-
-    auto it = bucketstore.find(key);
-
-    if (it == bucketstore.end())
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (offset < 0)
     {
-        std::string newStr(offset + value.length(), '\0');
-        for (size_t i = 0; i < value.length(); i++)
-        {
-            newStr[offset + i] = value[i];
-        }
-        bucketstore[key] = Value(newStr);
-        logToAOF("SETRANGE " + key + " " + std::to_string(offset) + " " + value);
-        checkAutoSave();
-        std::cout << "(integer) " << newStr.length() << std::endl;
-        return newStr.length();
+        return {DbStatus::OUT_OF_RANGE};
     }
-
-    Value &v = it->second;
-
-    if (v.type != ValueType::STRING)
+    if (static_cast<unsigned long long>(offset) + value.length() > Value::MAX_STRING)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
+        return {DbStatus::TOO_LARGE};
     }
 
-    if (offset + value.length() > v.str().length())
+    auto it = lookup(shard, key);
+
+    if (it == shard.bucketstore.end())
     {
-        v.str().resize(offset + value.length(), '\0');
+        it = shard.bucketstore.emplace(std::string(key), Value()).first;
     }
-
-    for (size_t i = 0; i < value.length(); i++)
+    else if (it->second.type() != ValueType::STRING && it->second.type() != ValueType::INTEGER)
     {
-        v.str()[offset + i] = value[i];
+        return {DbStatus::WRONG_TYPE};
     }
-    logToAOF("SETRANGE " + key + " " + std::to_string(offset) + " " + value);
-    checkAutoSave();
 
-    std::cout << "(integer) " << v.str().length() << std::endl;
-    return v.str().length();
+    Value &v = it->second;
+    v.makeString();
+    size_t length = std::max<size_t>(v.str().length(), offset + value.length());
+    char *data = v.resize(length);
+    std::copy(value.begin(), value.end(), data + offset);
+    logToAOF({"SETRANGE", key, std::to_string(offset), value});
+
+    return {DbStatus::OK, static_cast<long long>(v.str().length())};
 }
 
 // ============== List Commands ==============
 
-long long Db::lpush(const std::string& key, const std::vector<std::string>& values)
+DbResult<long long> Db::lpush(std::string_view key, const std::vector<std::string_view>& values)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        // Create new list
-        RedisList newList;
-        for (auto rit = values.rbegin(); rit != values.rend(); ++rit)
-        {
-            newList.push_front(*rit);
-        }
-        bucketstore[key] = Value(newList);
-    }
-    else if (it->second.type != ValueType::LIST)
-    {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
+        it = shard.bucketstore.emplace(std::string(key), Value(ValueType::LIST)).first;
     }
-    else
+    else if (it->second.type() != ValueType::LIST)
     {
-        // Push to existing list
-        for (auto rit = values.rbegin(); rit != values.rend(); ++rit)
-        {
-            it->second.list().push_front(*rit);
-        }
+        return {DbStatus::WRONG_TYPE};
     }
-    
-    // Log to AOF
+
+    Value &list = it->second;
     for (const auto& val : values)
     {
-        logToAOF("LPUSH " + key + " " + val);
+        list.listPush(val, true);
     }
-    checkAutoSave();
     
-    long long len = bucketstore[key].list().size();
-    std::cout << "(integer) " << len << std::endl;
-    return len;
+    logToAOF("LPUSH", key, values);
+    
+    return {DbStatus::OK, static_cast<long long>(list.listLength())};
 }
 
-long long Db::rpush(const std::string& key, const std::vector<std::string>& values)
+DbResult<long long> Db::rpush(std::string_view key, const std::vector<std::string_view>& values)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        RedisList newList(values.begin(), values.end());
-        bucketstore[key] = Value(newList);
+        it = shard.bucketstore.emplace(std::string(key), Value(ValueType::LIST)).first;
     }
-    else if (it->second.type != ValueType::LIST)
-    {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
-    }
-    else
+    else if (it->second.type() != ValueType::LIST)
     {
-        for (const auto& val : values)
-        {
-            it->second.list().push_back(val);
-        }
+        return {DbStatus::WRONG_TYPE};
     }
-    
+
+    Value &list = it->second;
     for (const auto& val : values)
     {
-        logToAOF("RPUSH " + key + " " + val);
+        list.listPush(val, false);
     }
-    checkAutoSave();
     
-    long long len = bucketstore[key].list().size();
-    std::cout << "(integer) " << len << std::endl;
-    return len;
+    logToAOF("RPUSH", key, values);
+    
+    return {DbStatus::OK, static_cast<long long>(list.listLength())};
 }
 
-std::string Db::lpop(const std::string& key)
+DbResult<std::string> Db::lpop(std::string_view key)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(nil)" << std::endl;
-        return "";
+        return {DbStatus::NOT_FOUND};
     }
     
-    if (it->second.type != ValueType::LIST)
+    if (it->second.type() != ValueType::LIST)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return "";
+        return {DbStatus::WRONG_TYPE};
     }
     
-    if (it->second.list().empty())
+    if (it->second.listLength() == 0)
     {
-        std::cout << "(nil)" << std::endl;
-        return "";
+        return {DbStatus::NOT_FOUND};
     }
     
-    std::string result = it->second.list().front();
-    it->second.list().pop_front();
+    std::string result = it->second.listPop(true);
     
     // Remove key if list is empty
-    if (it->second.list().empty())
+    if (it->second.listLength() == 0)
     {
-        bucketstore.erase(it);
+        eraseKey(shard, it);
     }
     
-    logToAOF("LPOP " + key);
-    checkAutoSave();
+    logToAOF({"LPOP", key});
     
-    std::cout << "\"" << result << "\"" << std::endl;
-    return result;
+    return {DbStatus::OK, std::move(result)};
 }
 
-std::string Db::rpop(const std::string& key)
+DbResult<std::string> Db::rpop(std::string_view key)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(nil)" << std::endl;
-        return "";
+        return {DbStatus::NOT_FOUND};
     }
     
-    if (it->second.type != ValueType::LIST)
+    if (it->second.type() != ValueType::LIST)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return "";
+        return {DbStatus::WRONG_TYPE};
     }
     
-    if (it->second.list().empty())
+    if (it->second.listLength() == 0)
     {
-        std::cout << "(nil)" << std::endl;
-        return "";
+        return {DbStatus::NOT_FOUND};
     }
     
-    std::string result = it->second.list().back();
-    it->second.list().pop_back();
+    std::string result = it->second.listPop(false);
     
-    if (it->second.list().empty())
+    if (it->second.listLength() == 0)
     {
-        bucketstore.erase(it);
+        eraseKey(shard, it);
     }
     
-    logToAOF("RPOP " + key);
-    checkAutoSave();
+    logToAOF({"RPOP", key});
     
-    std::cout << "\"" << result << "\"" << std::endl;
-    return result;
+    return {DbStatus::OK, std::move(result)};
 }
 
-long long Db::llen(const std::string& key)
+DbResult<long long> Db::llen(std::string_view key)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) 0" << std::endl;
-        return 0;
+        return {DbStatus::OK, 0};
     }
     
-    if (it->second.type != ValueType::LIST)
+    if (it->second.type() != ValueType::LIST)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
+        return {DbStatus::WRONG_TYPE};
     }
     
-    long long len = it->second.list().size();
-    std::cout << "(integer) " << len << std::endl;
-    return len;
+    return {DbStatus::OK, static_cast<long long>(it->second.listLength())};
 }
 
-std::vector<std::string> Db::lrange(const std::string& key, long long start, long long stop)
+DbResult<std::vector<std::string>> Db::lrange(std::string_view key, long long start, long long stop)
 {
-    cleanupIfExpired(key);
-    std::vector<std::string> result;
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    DbResult<std::vector<std::string>> result;
     
-    auto it = bucketstore.find(key);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(empty list)" << std::endl;
         return result;
     }
     
-    if (it->second.type != ValueType::LIST)
+    if (it->second.type() != ValueType::LIST)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
+        result.status = DbStatus::WRONG_TYPE;
         return result;
     }
     
-    const RedisList& lst = it->second.list();
-    long long len = lst.size();
+    const Value &list = it->second;
+    long long len = list.listLength();
     
     // Handle negative indices
     if (start < 0) start = len + start;
@@ -1159,466 +2232,392 @@ std::vector<std::string> Db::lrange(const std::string& key, long long start, lon
     
     if (start > stop || start >= len)
     {
-        std::cout << "(empty list)" << std::endl;
         return result;
     }
     
-    for (long long i = start; i <= stop; i++)
-    {
-        result.push_back(lst[i]);
-        std::cout << (i - start + 1) << ") \"" << lst[i] << "\"" << std::endl;
-    }
+    result.value.reserve(stop - start + 1);
+    list.listRange(start, stop, [&](std::string_view item) { result.value.emplace_back(item); });
     
     return result;
 }
 
-std::string Db::lindex(const std::string& key, long long index)
+DbResult<std::string> Db::lindex(std::string_view key, long long index)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(nil)" << std::endl;
-        return "";
+        return {DbStatus::NOT_FOUND};
     }
     
-    if (it->second.type != ValueType::LIST)
+    if (it->second.type() != ValueType::LIST)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return "";
+        return {DbStatus::WRONG_TYPE};
     }
     
-    const RedisList& lst = it->second.list();
-    long long len = lst.size();
+    const Value &list = it->second;
+    long long len = list.listLength();
     
     if (index < 0) index = len + index;
     
     if (index < 0 || index >= len)
     {
-        std::cout << "(nil)" << std::endl;
-        return "";
+        return {DbStatus::NOT_FOUND};
     }
     
-    std::cout << "\"" << lst[index] << "\"" << std::endl;
-    return lst[index];
+    return {DbStatus::OK, list.listIndex(index)};
 }
 
-bool Db::lset(const std::string& key, long long index, const std::string& value)
+DbStatus Db::lset(std::string_view key, long long index, std::string_view value)
 {
-    cleanupIfExpired(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
     
-    auto it = bucketstore.find(key);
-    
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(error) ERR no such key" << std::endl;
-        return false;
+        return DbStatus::NO_SUCH_KEY;
     }
     
-    if (it->second.type != ValueType::LIST)
+    if (it->second.type() != ValueType::LIST)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return false;
+        return DbStatus::WRONG_TYPE;
     }
     
-    RedisList& lst = it->second.list();
-    long long len = lst.size();
+    Value &list = it->second;
+    long long len = list.listLength();
     
     if (index < 0) index = len + index;
     
     if (index < 0 || index >= len)
     {
-        std::cout << "(error) ERR index out of range" << std::endl;
-        return false;
+        return DbStatus::OUT_OF_RANGE;
     }
     
-    lst[index] = value;
-    logToAOF("LSET " + key + " " + std::to_string(index) + " " + value);
-    checkAutoSave();
+    list.listSet(index, value);
+    logToAOF({"LSET", key, std::to_string(index), value});
     
-    std::cout << "OK" << std::endl;
-    return true;
+    return DbStatus::OK;
 }
 
 // ============== Set Commands ==============
 
-long long Db::sadd(const std::string& key, const std::vector<std::string>& members)
+DbResult<long long> Db::sadd(std::string_view key, const std::vector<std::string_view>& members)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
     long long added = 0;
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        RedisSet newSet(members.begin(), members.end());
-        added = newSet.size();
-        bucketstore[key] = Value(newSet);
+        it = shard.bucketstore.emplace(std::string(key), Value(ValueType::SET)).first;
     }
-    else if (it->second.type != ValueType::SET)
-    {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
-    }
-    else
+    else if (it->second.type() != ValueType::SET)
     {
-        for (const auto& member : members)
-        {
-            auto result = it->second.set().insert(member);
-            if (result.second) added++;
-        }
+        return {DbStatus::WRONG_TYPE};
     }
-    
+
     for (const auto& member : members)
     {
-        logToAOF("SADD " + key + " " + member);
+        if (it->second.setAdd(member)) added++;
     }
-    checkAutoSave();
     
-    std::cout << "(integer) " << added << std::endl;
-    return added;
+    logToAOF("SADD", key, members);
+    
+    return {DbStatus::OK, added};
 }
 
-long long Db::srem(const std::string& key, const std::string& member)
+DbResult<long long> Db::srem(std::string_view key, std::string_view member)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) 0" << std::endl;
-        return 0;
+        return {DbStatus::OK, 0};
     }
     
-    if (it->second.type != ValueType::SET)
+    if (it->second.type() != ValueType::SET)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
+        return {DbStatus::WRONG_TYPE};
     }
     
-    long long removed = it->second.set().erase(member);
+    long long removed = it->second.setRemove(member) ? 1 : 0;
     
-    if (it->second.set().empty())
+    if (it->second.setSize() == 0)
     {
-        bucketstore.erase(it);
+        eraseKey(shard, it);
     }
     
     if (removed > 0)
     {
-        logToAOF("SREM " + key + " " + member);
-        checkAutoSave();
+        logToAOF({"SREM", key, member});
     }
     
-    std::cout << "(integer) " << removed << std::endl;
-    return removed;
+    return {DbStatus::OK, removed};
 }
 
-std::vector<std::string> Db::smembers(const std::string& key)
+DbResult<std::vector<std::string>> Db::smembers(std::string_view key)
 {
-    cleanupIfExpired(key);
-    std::vector<std::string> result;
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    DbResult<std::vector<std::string>> result;
     
-    auto it = bucketstore.find(key);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(empty set)" << std::endl;
         return result;
     }
     
-    if (it->second.type != ValueType::SET)
+    if (it->second.type() != ValueType::SET)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
+        result.status = DbStatus::WRONG_TYPE;
         return result;
     }
     
-    int i = 1;
-    for (const auto& member : it->second.set())
-    {
-        result.push_back(member);
-        std::cout << i++ << ") \"" << member << "\"" << std::endl;
-    }
-    
+    result.value.reserve(it->second.setSize());
+    it->second.forEachMember([&](std::string_view member) { result.value.emplace_back(member); });
     return result;
 }
 
-bool Db::sismember(const std::string& key, const std::string& member)
+DbResult<bool> Db::sismember(std::string_view key, std::string_view member)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) 0" << std::endl;
-        return false;
+        return {DbStatus::OK, false};
     }
     
-    if (it->second.type != ValueType::SET)
+    if (it->second.type() != ValueType::SET)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return false;
+        return {DbStatus::WRONG_TYPE};
     }
     
-    bool exists = it->second.set().count(member) > 0;
-    std::cout << "(integer) " << (exists ? 1 : 0) << std::endl;
-    return exists;
+    return {DbStatus::OK, it->second.setHas(member)};
 }
 
-long long Db::scard(const std::string& key)
+DbResult<long long> Db::scard(std::string_view key)
 {
-    cleanupIfExpired(key);
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
     
-    auto it = bucketstore.find(key);
-    
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) 0" << std::endl;
-        return 0;
+        return {DbStatus::OK, 0};
     }
     
-    if (it->second.type != ValueType::SET)
+    if (it->second.type() != ValueType::SET)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
+        return {DbStatus::WRONG_TYPE};
     }
     
-    long long size = it->second.set().size();
-    std::cout << "(integer) " << size << std::endl;
-    return size;
+    return {DbStatus::OK, static_cast<long long>(it->second.setSize())};
 }
 
 // ============== Hash Commands ==============
 
-bool Db::hset(const std::string& key, const std::string& field, const std::string& value)
+DbResult<bool> Db::hset(std::string_view key, std::string_view field, std::string_view value)
 {
-    cleanupIfExpired(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
     
-    auto it = bucketstore.find(key);
-    bool isNew = false;
-    
-    if (it == bucketstore.end())
-    {
-        RedisHash newHash;
-        newHash[field] = value;
-        bucketstore[key] = Value(newHash);
-        isNew = true;
-    }
-    else if (it->second.type != ValueType::HASH)
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return false;
+        it = shard.bucketstore.emplace(std::string(key), Value(ValueType::HASH)).first;
     }
-    else
+    else if (it->second.type() != ValueType::HASH)
     {
-        isNew = (it->second.hash().find(field) == it->second.hash().end());
-        it->second.hash()[field] = value;
+        return {DbStatus::WRONG_TYPE};
     }
+
+    bool isNew = it->second.hashSet(field, value);
     
-    logToAOF("HSET " + key + " " + field + " " + value);
-    checkAutoSave();
+    logToAOF({"HSET", key, field, value});
     
-    std::cout << "(integer) " << (isNew ? 1 : 0) << std::endl;
-    return true;
+    return {DbStatus::OK, isNew};
 }
 
-std::string Db::hget(const std::string& key, const std::string& field)
+DbResult<std::string> Db::hget(std::string_view key, std::string_view field)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(nil)" << std::endl;
-        return "";
+        return {DbStatus::NOT_FOUND};
     }
     
-    if (it->second.type != ValueType::HASH)
+    if (it->second.type() != ValueType::HASH)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return "";
+        return {DbStatus::WRONG_TYPE};
     }
     
-    auto fieldIt = it->second.hash().find(field);
-    if (fieldIt == it->second.hash().end())
+    std::string_view value;
+    if (!it->second.hashGet(field, value))
     {
-        std::cout << "(nil)" << std::endl;
-        return "";
+        return {DbStatus::NOT_FOUND};
     }
     
-    std::cout << "\"" << fieldIt->second << "\"" << std::endl;
-    return fieldIt->second;
+    return {DbStatus::OK, std::string(value)};
 }
 
-bool Db::hdel(const std::string& key, const std::string& field)
+DbResult<bool> Db::hdel(std::string_view key, std::string_view field)
 {
-    cleanupIfExpired(key);
+    AfterWrite after_write{*this};
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lookup(shard, key);
     
-    auto it = bucketstore.find(key);
-    
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) 0" << std::endl;
-        return false;
+        return {DbStatus::OK, false};
     }
     
-    if (it->second.type != ValueType::HASH)
+    if (it->second.type() != ValueType::HASH)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return false;
+        return {DbStatus::WRONG_TYPE};
     }
     
-    bool deleted = it->second.hash().erase(field) > 0;
+    bool deleted = it->second.hashDelete(field);
     
-    if (it->second.hash().empty())
+    if (it->second.hashLength() == 0)
     {
-        bucketstore.erase(it);
+        eraseKey(shard, it);
     }
     
     if (deleted)
     {
-        logToAOF("HDEL " + key + " " + field);
-        checkAutoSave();
+        logToAOF({"HDEL", key, field});
     }
     
-    std::cout << "(integer) " << (deleted ? 1 : 0) << std::endl;
-    return deleted;
+    return {DbStatus::OK, deleted};
 }
 
-std::vector<std::pair<std::string, std::string>> Db::hgetall(const std::string& key)
+DbResult<std::vector<std::pair<std::string, std::string>>> Db::hgetall(std::string_view key)
 {
-    cleanupIfExpired(key);
-    std::vector<std::pair<std::string, std::string>> result;
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    DbResult<std::vector<std::pair<std::string, std::string>>> result;
     
-    auto it = bucketstore.find(key);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(empty hash)" << std::endl;
         return result;
     }
     
-    if (it->second.type != ValueType::HASH)
+    if (it->second.type() != ValueType::HASH)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
+        result.status = DbStatus::WRONG_TYPE;
         return result;
     }
     
-    int i = 1;
-    for (const auto& pair : it->second.hash())
-    {
-        result.push_back(pair);
-        std::cout << i++ << ") \"" << pair.first << "\"" << std::endl;
-        std::cout << i++ << ") \"" << pair.second << "\"" << std::endl;
-    }
-    
+    result.value.reserve(it->second.hashLength());
+    it->second.forEachField([&](std::string_view field, std::string_view value) {
+        result.value.emplace_back(field, value);
+    });
     return result;
 }
 
-std::vector<std::string> Db::hkeys(const std::string& key)
+DbResult<std::vector<std::string>> Db::hkeys(std::string_view key)
 {
-    cleanupIfExpired(key);
-    std::vector<std::string> result;
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    DbResult<std::vector<std::string>> result;
     
-    auto it = bucketstore.find(key);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(empty list)" << std::endl;
         return result;
     }
     
-    if (it->second.type != ValueType::HASH)
+    if (it->second.type() != ValueType::HASH)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
+        result.status = DbStatus::WRONG_TYPE;
         return result;
     }
     
-    int i = 1;
-    for (const auto& pair : it->second.hash())
-    {
-        result.push_back(pair.first);
-        std::cout << i++ << ") \"" << pair.first << "\"" << std::endl;
-    }
+    result.value.reserve(it->second.hashLength());
+    it->second.forEachField([&](std::string_view field, std::string_view) { result.value.emplace_back(field); });
     
     return result;
 }
 
-std::vector<std::string> Db::hvals(const std::string& key)
+DbResult<std::vector<std::string>> Db::hvals(std::string_view key)
 {
-    cleanupIfExpired(key);
-    std::vector<std::string> result;
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    DbResult<std::vector<std::string>> result;
     
-    auto it = bucketstore.find(key);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(empty list)" << std::endl;
         return result;
     }
     
-    if (it->second.type != ValueType::HASH)
+    if (it->second.type() != ValueType::HASH)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
+        result.status = DbStatus::WRONG_TYPE;
         return result;
     }
     
-    int i = 1;
-    for (const auto& pair : it->second.hash())
-    {
-        result.push_back(pair.second);
-        std::cout << i++ << ") \"" << pair.second << "\"" << std::endl;
-    }
+    result.value.reserve(it->second.hashLength());
+    it->second.forEachField([&](std::string_view, std::string_view value) { result.value.emplace_back(value); });
     
     return result;
 }
 
-long long Db::hlen(const std::string& key)
+DbResult<long long> Db::hlen(std::string_view key)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) 0" << std::endl;
-        return 0;
+        return {DbStatus::OK, 0};
     }
     
-    if (it->second.type != ValueType::HASH)
+    if (it->second.type() != ValueType::HASH)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return -1;
+        return {DbStatus::WRONG_TYPE};
     }
     
-    long long size = it->second.hash().size();
-    std::cout << "(integer) " << size << std::endl;
-    return size;
+    return {DbStatus::OK, static_cast<long long>(it->second.hashLength())};
 }
 
-bool Db::hexists(const std::string& key, const std::string& field)
+DbResult<bool> Db::hexists(std::string_view key, std::string_view field)
 {
-    cleanupIfExpired(key);
-    
-    auto it = bucketstore.find(key);
+    const Shard &shard = shardFor(key);
+    ReadLock lock(shard);
+    auto it = find(shard, key);
     
-    if (it == bucketstore.end())
+    if (it == shard.bucketstore.end())
     {
-        std::cout << "(integer) 0" << std::endl;
-        return false;
+        return {DbStatus::OK, false};
     }
     
-    if (it->second.type != ValueType::HASH)
+    if (it->second.type() != ValueType::HASH)
     {
-        std::cout << "(error) WRONGTYPE" << std::endl;
-        return false;
+        return {DbStatus::WRONG_TYPE};
     }
     
-    bool exists = it->second.hash().count(field) > 0;
-    std::cout << "(integer) " << (exists ? 1 : 0) << std::endl;
-    return exists;
+    return {DbStatus::OK, it->second.hashHas(field)};
 }
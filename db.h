@@ -3,89 +3,390 @@
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
+#include <initializer_list>
 #include <fstream>
 #include <chrono>
 #include <vector>
+#include <optional>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <condition_variable>
+#include <sys/types.h>
 #include "value.h"
+#include "swisstable.h"
+#include "aof.h"
+#include "rdb.h"
+
+// Outcome of a Db command. Anything other than OK tells the caller which
+// error (or nil) reply to produce.
+enum class DbStatus
+{
+    OK,
+    NOT_FOUND,      // Missing key, field or element (nil reply)
+    WRONG_TYPE,     // Key holds a different kind of value
+    NOT_INTEGER,    // Value is not an integer
+    OVERFLOW,       // Increment or decrement would overflow
+    NO_SUCH_KEY,    // Command requires the key to exist
+    OUT_OF_RANGE,   // Index or offset out of range
+    TOO_LARGE,      // String would exceed Value::MAX_STRING
+    BUSY,           // A background save is already in progress
+    IO_ERROR        // Saving failed
+};
+
+template <typename T>
+struct DbResult
+{
+    DbStatus status = DbStatus::OK;
+    T value{};
+
+    bool ok() const { return status == DbStatus::OK; }
+};
 
 class Db
 {
 private:
-    std::unordered_map<std::string, Value> bucketstore;
-    void cleanupIfExpired(const std::string &key);
+    using Keyspace = SwissTable<Value>;
+
+    // A key that was given a TTL, queued for the active expirer. Holds the
+    // key's hashString() rather than a copy of it; the expirer finds the
+    // key through the keyspace, which stores the same hash.
+    struct ExpiryEntry
+    {
+        std::chrono::steady_clock::time_point when;
+        size_t hash;
+
+        bool operator>(const ExpiryEntry &other) const { return when > other.when; }
+    };
+
+    // The keyspace is hash-partitioned into shards, each guarded by its own
+    // reader-writer lock. Single-key commands lock one shard; commands that
+    // touch several shards lock them in ascending index order.
+    struct Shard
+    {
+        mutable std::shared_mutex mutex;
+        Keyspace bucketstore;
+        // Expiration time of every key whose Value has its expiry flag set,
+        // by the key's hashString(), the hash the keyspace stores, so the
+        // key is not copied. Which key an entry belongs to is confirmed
+        // against the keyspace: the one with that hash and its flag set that
+        // is not in colliding_expires.
+        std::unordered_map<size_t, std::chrono::steady_clock::time_point> expires;
+        // Keys with a TTL whose hash another such key already has in
+        // expires, by key. Practically always empty.
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point> colliding_expires;
+
+        // Lazy loading: values still pointing into the snapshot mapping.
+        // Only ever decreases after startup.
+        std::atomic<size_t> encoded{0};
+        size_t decode_cursor = 0;       // Next group for the background decoder (see SwissTable::scan())
+
+        // Active expiry: min-heap of expiration times. Entries are never
+        // updated in place, so some are stale (the key was deleted,
+        // overwritten or given another TTL); the expirer checks the keys
+        // with each one's hash against expires.
+        // Guarded by mutex, held exclusively to modify it.
+        std::vector<ExpiryEntry> expiry_heap;
+    };
+
+    // Lock for read-only commands: shared, except while the shard still has
+    // encoded values, when it is exclusive so that find() can decode a value
+    // in place
+    class ReadLock
+    {
+    public:
+        explicit ReadLock(const Shard &shard)
+            : mutex_(&shard.mutex), exclusive_(shard.encoded.load(std::memory_order_acquire) > 0)
+        {
+            exclusive_ ? mutex_->lock() : mutex_->lock_shared();
+        }
+        ReadLock(ReadLock &&other) noexcept : mutex_(other.mutex_), exclusive_(other.exclusive_)
+        {
+            other.mutex_ = nullptr;
+        }
+        ReadLock(const ReadLock &) = delete;
+        ReadLock &operator=(const ReadLock &) = delete;
+        ~ReadLock()
+        {
+            if (mutex_ != nullptr)
+                exclusive_ ? mutex_->unlock() : mutex_->unlock_shared();
+        }
+
+    private:
+        std::shared_mutex *mutex_;
+        bool exclusive_;
+    };
+
+    std::vector<Shard> shards_;
+
+    Shard &shardFor(std::string_view key) { return shards_[shardIndex(key)]; }
+    std::vector<size_t> shardIndexes(const std::vector<std::string_view> &keys, size_t step) const;
+
+    // Entries move when the keyspace changes: an iterator from these is only
+    // good until the next lookup(), store() or eraseKey() on its shard
+    Keyspace::iterator lookup(Shard &shard, std::string_view key);
+    Keyspace::const_iterator find(const Shard &shard, std::string_view key) const;
+    void store(Shard &shard, std::string_view key, Value &&value);
+    void eraseKey(Shard &shard, Keyspace::iterator it);
+
+    // Expiration of a key, from its shard's expires tables; nullptr without one
+    const std::chrono::steady_clock::time_point *expirationOf(const Shard &shard,
+                                                             const Keyspace::value_type &entry) const;
+    bool isExpired(const Shard &shard, const Keyspace::value_type &entry) const;
+    void setExpiration(Shard &shard, Keyspace::iterator it, std::chrono::steady_clock::time_point when);
+    void clearExpiration(Shard &shard, Keyspace::iterator it);
+    // setExpiration() without queueing the key for the active expirer
+    void recordExpiration(Shard &shard, Keyspace::iterator it, std::chrono::steady_clock::time_point when);
+    // Drops the expires entry of a key whose expiry flag is set
+    void dropExpiration(Shard &shard, const std::string &key);
+
+    // ============== Lazy Loading ==============
+    // With lazy_load_, startup maps the snapshot and only indexes the keys;
+    // each value is decoded on first access, and the cron thread decodes the
+    // rest a little at a time before releasing the mapping.
+    bool lazy_load_;
+    std::unique_ptr<RDBMapping> mapping_;
+    std::atomic<bool> mapped_{false};
+
+    void decodeInPlace(Shard &shard, Value &value) const;
+    void decodeSome();
+
+    // ============== Incremental Rehashing ==============
+    // Each write to a shard moves one group of a resizing keyspace table;
+    // the cron thread moves more while the shard is otherwise idle.
+    void rehashSome();
+
+    // ============== Active Expiry ==============
+    // Lookups delete expired keys they run into; the cron thread deletes the
+    // rest, popping due entries off each shard's expiry heap within a time
+    // budget per tick, a small batch per lock acquisition.
+    std::atomic<long long> expired_keys_{0};        // Deleted by either path
+    std::atomic<long long> expired_per_sec_{0};
+    std::atomic<long long> expired_backlog_{0};     // Due heap entries left after the last tick
+    size_t expire_cursor_ = 0;                      // Shard the next tick starts at
+    long long expired_at_sample_ = 0;
+    std::chrono::steady_clock::time_point expire_sample_time_;
+
+    void scheduleExpiry(Shard &shard, size_t hash, std::chrono::steady_clock::time_point when);
+    void rebuildExpiryIndex(Shard &shard);
+    void expireSome();
+    void sampleExpiryStats();
+    static size_t countDue(const std::vector<ExpiryEntry> &heap, std::chrono::steady_clock::time_point now);
 
     std::string rdb_filename_;
     std::string aof_filename_;
-    std::ofstream aof_file_;
+    AofFsync aof_fsync_;
+    AofWriter aof_;
 
+    std::mutex save_mutex_;
     std::chrono::steady_clock::time_point last_save_time_;
     int auto_save_interval_;
 
-    void logToAOF(const std::string &command);
+    // ============== Background Saving ==============
+    // At most one forked child runs at a time, writing either a snapshot
+    // (BGSAVE) or an AOF base (BGREWRITEAOF). The child fields and those
+    // without atomics are guarded by save_mutex_.
+    enum class ChildType
+    {
+        NONE,
+        BGSAVE,
+        REWRITE
+    };
+    pid_t child_pid_ = -1;
+    ChildType child_type_ = ChildType::NONE;
+    long long dirty_at_fork_ = 0;
+    uint64_t child_aof_seq_ = 0;                    // First segment the child's output does not cover
+    std::chrono::steady_clock::time_point child_started_;
+    std::atomic<long long> dirty_{0};               // Writes since the last successful save
+    std::atomic<long long> last_save_unix_{0};
+    std::atomic<bool> bgsave_running_{false};
+    std::atomic<bool> last_bgsave_ok_{true};
+    std::atomic<long long> last_bgsave_seconds_{-1};
+    std::atomic<bool> rewrite_running_{false};
+    std::atomic<bool> last_rewrite_ok_{true};
+    std::atomic<long long> last_rewrite_seconds_{-1};
+
+    // Housekeeping thread: reaps children and triggers auto-saves and
+    // AOF rewrites
+    std::thread cron_;
+    std::mutex cron_mutex_;
+    std::condition_variable cron_wake_;
+    bool cron_stop_ = false;
+
+    void cronLoop();
+    DbStatus startBgsave();
+    DbStatus startRewrite();
+    void reapChild(bool block);
+    std::string tempRDBName(pid_t pid) const;
+
+    // ============== AOF Segments ==============
+    // The AOF is a numbered series of files, aof_filename_ + "." + seq. A
+    // snapshot is taken right after switching to a new segment and records
+    // that segment's number, so startup replays exactly the segments written
+    // after it and older ones can be deleted once the snapshot is on disk.
+    // Changed only with save_mutex_ and every shard lock held.
+    //
+    // BGREWRITEAOF compacts the same way, except that the child writes the
+    // keyspace as commands to a base file, aof_filename_ + "." + seq +
+    // ".base". Startup begins from whichever of the snapshot and the newest
+    // base covers more segments.
+    uint64_t aof_seq_ = 1;
+
+    // Auto-rewrite once the AOF has grown by aof_rewrite_percentage_ since
+    // the last compaction and is at least aof_rewrite_min_size_ bytes
+    int aof_rewrite_percentage_;
+    long long aof_rewrite_min_size_;
+    std::atomic<long long> aof_older_size_{0};      // Bytes in live AOF files before the current segment
+    std::atomic<long long> aof_base_size_{0};       // AOF size right after the last compaction
+
+    std::string aofSegmentName(uint64_t seq) const;
+    std::string aofBaseName(uint64_t seq) const;
+    std::vector<uint64_t> listAOFFiles(std::string_view suffix) const;
+    void removeAOFSegmentsBefore(uint64_t seq);
+    bool rotateAOF();
+    void updateAOFSize();
+    long long aofSize() const;
+    void checkAutoRewrite();
+    bool writeAOFBase(const std::string &tmp_filename) const;
+
+    bool replaying_ = false;    // Set while loading the AOF
+
+    void logToAOF(std::initializer_list<std::string_view> args);
+    void logToAOF(std::string_view cmd, std::string_view key, const std::vector<std::string_view> &values);
+    void replayCommand(const std::vector<std::string_view> &args);
+    bool convertLegacyAOF(const std::string &filename);
+    bool loadLegacyRDB(const std::string &filename);
+    bool loadRDB(uint64_t &aof_seq);
+    void loadAOF(uint64_t snapshot_seq);
+    bool replayAOF(const std::string &filename);
     void checkAutoSave();
+    std::vector<std::shared_lock<std::shared_mutex>> lockAllShards() const;
+    bool writeRDB(const std::string &tmp_filename, uint64_t aof_seq) const;
+    DbStatus snapshot();
+
+    // Declared before a write command takes its shard lock, so that waiting
+    // for the AOF fsync (appendfsync always) happens only after the lock has
+    // been released
+    struct AfterWrite
+    {
+        Db &db;
+        ~AfterWrite() { db.aof_.waitDurable(); }
+    };
 
 public:
 
-    Db(const std::string &rdb_file = "dump.json",
+    Db(const std::string &rdb_file = "dump.rdb",
         const std::string& aof_file = "dump.aof",
-       int auto_save_interval = 60);
+       int auto_save_interval = 60,
+       size_t shard_count = 16,
+       AofFsync aof_fsync = AofFsync::EVERYSEC,
+       int aof_rewrite_percentage = 100,
+       long long aof_rewrite_min_size = 64 * 1024 * 1024,
+       bool lazy_load = false);
 
     ~Db();
 
+    // ============== Partitioning ==============
+    // Shard owning a key; lets the server route commands by key
+    size_t shardIndex(std::string_view key) const;
+    size_t shardCount() const { return shards_.size(); }
+
     // ============== String Commands ==============
-    void set(const std::string &key, const std::string &value);
-    bool get(const std::string &key);
-    bool del(const std::string &key);
-    bool exists(const std::string &key);
-    bool incr(const std::string &key);
-    bool incrby(const std::string &key, long long amount);
-    bool decr(const std::string &key);
-    bool decrby(const std::string &key, long long amount);
-    long long append(const std::string& key, const std::string& value);
-    long long strlen(const std::string& key);
-    void mget(const std::vector<std::string>& keys);
-    void mset(const std::vector<std::string>& keyvals);
-    std::string getrange(const std::string& key, long long start, long long end);
-    long long setrange(const std::string& key, long long offset, const std::string& value);
+    void set(std::string_view key, std::string_view value);
+    DbResult<std::string> get(std::string_view key);
+    // GET for the server: appends the value to reply as a RESP bulk string
+    // while the shard is locked, so integers are formatted straight into it
+    DbStatus getBulk(std::string_view key, std::string &reply);
+    bool del(std::string_view key);
+    bool exists(std::string_view key);
+    DbResult<long long> incr(std::string_view key);
+    DbResult<long long> incrby(std::string_view key, long long amount);
+    DbResult<long long> decr(std::string_view key);
+    DbResult<long long> decrby(std::string_view key, long long amount);
+    DbResult<long long> append(std::string_view key, std::string_view value);
+    DbResult<long long> strlen(std::string_view key);
+    std::vector<std::optional<std::string>> mget(const std::vector<std::string_view> &keys);
+    bool mset(const std::vector<std::string_view> &keyvals);
+    DbResult<std::string> getrange(std::string_view key, long long start, long long end);
+    DbResult<long long> setrange(std::string_view key, long long offset, std::string_view value);
     
     // ============== Key Commands ==============
-    bool expire(const std::string &key, long long seconds);
-    long long ttl(const std::string &key);
-    bool persist(const std::string &key);
-    std::string type(const std::string& key);
+    // The relative forms saturate instead of overflowing; the AOF records
+    // every TTL as an absolute PEXPIREAT
+    bool expire(std::string_view key, long long seconds);
+    bool pexpire(std::string_view key, long long milliseconds);
+    bool pexpireat(std::string_view key, long long unix_ms);
+    long long ttl(std::string_view key);
+    long long pttl(std::string_view key);
+    bool persist(std::string_view key);
+    std::string_view type(std::string_view key);
     
     // ============== List Commands ==============
-    long long lpush(const std::string& key, const std::vector<std::string>& values);
-    long long rpush(const std::string& key, const std::vector<std::string>& values);
-    std::string lpop(const std::string& key);
-    std::string rpop(const std::string& key);
-    long long llen(const std::string& key);
-    std::vector<std::string> lrange(const std::string& key, long long start, long long stop);
-    std::string lindex(const std::string& key, long long index);
-    bool lset(const std::string& key, long long index, const std::string& value);
+    DbResult<long long> lpush(std::string_view key, const std::vector<std::string_view> &values);
+    DbResult<long long> rpush(std::string_view key, const std::vector<std::string_view> &values);
+    DbResult<std::string> lpop(std::string_view key);
+    DbResult<std::string> rpop(std::string_view key);
+    DbResult<long long> llen(std::string_view key);
+    DbResult<std::vector<std::string>> lrange(std::string_view key, long long start, long long stop);
+    DbResult<std::string> lindex(std::string_view key, long long index);
+    DbStatus lset(std::string_view key, long long index, std::string_view value);
     
     // ============== Set Commands ==============
-    long long sadd(const std::string& key, const std::vector<std::string>& members);
-    long long srem(const std::string& key, const std::string& member);
-    std::vector<std::string> smembers(const std::string& key);
-    bool sismember(const std::string& key, const std::string& member);
-    long long scard(const std::string& key);
+    DbResult<long long> sadd(std::string_view key, const std::vector<std::string_view> &members);
+    DbResult<long long> srem(std::string_view key, std::string_view member);
+    DbResult<std::vector<std::string>> smembers(std::string_view key);
+    DbResult<bool> sismember(std::string_view key, std::string_view member);
+    DbResult<long long> scard(std::string_view key);
     
     // ============== Hash Commands ==============
-    bool hset(const std::string& key, const std::string& field, const std::string& value);
-    std::string hget(const std::string& key, const std::string& field);
-    bool hdel(const std::string& key, const std::string& field);
-    std::vector<std::pair<std::string, std::string>> hgetall(const std::string& key);
-    std::vector<std::string> hkeys(const std::string& key);
-    std::vector<std::string> hvals(const std::string& key);
-    long long hlen(const std::string& key);
-    bool hexists(const std::string& key, const std::string& field);
+    DbResult<bool> hset(std::string_view key, std::string_view field, std::string_view value);
+    DbResult<std::string> hget(std::string_view key, std::string_view field);
+    DbResult<bool> hdel(std::string_view key, std::string_view field);
+    DbResult<std::vector<std::pair<std::string, std::string>>> hgetall(std::string_view key);
+    DbResult<std::vector<std::string>> hkeys(std::string_view key);
+    DbResult<std::vector<std::string>> hvals(std::string_view key);
+    DbResult<long long> hlen(std::string_view key);
+    DbResult<bool> hexists(std::string_view key, std::string_view field);
     
     // ============== Persistence ==============
-    bool saveRDB();
-    bool loadRDB();
-    bool loadAOF();
-    void startNewAOF();
+    // Snapshot to the RDB file and start a new AOF segment, atomically with
+    // respect to concurrent writers. BUSY while a BGSAVE is running.
+    DbStatus save();
+    // Same, from a forked child while the server keeps serving
+    DbStatus bgsave();
+    // Compacts the AOF into the shortest command list that rebuilds the
+    // keyspace, from a forked child. BUSY while another child is running.
+    DbStatus bgrewriteaof();
+
+    struct SaveInfo
+    {
+        long long changes_since_last_save;
+        bool bgsave_in_progress;
+        long long last_save_time;       // Unix seconds, as LASTSAVE
+        bool last_bgsave_ok;
+        long long last_bgsave_seconds;  // -1 before the first BGSAVE
+        bool rewrite_in_progress;
+        bool last_rewrite_ok;
+        long long last_rewrite_seconds; // -1 before the first rewrite
+        long long aof_current_size;     // Bytes in every live AOF file
+        long long aof_base_size;        // aof_current_size after the last compaction
+        long long lazy_pending;         // Snapshot values not decoded yet
+    };
+    SaveInfo saveInfo() const;
+
+    struct ExpiryInfo
+    {
+        long long expired_keys;         // Since startup
+        long long expired_per_sec;      // Over the last second
+        long long backlog;              // Keys past their TTL not deleted yet (approximate)
+    };
+    ExpiryInfo expiryInfo() const;
+
+    AofWriter::Stats aofStats() const { return aof_.stats(); }
+    AofFsync aofFsync() const { return aof_fsync_; }
 };
 
 #endif
@@ -0,0 +1,430 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include "hash.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Mapped type of a Dict used as a set
+struct NoValue
+{
+};
+
+// Hash table from strings to T that resizes without pausing, like Redis's
+// dict. Buckets are chains in a power-of-two table. When the table fills up
+// (or empties out), a second one of the new size is allocated and entries
+// move over a bucket at a time: one bucket per insert, erase or non-const
+// find, plus whatever rehashStep() is given from the cron thread. Lookups
+// check both tables meanwhile and inserts go to the new one. No single
+// operation pays for rehashing the whole table, which std::unordered_map
+// does in one go.
+//
+// Entries are allocated one by one and never move, so references and
+// iterators stay valid until their entry is erased; rehashing only relinks
+// them. Iterating while inserting or erasing is not supported. Lookups take
+// a string_view and never build a temporary std::string.
+template <typename T>
+class Dict
+{
+    struct Node;
+
+public:
+    using value_type = std::pair<const std::string, T>;
+
+    template <bool Const>
+    class Iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Dict::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type *, value_type *>;
+        using reference = std::conditional_t<Const, const value_type &, value_type &>;
+
+        Iterator() = default;
+        // iterator converts to const_iterator
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        Iterator(const Iterator<false> &other)
+            : dict_(other.dict_), table_(other.table_), bucket_(other.bucket_), node_(other.node_)
+        {
+        }
+
+        reference operator*() const { return node_->entry; }
+        pointer operator->() const { return &node_->entry; }
+
+        Iterator &operator++()
+        {
+            node_ = node_->next;
+            if (node_ == nullptr)
+            {
+                bucket_++;
+                settle();
+            }
+            return *this;
+        }
+
+        template <bool C>
+        bool operator==(const Iterator<C> &other) const { return node_ == other.node_; }
+        template <bool C>
+        bool operator!=(const Iterator<C> &other) const { return node_ != other.node_; }
+
+    private:
+        friend class Dict;
+        friend class Iterator<!Const>;
+        using DictPointer = std::conditional_t<Const, const Dict *, Dict *>;
+
+        DictPointer dict_ = nullptr;
+        int table_ = 0;
+        size_t bucket_ = 0;
+        Node *node_ = nullptr;
+
+        Iterator(DictPointer dict, int table, size_t bucket, Node *node)
+            : dict_(dict), table_(table), bucket_(bucket), node_(node)
+        {
+        }
+
+        // Moves to the first entry at or after bucket_, or to the end
+        void settle()
+        {
+            for (; table_ < 2; table_++, bucket_ = 0)
+            {
+                const Table &table = dict_->tables_[table_];
+                for (; bucket_ < table.size; bucket_++)
+                {
+                    if (table.buckets[bucket_] != nullptr)
+                    {
+                        node_ = table.buckets[bucket_];
+                        return;
+                    }
+                }
+            }
+            node_ = nullptr;
+        }
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    Dict() = default;
+    explicit Dict(size_t capacity) { reserve(capacity); }
+    Dict(const Dict &other)
+    {
+        reserve(other.size());
+        for (const auto &entry : other)
+            try_emplace(entry.first, entry.second);
+    }
+    Dict &operator=(const Dict &) = delete;
+    ~Dict() { clear(); }
+
+    size_t size() const { return tables_[0].used + tables_[1].used; }
+    bool empty() const { return size() == 0; }
+    bool rehashing() const { return tables_[1].buckets != nullptr; }
+
+    iterator begin()
+    {
+        iterator it(this, 0, 0, nullptr);
+        it.settle();
+        return it;
+    }
+    iterator end() { return iterator(); }
+    const_iterator begin() const
+    {
+        const_iterator it(this, 0, 0, nullptr);
+        it.settle();
+        return it;
+    }
+    const_iterator end() const { return const_iterator(); }
+
+    iterator find(std::string_view key)
+    {
+        rehashStep(1);
+        int table;
+        size_t bucket;
+        Node *node = locate(key, hashOf(key), table, bucket);
+        return node != nullptr ? iterator(this, table, bucket, node) : end();
+    }
+
+    const_iterator find(std::string_view key) const
+    {
+        int table;
+        size_t bucket;
+        Node *node = locate(key, hashOf(key), table, bucket);
+        return node != nullptr ? const_iterator(this, table, bucket, node) : end();
+    }
+
+    size_t count(std::string_view key) const { return find(key) != end() ? 1 : 0; }
+
+    // Inserts key with T(args...) unless it is already there. key may be a
+    // std::string rvalue, which is moved in.
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&...args)
+    {
+        rehashStep(1);
+        std::string_view view(key);
+        size_t hash = hashOf(view);
+        int table;
+        size_t bucket;
+        if (Node *node = locate(view, hash, table, bucket))
+            return {iterator(this, table, bucket, node), false};
+
+        growIfFull();
+        table = rehashing() ? 1 : 0;
+        Table &target = tables_[table];
+        bucket = hash & (target.size - 1);
+        Node *node = new Node(hash, std::forward<K>(key), std::forward<Args>(args)...);
+        node->next = target.buckets[bucket];
+        target.buckets[bucket] = node;
+        target.used++;
+        return {iterator(this, table, bucket, node), true};
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> emplace(K &&key, Args &&...args)
+    {
+        return try_emplace(std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    template <typename K, typename M>
+    std::pair<iterator, bool> insert_or_assign(K &&key, M &&mapped)
+    {
+        auto result = try_emplace(std::forward<K>(key), std::forward<M>(mapped));
+        if (!result.second)
+            result.first->second = std::forward<M>(mapped);
+        return result;
+    }
+
+    template <typename K>
+    T &operator[](K &&key)
+    {
+        return try_emplace(std::forward<K>(key)).first->second;
+    }
+
+    size_t erase(std::string_view key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    // The iterator's bucket may be stale if a rehash step ran since it was
+    // returned, so the node is looked up by its hash again
+    void erase(iterator it)
+    {
+        Node *node = it.node_;
+        for (Table &table : tables_)
+        {
+            if (table.size == 0)
+                continue;
+            for (Node **link = &table.buckets[node->hash & (table.size - 1)]; *link != nullptr;
+                 link = &(*link)->next)
+            {
+                if (*link == node)
+                {
+                    *link = node->next;
+                    table.used--;
+                    delete node;
+                    shrinkIfSparse();
+                    return;
+                }
+            }
+        }
+    }
+
+    void clear()
+    {
+        for (Table &table : tables_)
+        {
+            for (size_t i = 0; i < table.size; i++)
+            {
+                for (Node *node = table.buckets[i]; node != nullptr;)
+                {
+                    Node *next = node->next;
+                    delete node;
+                    node = next;
+                }
+            }
+            std::free(table.buckets);
+            table = Table();
+        }
+        rehash_index_ = 0;
+    }
+
+    // Sizes the table for n entries in one go, finishing any rehash first.
+    // For bulk loads, where a pause is expected.
+    void reserve(size_t n)
+    {
+        size_t size = tableSizeFor(n);
+        while (rehashStep(1024))
+        {
+        }
+        if (size <= tables_[0].size)
+            return;
+        startResize(size);
+        while (rehashStep(1024))
+        {
+        }
+    }
+
+    // Moves up to n buckets into the new table, looking at no more than
+    // 10 * n empty ones; returns whether a rehash is still in progress
+    bool rehashStep(size_t n)
+    {
+        if (!rehashing())
+            return false;
+
+        Table &from = tables_[0];
+        Table &to = tables_[1];
+        size_t empty_visits = n * 10;
+        while (n-- > 0 && from.used > 0)
+        {
+            while (from.buckets[rehash_index_] == nullptr)
+            {
+                rehash_index_++;
+                if (--empty_visits == 0)
+                    return true;
+            }
+            for (Node *node = from.buckets[rehash_index_]; node != nullptr;)
+            {
+                Node *next = node->next;
+                size_t bucket = node->hash & (to.size - 1);
+                node->next = to.buckets[bucket];
+                to.buckets[bucket] = node;
+                from.used--;
+                to.used++;
+                node = next;
+            }
+            from.buckets[rehash_index_++] = nullptr;
+        }
+
+        if (from.used > 0)
+            return true;
+        std::free(from.buckets);
+        from = to;
+        to = Table();
+        rehash_index_ = 0;
+        return false;
+    }
+
+    // Calls f(entry) for the entries in bucket `cursor` of either table and
+    // returns the next cursor, 0 once past the last bucket. A full pass from
+    // 0 sees every entry that stayed put; a rehash meanwhile may cause some
+    // to be seen twice or missed.
+    template <typename F>
+    size_t scan(size_t cursor, F &&f)
+    {
+        for (Table &table : tables_)
+        {
+            if (cursor < table.size)
+            {
+                for (Node *node = table.buckets[cursor]; node != nullptr; node = node->next)
+                    f(node->entry);
+            }
+        }
+        cursor++;
+        return cursor < std::max(tables_[0].size, tables_[1].size) ? cursor : 0;
+    }
+
+private:
+    static constexpr size_t INITIAL_SIZE = 4;
+
+    struct Node
+    {
+        Node *next = nullptr;
+        size_t hash;
+        value_type entry;
+
+        template <typename K, typename... Args>
+        Node(size_t hash, K &&key, Args &&...args)
+            : hash(hash), entry(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                                std::forward_as_tuple(std::forward<Args>(args)...))
+        {
+        }
+    };
+
+    struct Table
+    {
+        Node **buckets = nullptr;
+        size_t size = 0;        // A power of two, or 0
+        size_t used = 0;
+    };
+
+    // tables_[1] is only allocated during a rehash, and buckets of
+    // tables_[0] below rehash_index_ are empty then
+    Table tables_[2];
+    size_t rehash_index_ = 0;
+
+    static size_t hashOf(std::string_view key) { return hashString(key); }
+
+    // Smallest power of two that holds n entries at a load factor of 1
+    static size_t tableSizeFor(size_t n)
+    {
+        size_t size = INITIAL_SIZE;
+        while (size < n)
+            size <<= 1;
+        return size;
+    }
+
+    Node *locate(std::string_view key, size_t hash, int &table, size_t &bucket) const
+    {
+        for (table = 0; table < 2; table++)
+        {
+            const Table &t = tables_[table];
+            if (t.size == 0)
+                continue;
+            bucket = hash & (t.size - 1);
+            for (Node *node = t.buckets[bucket]; node != nullptr; node = node->next)
+            {
+                if (node->hash == hash && node->entry.first == key)
+                    return node;
+            }
+        }
+        return nullptr;
+    }
+
+    void startResize(size_t size)
+    {
+        // calloc rather than new[]: a large table then comes straight from
+        // mmap as zero pages, instead of being cleared up front
+        Table table;
+        table.buckets = static_cast<Node **>(std::calloc(size, sizeof(Node *)));
+        if (table.buckets == nullptr)
+            throw std::bad_alloc();
+        table.size = size;
+        if (tables_[0].used == 0)
+        {
+            // Nothing to move
+            std::free(tables_[0].buckets);
+            tables_[0] = table;
+            return;
+        }
+        tables_[1] = table;
+        rehash_index_ = 0;
+    }
+
+    // Doubles at a load factor of 1
+    void growIfFull()
+    {
+        if (!rehashing() && tables_[0].used >= tables_[0].size)
+            startResize(tableSizeFor(tables_[0].used + 1));
+    }
+
+    // Down to a quarter full at most, once under an eighth
+    void shrinkIfSparse()
+    {
+        const Table &table = tables_[0];
+        if (!rehashing() && table.size > INITIAL_SIZE && table.used * 8 < table.size)
+            startResize(tableSizeFor(2 * table.used));
+    }
+};
+
+#endif
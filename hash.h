@@ -0,0 +1,22 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+// Hash of a key for the in-memory tables (Dict, SwissTable). std::hash also
+// picks the keyspace shard (see Db::shardIndex()), so all keys of a shard
+// agree in its low bits; MurmurHash3's finalizer spreads the rest over them
+// before a table takes its index from them.
+inline size_t hashString(std::string_view s)
+{
+    uint64_t hash = std::hash<std::string_view>()(s);
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return static_cast<size_t>(hash);
+}
+
+#endif
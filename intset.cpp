@@ -0,0 +1,269 @@
+#include "intset.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// contains() stops bisecting once this few values are left and compares
+// them all; a couple of SSE registers' worth
+static constexpr size_t SCAN_WINDOW = 16;
+
+static size_t widthFor(int64_t value)
+{
+    if (value >= INT16_MIN && value <= INT16_MAX)
+        return sizeof(int16_t);
+    if (value >= INT32_MIN && value <= INT32_MAX)
+        return sizeof(int32_t);
+    return sizeof(int64_t);
+}
+
+static int64_t load(const char *p, size_t width)
+{
+    if (width == sizeof(int16_t))
+    {
+        int16_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    if (width == sizeof(int32_t))
+    {
+        int32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    int64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void store(char *p, size_t width, int64_t value)
+{
+    if (width == sizeof(int16_t))
+    {
+        int16_t v = static_cast<int16_t>(value);
+        std::memcpy(p, &v, sizeof(v));
+    }
+    else if (width == sizeof(int32_t))
+    {
+        int32_t v = static_cast<int32_t>(value);
+        std::memcpy(p, &v, sizeof(v));
+    }
+    else
+    {
+        std::memcpy(p, &value, sizeof(value));
+    }
+}
+
+static char *reallocOrThrow(char *ptr, size_t size)
+{
+    char *resized = static_cast<char *>(std::realloc(ptr, size));
+    if (resized == nullptr)
+        throw std::bad_alloc();
+    return resized;
+}
+
+// ============== IntSet ==============
+
+IntSet::IntSet() : data_(reallocOrThrow(nullptr, HEADER_SIZE))
+{
+    setHeader(sizeof(int16_t), 0);
+}
+
+IntSet::IntSet(const IntSet &other) : data_(reallocOrThrow(nullptr, other.bytes()))
+{
+    std::memcpy(data_, other.data_, other.bytes());
+}
+
+IntSet::IntSet(IntSet &&other) noexcept : data_(other.data_)
+{
+    other.data_ = nullptr;
+}
+
+IntSet &IntSet::operator=(const IntSet &other)
+{
+    if (this != &other)
+    {
+        data_ = reallocOrThrow(data_, other.bytes());
+        std::memcpy(data_, other.data_, other.bytes());
+    }
+    return *this;
+}
+
+IntSet &IntSet::operator=(IntSet &&other) noexcept
+{
+    if (this != &other)
+    {
+        std::free(data_);
+        data_ = other.data_;
+        other.data_ = nullptr;
+    }
+    return *this;
+}
+
+IntSet::~IntSet()
+{
+    std::free(data_);
+}
+
+void IntSet::setHeader(uint32_t width, uint32_t count)
+{
+    std::memcpy(data_, &width, sizeof(width));
+    std::memcpy(data_ + 4, &count, sizeof(count));
+}
+
+size_t IntSet::width() const
+{
+    uint32_t width;
+    std::memcpy(&width, data_, sizeof(width));
+    return width;
+}
+
+size_t IntSet::size() const
+{
+    uint32_t count;
+    std::memcpy(&count, data_ + 4, sizeof(count));
+    return count;
+}
+
+void IntSet::resize(size_t width, size_t count)
+{
+    data_ = reallocOrThrow(data_, HEADER_SIZE + width * count);
+}
+
+int64_t IntSet::get(size_t index) const
+{
+    size_t w = width();
+    return load(data_ + HEADER_SIZE + index * w, w);
+}
+
+void IntSet::set(size_t index, int64_t value)
+{
+    size_t w = width();
+    store(data_ + HEADER_SIZE + index * w, w, value);
+}
+
+bool IntSet::search(int64_t value, size_t &index) const
+{
+    size_t lo = 0;
+    size_t hi = size();
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int64_t current = get(mid);
+        if (current < value)
+        {
+            lo = mid + 1;
+        }
+        else if (current > value)
+        {
+            hi = mid;
+        }
+        else
+        {
+            index = mid;
+            return true;
+        }
+    }
+    index = lo;
+    return false;
+}
+
+bool IntSet::add(int64_t value)
+{
+    size_t count = size();
+    size_t old_width = width();
+    size_t new_width = widthFor(value);
+
+    if (new_width > old_width)
+    {
+        // Too wide for any current member, so it goes first (if negative)
+        // or last. Widen from the back so nothing is overwritten before
+        // it is moved.
+        size_t shift = value < 0 ? 1 : 0;
+        resize(new_width, count + 1);
+        char *values = data_ + HEADER_SIZE;
+        for (size_t i = count; i-- > 0;)
+            store(values + (i + shift) * new_width, new_width, load(values + i * old_width, old_width));
+        setHeader(static_cast<uint32_t>(new_width), static_cast<uint32_t>(count + 1));
+        set(shift ? 0 : count, value);
+        return true;
+    }
+
+    size_t index;
+    if (search(value, index))
+        return false;
+
+    resize(old_width, count + 1);
+    char *at = data_ + HEADER_SIZE + index * old_width;
+    std::memmove(at + old_width, at, (count - index) * old_width);
+    setHeader(static_cast<uint32_t>(old_width), static_cast<uint32_t>(count + 1));
+    set(index, value);
+    return true;
+}
+
+bool IntSet::remove(int64_t value)
+{
+    size_t index;
+    if (widthFor(value) > width() || !search(value, index))
+        return false;
+
+    size_t count = size();
+    size_t w = width();
+    char *at = data_ + HEADER_SIZE + index * w;
+    std::memmove(at, at + w, (count - index - 1) * w);
+    resize(w, count - 1);
+    setHeader(static_cast<uint32_t>(w), static_cast<uint32_t>(count - 1));
+    return true;
+}
+
+bool IntSet::contains(int64_t value) const
+{
+    size_t w = width();
+    if (widthFor(value) > w)
+        return false;
+
+    // Narrow down to a window that still holds value if it is anywhere
+    size_t lo = 0;
+    size_t hi = size();
+    while (hi - lo > SCAN_WINDOW)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (get(mid) < value)
+            lo = mid + 1;
+        else
+            hi = mid + 1;
+    }
+
+    const char *values = data_ + HEADER_SIZE;
+#ifdef __SSE2__
+    // 64-bit lanes have no SSE2 compare; they take the scalar loop
+    if (w == sizeof(int16_t))
+    {
+        __m128i needle = _mm_set1_epi16(static_cast<int16_t>(value));
+        for (; lo + 8 <= hi; lo += 8)
+        {
+            __m128i lanes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + lo * w));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(lanes, needle)) != 0)
+                return true;
+        }
+    }
+    else if (w == sizeof(int32_t))
+    {
+        __m128i needle = _mm_set1_epi32(static_cast<int32_t>(value));
+        for (; lo + 4 <= hi; lo += 4)
+        {
+            __m128i lanes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + lo * w));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(lanes, needle)) != 0)
+                return true;
+        }
+    }
+#endif
+    for (; lo < hi; lo++)
+    {
+        if (load(values + lo * w, w) == value)
+            return true;
+    }
+    return false;
+}
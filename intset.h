@@ -0,0 +1,47 @@
+#ifndef INTSET_H
+#define INTSET_H
+
+#include <cstddef>
+#include <cstdint>
+
+// A set of integers kept as one sorted array in a heap buffer, for sets
+// whose members are all integers:
+//
+//   intset := width:u32 count:u32 value*
+//
+// Every value has the same width, 2, 4 or 8 bytes, the smallest that fits
+// all of them. Adding a value that needs more upgrades the whole array.
+// Lookups are a binary search that finishes with a SIMD scan where the
+// target has SSE2.
+class IntSet
+{
+public:
+    static constexpr size_t HEADER_SIZE = 8;
+
+    IntSet();
+    IntSet(const IntSet &other);
+    IntSet(IntSet &&other) noexcept;
+    IntSet &operator=(const IntSet &other);
+    IntSet &operator=(IntSet &&other) noexcept;
+    ~IntSet();
+
+    size_t size() const;
+    size_t width() const;           // Bytes per value
+    size_t bytes() const { return HEADER_SIZE + size() * width(); }
+
+    bool add(int64_t value);        // False if already there
+    bool remove(int64_t value);     // False if not there
+    bool contains(int64_t value) const;
+    int64_t get(size_t index) const;    // In ascending order
+
+private:
+    char *data_;
+
+    // Index of value, or of where it would be inserted
+    bool search(int64_t value, size_t &index) const;
+    void set(size_t index, int64_t value);
+    void setHeader(uint32_t width, uint32_t count);
+    void resize(size_t width, size_t count);
+};
+
+#endif
@@ -0,0 +1,268 @@
+#include "listpack.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// ============== Encoding helpers ==============
+
+static size_t varintSize(uint64_t n)
+{
+    size_t size = 1;
+    while (n >= 0x80)
+    {
+        n >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static size_t putVarint(char *p, uint64_t n)
+{
+    size_t i = 0;
+    while (n >= 0x80)
+    {
+        p[i++] = static_cast<char>((n & 0x7f) | 0x80);
+        n >>= 7;
+    }
+    p[i++] = static_cast<char>(n);
+    return i;
+}
+
+static size_t getVarint(const char *p, uint64_t &n)
+{
+    n = 0;
+    size_t i = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        uint8_t byte = static_cast<uint8_t>(p[i++]);
+        n |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return i;
+    }
+}
+
+// The backlen is a varint with its bytes in reverse order, so the last byte
+// of an entry holds the lowest seven bits and the continuation flag
+static void putBacklen(char *p, uint64_t n)
+{
+    size_t size = varintSize(n);
+    for (size_t i = size; i-- > 0;)
+    {
+        uint8_t byte = n & 0x7f;
+        n >>= 7;
+        p[i] = static_cast<char>(i == 0 ? byte : byte | 0x80);
+    }
+}
+
+// Reads the backlen ending just before `end`; sets size to its own length
+static uint64_t getBacklen(const char *end, size_t &size)
+{
+    uint64_t n = 0;
+    size = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        uint8_t byte = static_cast<uint8_t>(*--end);
+        size++;
+        n |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return n;
+    }
+}
+
+static size_t encodedSize(std::string_view s)
+{
+    size_t body = varintSize(s.size()) + s.size();
+    return body + varintSize(body);
+}
+
+static void encode(char *p, std::string_view s)
+{
+    size_t header = putVarint(p, s.size());
+    std::memcpy(p + header, s.data(), s.size());
+    putBacklen(p + header + s.size(), header + s.size());
+}
+
+static char *reallocOrThrow(char *ptr, size_t size)
+{
+    char *resized = static_cast<char *>(std::realloc(ptr, size));
+    if (resized == nullptr)
+        throw std::bad_alloc();
+    return resized;
+}
+
+static uint32_t getU32(const char *p)
+{
+    uint32_t n;
+    std::memcpy(&n, p, sizeof(n));
+    return n;
+}
+
+// ============== Listpack ==============
+
+Listpack::Listpack() : data_(reallocOrThrow(nullptr, HEADER_SIZE))
+{
+    setHeader(HEADER_SIZE, 0);
+}
+
+Listpack::Listpack(const Listpack &other) : data_(reallocOrThrow(nullptr, other.bytes()))
+{
+    std::memcpy(data_, other.data_, other.bytes());
+}
+
+Listpack::Listpack(Listpack &&other) noexcept : data_(other.data_)
+{
+    other.data_ = nullptr;
+}
+
+Listpack &Listpack::operator=(const Listpack &other)
+{
+    if (this != &other)
+    {
+        data_ = reallocOrThrow(data_, other.bytes());
+        std::memcpy(data_, other.data_, other.bytes());
+    }
+    return *this;
+}
+
+Listpack &Listpack::operator=(Listpack &&other) noexcept
+{
+    if (this != &other)
+    {
+        std::free(data_);
+        data_ = other.data_;
+        other.data_ = nullptr;
+    }
+    return *this;
+}
+
+Listpack::~Listpack()
+{
+    std::free(data_);
+}
+
+void Listpack::setHeader(uint32_t total, uint32_t count)
+{
+    std::memcpy(data_, &total, sizeof(total));
+    std::memcpy(data_ + 4, &count, sizeof(count));
+}
+
+size_t Listpack::bytes() const
+{
+    return getU32(data_);
+}
+
+size_t Listpack::size() const
+{
+    return getU32(data_ + 4);
+}
+
+size_t Listpack::entryBytes(std::string_view s)
+{
+    return encodedSize(s);
+}
+
+size_t Listpack::entrySize(size_t pos) const
+{
+    uint64_t length;
+    size_t header = getVarint(data_ + pos, length);
+    size_t body = header + length;
+    return body + varintSize(body);
+}
+
+size_t Listpack::next(size_t pos) const
+{
+    return pos + entrySize(pos);
+}
+
+size_t Listpack::prev(size_t pos) const
+{
+    size_t backlen_size;
+    uint64_t body = getBacklen(data_ + pos, backlen_size);
+    return pos - backlen_size - body;
+}
+
+size_t Listpack::seek(long long index) const
+{
+    long long count = static_cast<long long>(size());
+    if (index < 0)
+        index += count;
+    if (index < 0 || index >= count)
+        return end();
+
+    // Walk from whichever end is closer
+    size_t pos;
+    if (index <= count / 2)
+    {
+        pos = begin();
+        for (long long i = 0; i < index; i++)
+            pos = next(pos);
+    }
+    else
+    {
+        pos = end();
+        for (long long i = count; i > index; i--)
+            pos = prev(pos);
+    }
+    return pos;
+}
+
+std::string_view Listpack::get(size_t pos) const
+{
+    uint64_t length;
+    size_t header = getVarint(data_ + pos, length);
+    return std::string_view(data_ + pos + header, length);
+}
+
+size_t Listpack::find(std::string_view s, size_t pos, size_t step) const
+{
+    size_t stop = end();
+    while (pos < stop)
+    {
+        uint64_t length;
+        size_t header = getVarint(data_ + pos, length);
+        if (length == s.size() && std::memcmp(data_ + pos + header, s.data(), length) == 0)
+            return pos;
+        for (size_t i = 0; i < step && pos < stop; i++)
+            pos = next(pos);
+    }
+    return stop;
+}
+
+void Listpack::insert(size_t pos, std::string_view s)
+{
+    size_t total = bytes();
+    size_t size = encodedSize(s);
+    data_ = reallocOrThrow(data_, total + size);
+    std::memmove(data_ + pos + size, data_ + pos, total - pos);
+    encode(data_ + pos, s);
+    setHeader(static_cast<uint32_t>(total + size), static_cast<uint32_t>(this->size() + 1));
+}
+
+void Listpack::replace(size_t pos, std::string_view s)
+{
+    size_t total = bytes();
+    size_t old_size = entrySize(pos);
+    size_t new_size = encodedSize(s);
+
+    if (new_size > old_size)
+        data_ = reallocOrThrow(data_, total - old_size + new_size);
+    std::memmove(data_ + pos + new_size, data_ + pos + old_size, total - pos - old_size);
+    if (new_size < old_size)
+        data_ = reallocOrThrow(data_, total - old_size + new_size);
+
+    encode(data_ + pos, s);
+    setHeader(static_cast<uint32_t>(total - old_size + new_size), static_cast<uint32_t>(size()));
+}
+
+void Listpack::erase(size_t pos, size_t count)
+{
+    size_t total = bytes();
+    size_t stop = pos;
+    for (size_t i = 0; i < count; i++)
+        stop = next(stop);
+
+    std::memmove(data_ + pos, data_ + stop, total - stop);
+    total -= stop - pos;
+    data_ = reallocOrThrow(data_, total);
+    setHeader(static_cast<uint32_t>(total), static_cast<uint32_t>(size() - count));
+}
@@ -0,0 +1,72 @@
+#ifndef LISTPACK_H
+#define LISTPACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// A sequence of strings packed into a single heap buffer. Small lists, sets
+// and hashes (fields and values alternating) are kept in one instead of a
+// node-based container, trading O(n) search for a fraction of the memory.
+//
+//   listpack := total_bytes:u32 count:u32 entry*
+//   entry    := length:varint data backlen
+//
+// backlen is the size of length + data, stored so that it can be read from
+// the end of the entry backwards: the list can be walked in both directions.
+//
+// Entries are addressed by their byte offset in the buffer. Any edit may
+// move the buffer, so offsets past the edit point and string_views returned
+// by get() are invalid after one.
+class Listpack
+{
+public:
+    static constexpr size_t HEADER_SIZE = 8;
+
+    Listpack();
+    // Takes ownership of a malloc'd buffer already holding a listpack, such
+    // as one decompressed from bytes() bytes of data()
+    explicit Listpack(char *buffer) : data_(buffer) {}
+    Listpack(const Listpack &other);
+    Listpack(Listpack &&other) noexcept;
+    Listpack &operator=(const Listpack &other);
+    Listpack &operator=(Listpack &&other) noexcept;
+    ~Listpack();
+
+    size_t size() const;            // Entries
+    size_t bytes() const;           // Whole buffer, header included
+    bool empty() const { return size() == 0; }
+    const char *data() const { return data_; }
+    // Bytes that inserting s would add
+    static size_t entryBytes(std::string_view s);
+
+    // ============== Navigation ==============
+    size_t begin() const { return HEADER_SIZE; }
+    size_t end() const { return bytes(); }
+    size_t next(size_t pos) const;
+    size_t prev(size_t pos) const;          // pos may be end()
+    // Offset of the index-th entry, negative counting from the end; end()
+    // if out of range
+    size_t seek(long long index) const;
+    std::string_view get(size_t pos) const;
+
+    // First entry equal to s among pos, pos + step entries, pos + 2 * step
+    // entries, ...; end() if none. Hashes search their fields with step 2.
+    size_t find(std::string_view s, size_t pos, size_t step = 1) const;
+
+    // ============== Editing ==============
+    void insert(size_t pos, std::string_view s);    // Before pos; end() appends
+    void pushFront(std::string_view s) { insert(begin(), s); }
+    void pushBack(std::string_view s) { insert(end(), s); }
+    void replace(size_t pos, std::string_view s);
+    // Removes count entries from pos on; what followed them is now at pos
+    void erase(size_t pos, size_t count = 1);
+
+private:
+    char *data_;
+
+    void setHeader(uint32_t total, uint32_t count);
+    size_t entrySize(size_t pos) const;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "log.h"
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic<int> Logger::current_level_{static_cast<int>(LogLevel::INFO)};
+
+namespace
+{
+struct LogLine
+{
+    LogLevel level;
+    std::string text;
+};
+
+// Shared by all threads. Intentionally never destroyed: detached client
+// threads may still log while static destructors run at exit.
+struct LogState
+{
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::vector<LogLine> queue;
+    unsigned long long queued = 0;
+    unsigned long long written = 0;
+    std::thread writer;
+};
+
+void writerLoop(LogState *state)
+{
+    std::vector<LogLine> batch;
+
+    while (true)
+    {
+        unsigned long long upto;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->wake.wait(lock, [state]() { return !state->queue.empty(); });
+            batch.swap(state->queue);
+            upto = state->queued;
+        }
+
+        bool wrote_err = false;
+        for (const LogLine &line : batch)
+        {
+            FILE *out = line.level <= LogLevel::WARNING ? stderr : stdout;
+            wrote_err |= out == stderr;
+            std::fwrite(line.text.data(), 1, line.text.size(), out);
+            std::fputc('\n', out);
+        }
+        std::fflush(stdout);
+        if (wrote_err)
+            std::fflush(stderr);
+        batch.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->written = upto;
+        }
+        state->drained.notify_all();
+    }
+}
+
+LogState &state()
+{
+    static LogState *instance = []() {
+        LogState *s = new LogState();
+        s->writer = std::thread(writerLoop, s);
+        s->writer.detach();
+        std::atexit(Logger::flush);
+        return s;
+    }();
+    return *instance;
+}
+} // namespace
+
+void Logger::setLevel(LogLevel level)
+{
+    current_level_.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+LogLevel Logger::level()
+{
+    return static_cast<LogLevel>(current_level_.load(std::memory_order_relaxed));
+}
+
+bool Logger::parseLevel(const std::string &name, LogLevel &out)
+{
+    if (name == "error")
+        out = LogLevel::ERROR;
+    else if (name == "warning")
+        out = LogLevel::WARNING;
+    else if (name == "info")
+        out = LogLevel::INFO;
+    else if (name == "debug")
+        out = LogLevel::DEBUG;
+    else if (name == "trace")
+        out = LogLevel::TRACE;
+    else
+        return false;
+    return true;
+}
+
+void Logger::write(LogLevel level, std::string message)
+{
+    LogState &s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.queue.push_back(LogLine{level, std::move(message)});
+        s.queued++;
+    }
+    s.wake.notify_one();
+}
+
+void Logger::flush()
+{
+    LogState &s = state();
+    std::unique_lock<std::mutex> lock(s.mutex);
+    unsigned long long target = s.queued;
+    s.drained.wait(lock, [&s, target]() { return s.written >= target; });
+}
@@ -0,0 +1,66 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <sstream>
+#include <string>
+
+enum class LogLevel
+{
+    ERROR = 0,
+    WARNING,
+    INFO,
+    DEBUG,
+    TRACE
+};
+
+// Leveled, asynchronous logger. Callers only format the message and append it
+// to an in-memory queue; a background thread writes queued lines to stdout
+// (stderr for warnings and errors) in batches, so request threads never block
+// on the stdout lock.
+class Logger
+{
+public:
+    static void setLevel(LogLevel level);
+    static LogLevel level();
+    static bool enabled(LogLevel level) { return static_cast<int>(level) <= current_level_.load(std::memory_order_relaxed); }
+
+    // Accepts "error", "warning", "info", "debug" or "trace"
+    static bool parseLevel(const std::string &name, LogLevel &out);
+
+    static void write(LogLevel level, std::string message);
+
+    // Blocks until everything queued so far has been written
+    static void flush();
+
+private:
+    static std::atomic<int> current_level_;
+};
+
+#define LOG_AT(level, expr)                          \
+    do                                               \
+    {                                                \
+        if (Logger::enabled(level))                  \
+        {                                            \
+            std::ostringstream log_stream_;          \
+            log_stream_ << expr;                     \
+            Logger::write(level, log_stream_.str()); \
+        }                                            \
+    } while (0)
+
+#define LOG_ERROR(expr) LOG_AT(LogLevel::ERROR, expr)
+#define LOG_WARNING(expr) LOG_AT(LogLevel::WARNING, expr)
+#define LOG_INFO(expr) LOG_AT(LogLevel::INFO, expr)
+#define LOG_DEBUG(expr) LOG_AT(LogLevel::DEBUG, expr)
+
+// Per-command tracing is compiled out unless built with -DTINYREDIS_TRACE
+#ifdef TINYREDIS_TRACE
+#define LOG_TRACE(expr) LOG_AT(LogLevel::TRACE, expr)
+#else
+#define LOG_TRACE(expr) \
+    do                  \
+    {                   \
+    } while (0)
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+#include "lzf.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// The stream is a sequence of control bytes, each followed by its payload:
+//
+//   000LLLLL             L + 1 literal bytes follow (1..32)
+//   LLLOOOOO [X] P       copy L + 2 bytes (L + X + 2 if L == 7) from
+//                        OOOOOP + 1 bytes back in the output
+//
+// The compressor finds matches with a table of the last position of every
+// 3-byte sequence's hash; it does not search further back.
+static constexpr size_t HASH_BITS = 13;
+static constexpr size_t MAX_LITERALS = 32;
+static constexpr size_t MAX_OFFSET = 1 << 13;
+static constexpr size_t MAX_MATCH = 7 + 255 + 2;
+
+static uint32_t hash3(const unsigned char *p)
+{
+    uint32_t v = (static_cast<uint32_t>(p[0]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[2];
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+size_t LZF::compress(const char *input, size_t length, char *output, size_t out_capacity)
+{
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(input);
+    unsigned char *out = reinterpret_cast<unsigned char *>(output);
+
+    // Position + 1 of the last occurrence of each hash, 0 if none
+    uint32_t table[1 << HASH_BITS] = {};
+    size_t ip = 0;
+    size_t op = 0;
+    size_t literals = 0;    // Length of the open literal run
+    size_t ctrl = 0;        // Where its control byte is
+
+    while (ip < length)
+    {
+        size_t ref = 0;
+        bool match = false;
+        if (ip + 2 < length)
+        {
+            uint32_t h = hash3(in + ip);
+            if (table[h] != 0)
+            {
+                ref = table[h] - 1;
+                match = ip - ref <= MAX_OFFSET && std::memcmp(in + ref, in + ip, 3) == 0;
+            }
+            table[h] = static_cast<uint32_t>(ip + 1);
+        }
+
+        if (match)
+        {
+            size_t max = std::min(MAX_MATCH, length - ip);
+            size_t len = 3;
+            while (len < max && in[ref + len] == in[ip + len])
+                len++;
+
+            size_t offset = ip - ref - 1;
+            size_t code = len - 2;
+            if (op + 3 > out_capacity)
+                return 0;
+            if (code < 7)
+            {
+                out[op++] = static_cast<unsigned char>((code << 5) | (offset >> 8));
+            }
+            else
+            {
+                out[op++] = static_cast<unsigned char>((7 << 5) | (offset >> 8));
+                out[op++] = static_cast<unsigned char>(code - 7);
+            }
+            out[op++] = static_cast<unsigned char>(offset & 0xff);
+            ip += len;
+            literals = 0;
+            continue;
+        }
+
+        if (op + (literals == 0 ? 2 : 1) > out_capacity)
+            return 0;
+        if (literals == 0)
+            ctrl = op++;
+        out[op++] = in[ip++];
+        out[ctrl] = static_cast<unsigned char>(literals);
+        if (++literals == MAX_LITERALS)
+            literals = 0;
+    }
+    return op;
+}
+
+size_t LZF::decompress(const char *input, size_t length, char *output, size_t out_capacity)
+{
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(input);
+    unsigned char *out = reinterpret_cast<unsigned char *>(output);
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < length)
+    {
+        size_t ctrl = in[ip++];
+        if (ctrl < MAX_LITERALS)
+        {
+            size_t run = ctrl + 1;
+            if (ip + run > length || op + run > out_capacity)
+                return 0;
+            std::memcpy(out + op, in + ip, run);
+            ip += run;
+            op += run;
+            continue;
+        }
+
+        size_t len = ctrl >> 5;
+        if (len == 7)
+        {
+            if (ip >= length)
+                return 0;
+            len += in[ip++];
+        }
+        if (ip >= length)
+            return 0;
+        size_t offset = ((ctrl & 0x1f) << 8) + in[ip++] + 1;
+        len += 2;
+        if (offset > op || op + len > out_capacity)
+            return 0;
+        // The source may overlap what is being written, so byte by byte
+        for (size_t i = 0; i < len; i++, op++)
+            out[op] = out[op - offset];
+    }
+    return op;
+}
@@ -0,0 +1,21 @@
+#ifndef LZF_H
+#define LZF_H
+
+#include <cstddef>
+
+// LZF compression (the format of liblzf, as used by Redis): fast, byte
+// oriented, no entropy coding. Meant for data that is compressed rarely and
+// read often, such as the interior nodes of a long list.
+class LZF
+{
+public:
+    // Compresses in into out; returns the compressed size, or 0 if it would
+    // not fit in out_capacity bytes (so incompressible data costs nothing)
+    static size_t compress(const char *in, size_t length, char *out, size_t out_capacity);
+
+    // Decompresses in into out; returns the decompressed size, or 0 if the
+    // data is corrupt or larger than out_capacity
+    static size_t decompress(const char *in, size_t length, char *out, size_t out_capacity);
+};
+
+#endif
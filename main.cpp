@@ -14,6 +14,59 @@ static std::vector<std::string> split(const std::string &line)
 
     return tokens;
 }
+// Prints a non-OK Db status the way redis-cli shows the matching reply
+static void printStatus(DbStatus status)
+{
+    switch (status)
+    {
+    case DbStatus::NOT_FOUND:
+        std::cout << "(nil)" << std::endl;
+        break;
+    case DbStatus::WRONG_TYPE:
+        std::cout << "(error) WRONGTYPE Operation against a key holding the wrong kind of value" << std::endl;
+        break;
+    case DbStatus::NOT_INTEGER:
+        std::cout << "(error) ERR value is not an integer or out of range" << std::endl;
+        break;
+    case DbStatus::OVERFLOW:
+        std::cout << "(error) ERR increment or decrement would overflow" << std::endl;
+        break;
+    case DbStatus::NO_SUCH_KEY:
+        std::cout << "(error) ERR no such key" << std::endl;
+        break;
+    case DbStatus::OUT_OF_RANGE:
+        std::cout << "(error) ERR index out of range" << std::endl;
+        break;
+    case DbStatus::TOO_LARGE:
+        std::cout << "(error) ERR string exceeds maximum allowed size (512MB)" << std::endl;
+        break;
+    default:
+        std::cout << "OK" << std::endl;
+        break;
+    }
+}
+
+static void printInteger(long long value)
+{
+    std::cout << "(integer) " << value << std::endl;
+}
+
+static void printInteger(const DbResult<long long> &result)
+{
+    if (result.ok())
+        printInteger(result.value);
+    else
+        printStatus(result.status);
+}
+
+static void printBulk(const DbResult<std::string> &result)
+{
+    if (result.ok())
+        std::cout << "\"" << result.value << "\"" << std::endl;
+    else
+        printStatus(result.status);
+}
+
 int main()
 {
     Db redis;
@@ -46,6 +99,7 @@ int main()
                 value += tokens[i];
             }
             redis.set(tokens[1], value);
+            std::cout << "OK" << std::endl;
         }
         else if (cmd == "GET" || cmd == "get")
         {
@@ -54,7 +108,7 @@ int main()
                 std::cout << "(error) wrong number of arguments" << std::endl;
                 continue;
             }
-            redis.get(tokens[1]);
+            printBulk(redis.get(tokens[1]));
         }
         else if (cmd == "DEL" || cmd == "del")
         {
@@ -63,7 +117,7 @@ int main()
                 std::cout << "(error) wrong number of arguments" << std::endl;
                 continue;
             }
-            redis.del(tokens[1]);
+            printInteger(redis.del(tokens[1]) ? 1 : 0);
         }
         else if (cmd == "EXISTS" || cmd == "exists")
         {
@@ -72,7 +126,7 @@ int main()
                 std::cout << "(error) wrong number of arguments" << std::endl;
                 continue;
             }
-            redis.exists(tokens[1]);
+            printInteger(redis.exists(tokens[1]) ? 1 : 0);
         }
         else if (cmd == "INCR" || cmd == "incr")
         {
@@ -81,7 +135,7 @@ int main()
                 std::cout << "(error) wrong number of arguments" << std::endl;
                 continue;
             }
-            redis.incr(tokens[1]);
+            printInteger(redis.incr(tokens[1]));
         }
         else if (cmd == "INCRBY" || cmd == "incrby")
         {
@@ -91,7 +145,7 @@ int main()
                 continue;
             }
             long long amt = std::stoll(tokens[2]);
-            redis.incrby(tokens[1], amt);
+            printInteger(redis.incrby(tokens[1], amt));
         }
         else if (cmd == "DECR" || cmd == "decr")
         {
@@ -100,7 +154,7 @@ int main()
                 std::cout << "(error) wrong number of arguments" << std::endl;
                 continue;
             }
-            redis.decr(tokens[1]);
+            printInteger(redis.decr(tokens[1]));
         }
         else if (cmd == "DECRBY" || cmd == "decrby")
         {
@@ -110,7 +164,7 @@ int main()
                 continue;
             }
             long long amt = std::stoll(tokens[2]);
-            redis.decrby(tokens[1], amt);
+            printInteger(redis.decrby(tokens[1], amt));
         }
         else if (cmd == "TYPE" || cmd == "type")
         {
@@ -119,7 +173,7 @@ int main()
                 std::cout << "(error) wrong number of arguments" << std::endl;
                 continue;
             }
-            redis.type(tokens[1]);
+            std::cout << redis.type(tokens[1]) << std::endl;
         }
         else if (cmd == "EXPIRE" || cmd == "expire")
         {
@@ -129,7 +183,27 @@ int main()
                 continue;
             }
             long long seconds = std::stoll(tokens[2]);
-            redis.expire(tokens[1], seconds);
+            printInteger(redis.expire(tokens[1], seconds) ? 1 : 0);
+        }
+        else if (cmd == "PEXPIRE" || cmd == "pexpire")
+        {
+            if (tokens.size() < 3)
+            {
+                std::cout << "(error) wrong number of arguments" << std::endl;
+                continue;
+            }
+            long long milliseconds = std::stoll(tokens[2]);
+            printInteger(redis.pexpire(tokens[1], milliseconds) ? 1 : 0);
+        }
+        else if (cmd == "PEXPIREAT" || cmd == "pexpireat")
+        {
+            if (tokens.size() < 3)
+            {
+                std::cout << "(error) wrong number of arguments" << std::endl;
+                continue;
+            }
+            long long unix_ms = std::stoll(tokens[2]);
+            printInteger(redis.pexpireat(tokens[1], unix_ms) ? 1 : 0);
         }
         else if (cmd == "TTL" || cmd == "ttl")
         {
@@ -138,7 +212,16 @@ int main()
                 std::cout << "(error) wrong number of arguments" << std::endl;
                 continue;
             }
-            redis.ttl(tokens[1]);
+            printInteger(redis.ttl(tokens[1]));
+        }
+        else if (cmd == "PTTL" || cmd == "pttl")
+        {
+            if (tokens.size() < 2)
+            {
+                std::cout << "(error) wrong number of arguments" << std::endl;
+                continue;
+            }
+            printInteger(redis.pttl(tokens[1]));
         }
         else if (cmd == "PERSIST" || cmd == "persist")
         {
@@ -147,7 +230,7 @@ int main()
                 std::cout << "(error) wrong number of arguments" << std::endl;
                 continue;
             }
-            redis.persist(tokens[1]);
+            printInteger(redis.persist(tokens[1]) ? 1 : 0);
         }
         else if (cmd == "APPEND" || cmd == "append")
 {
@@ -161,7 +244,7 @@ int main()
         if (i > 2) value += " ";
         value += tokens[i];
     }
-    redis.append(tokens[1], value);
+    printInteger(redis.append(tokens[1], value));
 }
 else if (cmd == "STRLEN" || cmd == "strlen")
 {
@@ -169,7 +252,7 @@ else if (cmd == "STRLEN" || cmd == "strlen")
         std::cout << "(error) wrong number of arguments" << std::endl;
         continue;
     }
-    redis.strlen(tokens[1]);
+    printInteger(redis.strlen(tokens[1]));
 }
 else if (cmd == "MGET" || cmd == "mget")
 {
@@ -177,8 +260,16 @@ else if (cmd == "MGET" || cmd == "mget")
         std::cout << "(error) wrong number of arguments" << std::endl;
         continue;
     }
-    std::vector<std::string> keys(tokens.begin() + 1, tokens.end());
-    redis.mget(keys);
+    std::vector<std::string_view> keys(tokens.begin() + 1, tokens.end());
+    auto values = redis.mget(keys);
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        std::cout << (i + 1) << ") ";
+        if (values[i])
+            std::cout << "\"" << *values[i] << "\"" << std::endl;
+        else
+            std::cout << "(nil)" << std::endl;
+    }
 }
 else if (cmd == "MSET" || cmd == "mset")
 {
@@ -186,8 +277,9 @@ else if (cmd == "MSET" || cmd == "mset")
         std::cout << "(error) wrong number of arguments" << std::endl;
         continue;
     }
-    std::vector<std::string> keyvals(tokens.begin() + 1, tokens.end());
+    std::vector<std::string_view> keyvals(tokens.begin() + 1, tokens.end());
     redis.mset(keyvals);
+    std::cout << "OK" << std::endl;
 }
 else if (cmd == "GETRANGE" || cmd == "getrange")
 {
@@ -197,7 +289,7 @@ else if (cmd == "GETRANGE" || cmd == "getrange")
     }
     long long start = std::stoll(tokens[2]);
     long long end = std::stoll(tokens[3]);
-    redis.getrange(tokens[1], start, end);
+    printBulk(redis.getrange(tokens[1], start, end));
 }
 else if (cmd == "SETRANGE" || cmd == "setrange")
 {
@@ -212,12 +304,18 @@ else if (cmd == "SETRANGE" || cmd == "setrange")
         if (i > 3) value += " ";
         value += tokens[i];
     }
-    redis.setrange(tokens[1], offset, value);
+    printInteger(redis.setrange(tokens[1], offset, value));
 }
 else if (cmd == "SAVE" || cmd == "save")
 {
-    redis.saveRDB();
-    redis.startNewAOF();
+    if (redis.save() == DbStatus::OK)
+    {
+        std::cout << "OK" << std::endl;
+    }
+    else
+    {
+        std::cout << "(error) ERR failed to save snapshot" << std::endl;
+    }
 }
 
         else if (cmd == "QUIT" || cmd == "quit" || cmd == "EXIT" || cmd == "exit")
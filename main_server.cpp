@@ -1,7 +1,12 @@
 #include "db.h"
 #include "server.h"
+#include "log.h"
 #include <iostream>
 #include <signal.h>
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <thread>
 
 Server *global_server = nullptr;
 
@@ -21,27 +26,116 @@ void signalHandler(int signum)
 int main(int argc, char *argv[])
 {
     int port = 6379;
+    ServerMode mode = ServerMode::THREADED;
+    int io_threads = 4;
     
-    // Allow custom port via command line
-    if (argc > 1)
+    AofFsync aof_fsync = AofFsync::EVERYSEC;
+    int aof_rewrite_percentage = 100;
+    long long aof_rewrite_min_size = 64 * 1024 * 1024;
+    bool lazy_load = false;
+    PackLimits pack_limits;
+
+    // Usage: redis_server [port] [--epoll [io_threads] | --sharded [cores]]
+    //                    [--loglevel error|warning|info|debug|trace]
+    //                    [--appendfsync always|everysec|no]
+    //                    [--auto-aof-rewrite-percentage n] [--auto-aof-rewrite-min-size bytes]
+    //                    [--lazy-load] [--listpack-max-entries n] [--listpack-max-value bytes]
+    //                    [--intset-max-entries n] [--list-max-listpack-size bytes]
+    //                    [--list-compress-depth n]
+    for (int i = 1; i < argc; i++)
     {
-        port = std::stoi(argv[1]);
+        std::string arg = argv[i];
+        if (arg == "--loglevel" && i + 1 < argc)
+        {
+            LogLevel level;
+            if (!Logger::parseLevel(argv[++i], level))
+            {
+                std::cerr << "Unknown log level: " << argv[i] << std::endl;
+                return 1;
+            }
+            Logger::setLevel(level);
+        }
+        else if (arg == "--appendfsync" && i + 1 < argc)
+        {
+            if (!AofWriter::parsePolicy(argv[++i], aof_fsync))
+            {
+                std::cerr << "Unknown appendfsync policy: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--auto-aof-rewrite-percentage" && i + 1 < argc)
+        {
+            aof_rewrite_percentage = std::stoi(argv[++i]);
+        }
+        else if (arg == "--auto-aof-rewrite-min-size" && i + 1 < argc)
+        {
+            aof_rewrite_min_size = std::stoll(argv[++i]);
+        }
+        else if (arg == "--lazy-load")
+        {
+            lazy_load = true;
+        }
+        else if (arg == "--listpack-max-entries" && i + 1 < argc)
+        {
+            pack_limits.max_entries = std::stoul(argv[++i]);
+        }
+        else if (arg == "--listpack-max-value" && i + 1 < argc)
+        {
+            pack_limits.max_value = std::stoul(argv[++i]);
+        }
+        else if (arg == "--intset-max-entries" && i + 1 < argc)
+        {
+            pack_limits.max_intset_entries = std::stoul(argv[++i]);
+        }
+        else if (arg == "--list-max-listpack-size" && i + 1 < argc)
+        {
+            pack_limits.list_node_bytes = std::stoul(argv[++i]);
+        }
+        else if (arg == "--list-compress-depth" && i + 1 < argc)
+        {
+            pack_limits.list_compress_depth = std::stoul(argv[++i]);
+        }
+        else if (arg == "--epoll")
+        {
+            mode = ServerMode::EPOLL;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+            {
+                io_threads = std::stoi(argv[++i]);
+            }
+        }
+        else if (arg == "--sharded")
+        {
+            mode = ServerMode::SHARDED;
+            io_threads = std::max(1u, std::thread::hardware_concurrency());
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+            {
+                io_threads = std::stoi(argv[++i]);
+            }
+        }
+        else
+        {
+            port = std::stoi(arg);
+        }
     }
 
-    std::cout << "# Starting TinyRedis Server..." << std::endl;
+    LOG_INFO("# Starting TinyRedis Server...");
 
     // Setup signal handler for Ctrl+C
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
 
-    // Create database
-    Db db;
+    Value::setPackLimits(pack_limits);
+
+    // Create database. In sharded mode every core owns exactly one partition.
+    size_t shard_count = mode == ServerMode::SHARDED ? std::max(io_threads, 1) : 16;
+    Db db("dump.rdb", "dump.aof", 60, shard_count, aof_fsync, aof_rewrite_percentage, aof_rewrite_min_size,
+          lazy_load);
 
     // Create and start server
-    Server server(db, port);
+    Server server(db, port, mode, io_threads);
     global_server = &server;
 
-    std::cout << "# Press Ctrl+C to stop the server" << std::endl;
+    LOG_INFO("# Press Ctrl+C to stop the server");
     server.start();
 
     return 0;
@@ -0,0 +1,253 @@
+#include "quicklist.h"
+#include "lzf.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+// Nodes smaller than this are not worth compressing, nor is compression
+// that saves less than MIN_COMPRESS_GAIN bytes
+static constexpr size_t MIN_COMPRESS_BYTES = 48;
+static constexpr size_t MIN_COMPRESS_GAIN = 8;
+
+static char *mallocOrThrow(size_t size)
+{
+    char *ptr = static_cast<char *>(std::malloc(size));
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+Quicklist::Node::~Node()
+{
+    std::free(compressed);
+}
+
+// ============== Quicklist ==============
+
+Quicklist::Quicklist(size_t node_bytes, size_t compress_depth)
+    : node_bytes_(node_bytes), compress_depth_(compress_depth)
+{
+}
+
+Quicklist::Quicklist(const Quicklist &other)
+    : count_(other.count_), node_bytes_(other.node_bytes_), compress_depth_(other.compress_depth_)
+{
+    for (const Node *source = other.head_; source != nullptr; source = source->next)
+    {
+        Node *node = new Node();
+        node->prev = tail_;
+        (tail_ != nullptr ? tail_->next : head_) = node;
+        tail_ = node;
+        nodes_++;
+
+        node->count = source->count;
+        node->compress_failed = source->compress_failed;
+        if (source->compressed == nullptr)
+        {
+            node->lp = source->lp;
+            continue;
+        }
+        Listpack released(std::move(node->lp));
+        node->compressed = mallocOrThrow(source->compressed_bytes);
+        std::memcpy(node->compressed, source->compressed, source->compressed_bytes);
+        node->compressed_bytes = source->compressed_bytes;
+        node->raw_bytes = source->raw_bytes;
+    }
+}
+
+Quicklist::~Quicklist()
+{
+    while (head_ != nullptr)
+    {
+        Node *next = head_->next;
+        delete head_;
+        head_ = next;
+    }
+}
+
+void Quicklist::push(std::string_view item, bool front)
+{
+    // The end nodes are never compressed
+    Node *node = front ? head_ : tail_;
+    bool added = false;
+    if (node == nullptr || node->lp.bytes() + Listpack::entryBytes(item) > node_bytes_)
+    {
+        node = new Node();
+        if (front)
+        {
+            node->next = head_;
+            (head_ != nullptr ? head_->prev : tail_) = node;
+            head_ = node;
+        }
+        else
+        {
+            node->prev = tail_;
+            (tail_ != nullptr ? tail_->next : head_) = node;
+            tail_ = node;
+        }
+        nodes_++;
+        added = true;
+    }
+
+    if (front)
+        node->lp.pushFront(item);
+    else
+        node->lp.pushBack(item);
+    node->count++;
+    node->compress_failed = false;
+    count_++;
+
+    if (added)
+        compressEnds();
+}
+
+std::string Quicklist::pop(bool front)
+{
+    Node *node = front ? head_ : tail_;
+    Listpack &lp = node->lp;
+    size_t pos = front ? lp.begin() : lp.prev(lp.end());
+    std::string item(lp.get(pos));
+    lp.erase(pos);
+    node->count--;
+    node->compress_failed = false;
+    count_--;
+
+    if (node->count == 0)
+    {
+        unlink(node);
+        delete node;
+        compressEnds();
+    }
+    return item;
+}
+
+std::string Quicklist::index(size_t index) const
+{
+    size_t offset;
+    const Node *node = locate(index, offset);
+    Listpack scratch;
+    const Listpack &lp = view(node, scratch);
+    return std::string(lp.get(lp.seek(static_cast<long long>(offset))));
+}
+
+void Quicklist::set(size_t index, std::string_view item)
+{
+    size_t offset;
+    Node *node = locate(index, offset);
+    bool was_compressed = node->compressed != nullptr;
+    decompress(node);
+    node->lp.replace(node->lp.seek(static_cast<long long>(offset)), item);
+    node->compress_failed = false;
+    if (was_compressed)
+        compress(node);
+}
+
+Quicklist::Node *Quicklist::locate(size_t index, size_t &offset) const
+{
+    if (index < count_ / 2)
+    {
+        Node *node = head_;
+        while (index >= node->count)
+        {
+            index -= node->count;
+            node = node->next;
+        }
+        offset = index;
+        return node;
+    }
+
+    // Count the items after index, from the tail
+    size_t after = count_ - 1 - index;
+    Node *node = tail_;
+    while (after >= node->count)
+    {
+        after -= node->count;
+        node = node->prev;
+    }
+    offset = node->count - 1 - after;
+    return node;
+}
+
+// ============== Compression ==============
+
+static char *inflate(const char *compressed, size_t compressed_bytes, size_t raw_bytes)
+{
+    char *buffer = mallocOrThrow(raw_bytes);
+    if (LZF::decompress(compressed, compressed_bytes, buffer, raw_bytes) != raw_bytes)
+    {
+        std::free(buffer);
+        throw std::runtime_error("corrupt compressed list node");
+    }
+    return buffer;
+}
+
+const Listpack &Quicklist::view(const Node *node, Listpack &scratch) const
+{
+    if (node->compressed == nullptr)
+        return node->lp;
+    scratch = Listpack(inflate(node->compressed, node->compressed_bytes, node->raw_bytes));
+    return scratch;
+}
+
+void Quicklist::compress(Node *node)
+{
+    if (node->compressed != nullptr || node->compress_failed)
+        return;
+    size_t raw_bytes = node->lp.bytes();
+    if (raw_bytes < MIN_COMPRESS_BYTES)
+        return;
+
+    char *buffer = mallocOrThrow(raw_bytes);
+    size_t size = LZF::compress(node->lp.data(), raw_bytes, buffer, raw_bytes - MIN_COMPRESS_GAIN);
+    if (size == 0)
+    {
+        std::free(buffer);
+        node->compress_failed = true;
+        return;
+    }
+
+    char *shrunk = static_cast<char *>(std::realloc(buffer, size));
+    node->compressed = shrunk != nullptr ? shrunk : buffer;
+    node->compressed_bytes = static_cast<uint32_t>(size);
+    node->raw_bytes = static_cast<uint32_t>(raw_bytes);
+    Listpack released(std::move(node->lp));
+}
+
+void Quicklist::decompress(Node *node)
+{
+    if (node->compressed == nullptr)
+        return;
+    node->lp = Listpack(inflate(node->compressed, node->compressed_bytes, node->raw_bytes));
+    std::free(node->compressed);
+    node->compressed = nullptr;
+}
+
+// Only one node can have crossed into or out of either end's window since
+// the last call, so this touches compress_depth_ + 1 nodes at each end
+void Quicklist::compressEnds()
+{
+    if (compress_depth_ == 0)
+        return;
+
+    Node *front = head_;
+    Node *back = tail_;
+    for (size_t i = 0; i < compress_depth_ && front != nullptr; i++, front = front->next)
+        decompress(front);
+    for (size_t i = 0; i < compress_depth_ && back != nullptr; i++, back = back->prev)
+        decompress(back);
+
+    // front and back are now the first nodes inside, if there are any
+    if (nodes_ > 2 * compress_depth_)
+    {
+        compress(front);
+        compress(back);
+    }
+}
+
+void Quicklist::unlink(Node *node)
+{
+    (node->prev != nullptr ? node->prev->next : head_) = node->next;
+    (node->next != nullptr ? node->next->prev : tail_) = node->prev;
+    nodes_--;
+}
@@ -0,0 +1,91 @@
+#ifndef QUICKLIST_H
+#define QUICKLIST_H
+
+#include "listpack.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// A long list as a doubly-linked list of Listpack nodes of up to node_bytes
+// each, so that pushes and pops at either end touch one small buffer and a
+// range is a scan through a handful of them rather than a pointer per item.
+//
+// With a compress_depth of n > 0, every node but the first and last n is
+// kept LZF-compressed: the ends, where queues push and pop, stay raw, and
+// the middle of a long list costs a fraction of its size. Reading a
+// compressed node decompresses a temporary copy; the node stays compressed.
+class Quicklist
+{
+public:
+    Quicklist(size_t node_bytes, size_t compress_depth);
+    Quicklist(const Quicklist &other);
+    Quicklist &operator=(const Quicklist &other) = delete;
+    ~Quicklist();
+
+    size_t size() const { return count_; }
+
+    void push(std::string_view item, bool front);
+    std::string pop(bool front);                    // The list must not be empty
+    // Indexes must be in range
+    std::string index(size_t index) const;
+    void set(size_t index, std::string_view item);
+    // Calls f(item) for items start..stop inclusive, in order. A compressed
+    // node's items point into a copy that is freed on moving to the next
+    // node, so a view is only valid during the call.
+    template <typename F>
+    void range(size_t start, size_t stop, F &&f) const;
+
+private:
+    struct Node
+    {
+        Node *prev = nullptr;
+        Node *next = nullptr;
+        uint32_t count = 0;             // Items, also while compressed
+        bool compress_failed = false;   // Did not shrink; not retried until changed
+        Listpack lp;                    // Moved out while compressed
+        char *compressed = nullptr;     // LZF bytes of lp, or null
+        uint32_t compressed_bytes = 0;
+        uint32_t raw_bytes = 0;         // lp.bytes() before compression
+
+        ~Node();
+    };
+
+    Node *head_ = nullptr;
+    Node *tail_ = nullptr;
+    size_t count_ = 0;
+    size_t nodes_ = 0;
+    size_t node_bytes_;
+    size_t compress_depth_;
+
+    // The node holding item index, and index's position within it
+    Node *locate(size_t index, size_t &offset) const;
+    // The node's listpack: its own, or decompressed into scratch
+    const Listpack &view(const Node *node, Listpack &scratch) const;
+    static void compress(Node *node);
+    static void decompress(Node *node);
+    // Restores the invariant after a node was added or removed at an end:
+    // the compress_depth nodes at each end raw, the ones inside compressed
+    void compressEnds();
+    void unlink(Node *node);
+};
+
+template <typename F>
+void Quicklist::range(size_t start, size_t stop, F &&f) const
+{
+    size_t offset;
+    const Node *node = locate(start, offset);
+    size_t remaining = stop - start + 1;
+    Listpack scratch;
+    while (remaining > 0)
+    {
+        const Listpack &lp = view(node, scratch);
+        for (size_t pos = lp.seek(static_cast<long long>(offset)); pos != lp.end() && remaining > 0;
+             pos = lp.next(pos), remaining--)
+            f(lp.get(pos));
+        node = node->next;
+        offset = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,643 @@
+#include "rdb.h"
+#include "log.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+constexpr char RDB::MAGIC[4];
+constexpr char RDB::TRAILER_MAGIC[4];
+
+// ============== Encoding Helpers ==============
+
+static void putVarint(std::string &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out += static_cast<char>((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+static void putString(std::string &out, std::string_view s)
+{
+    putVarint(out, s.size());
+    out += s;
+}
+
+static void putFixed32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+
+static void putFixed64(std::string &out, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+
+static uint32_t getFixed32(const char *p)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+static uint64_t getFixed64(const char *p)
+{
+    return getFixed32(p) | (static_cast<uint64_t>(getFixed32(p + 4)) << 32);
+}
+
+// Bounds-checked cursor over a block payload
+struct Reader
+{
+    const char *p;
+    const char *end;
+
+    bool varint(uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7)
+        {
+            unsigned char byte = static_cast<unsigned char>(*p++);
+            v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    // The string's bytes, in place
+    bool view(std::string_view &s)
+    {
+        uint64_t len;
+        if (!varint(len) || len > static_cast<uint64_t>(end - p))
+            return false;
+        s = std::string_view(p, len);
+        p += len;
+        return true;
+    }
+
+    bool string(std::string &s)
+    {
+        std::string_view bytes;
+        if (!view(bytes))
+            return false;
+        s.assign(bytes);
+        return true;
+    }
+};
+
+uint32_t RDB::crc32(const char *data, size_t length, uint32_t crc)
+{
+    static const auto table = []() {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// ============== Writer ==============
+
+bool RDBWriter::open(const std::string &filename)
+{
+    filename_ = filename;
+    file_.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file_.is_open())
+        return false;
+
+    file_.write(RDB::MAGIC, sizeof(RDB::MAGIC));
+    file_.put(static_cast<char>(RDB::VERSION));
+    offset_ = RDB::HEADER_SIZE;
+    return static_cast<bool>(file_);
+}
+
+void RDBWriter::add(const std::string &key, const Value &value, int64_t expire_at_ms)
+{
+    uint8_t tag = static_cast<uint8_t>(value.type());
+    if (expire_at_ms > 0)
+        tag |= 0x80;
+
+    block_ += static_cast<char>(tag);
+    if (expire_at_ms > 0)
+        putVarint(block_, expire_at_ms);
+    putString(block_, key);
+
+    if (value.isEncoded())
+    {
+        // Never decoded since it was loaded; the bytes are already in this
+        // format
+        block_.append(value.encoded().data, value.encoded().length);
+    }
+    else
+    {
+        switch (value.type())
+        {
+        case ValueType::STRING:
+            putString(block_, value.str());
+            break;
+        case ValueType::INTEGER:
+        {
+            // Zigzag so small negative numbers stay short
+            uint64_t n = static_cast<uint64_t>(value.integer());
+            putVarint(block_, (n << 1) ^ (value.integer() < 0 ? ~uint64_t(0) : 0));
+            break;
+        }
+        case ValueType::LIST:
+            putVarint(block_, value.listLength());
+            value.forEachMember([&](std::string_view item) { putString(block_, item); });
+            break;
+        case ValueType::SET:
+            putVarint(block_, value.setSize());
+            value.forEachMember([&](std::string_view member) { putString(block_, member); });
+            break;
+        case ValueType::HASH:
+            putVarint(block_, value.hashLength());
+            value.forEachField([&](std::string_view field, std::string_view val) {
+                putString(block_, field);
+                putString(block_, val);
+            });
+            break;
+        }
+    }
+
+    block_entries_++;
+    if (block_.size() >= RDB::BLOCK_SIZE)
+        flushBlock();
+}
+
+void RDBWriter::flushBlock()
+{
+    if (block_entries_ == 0)
+        return;
+
+    std::string header;
+    putFixed32(header, static_cast<uint32_t>(block_.size()));
+    putFixed32(header, static_cast<uint32_t>(block_entries_));
+    std::string crc;
+    putFixed32(crc, RDB::crc32(block_.data(), block_.size()));
+
+    file_.write(header.data(), header.size());
+    file_.write(block_.data(), block_.size());
+    file_.write(crc.data(), crc.size());
+
+    index_.push_back({offset_, block_.size(), block_entries_});
+    offset_ += header.size() + block_.size() + crc.size();
+
+    block_.clear();
+    block_entries_ = 0;
+}
+
+bool RDBWriter::finish(uint64_t aof_seq)
+{
+    flushBlock();
+
+    std::string index;
+    putVarint(index, index_.size());
+    for (const RDB::BlockInfo &block : index_)
+    {
+        putVarint(index, block.offset);
+        putVarint(index, block.length);
+        putVarint(index, block.entries);
+    }
+    putVarint(index, aof_seq);
+
+    std::string trailer;
+    putFixed64(trailer, offset_);
+    putFixed32(trailer, RDB::crc32(index.data(), index.size()));
+    trailer.append(RDB::TRAILER_MAGIC, sizeof(RDB::TRAILER_MAGIC));
+
+    file_.write(index.data(), index.size());
+    file_.write(trailer.data(), trailer.size());
+    file_.close();
+    if (file_.fail())
+        return false;
+
+    // ofstream cannot fsync; any descriptor of the file will do
+    int fd = ::open(filename_.c_str(), O_RDONLY | O_CLOEXEC);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0)
+        ::close(fd);
+    return synced;
+}
+
+// ============== Reader ==============
+
+bool RDB::isSnapshot(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+// Decodes the value of an entry whose tag says `type` into `value`, keeping
+// its expiry flag
+static bool readValue(Reader &in, ValueType type, Value &value)
+{
+    uint64_t count;
+    bool has_expiry = value.hasExpiry();
+
+    switch (type)
+    {
+    case ValueType::STRING:
+    {
+        std::string_view s;
+        if (!in.view(s))
+            return false;
+        value = Value(s);
+        break;
+    }
+    case ValueType::INTEGER:
+    {
+        uint64_t z;
+        if (!in.varint(z))
+            return false;
+        value = Value(static_cast<long long>((z >> 1) ^ (~(z & 1) + 1)));
+        break;
+    }
+    // Collections are rebuilt element by element, so the small ones come
+    // back packed whatever they were when saved
+    case ValueType::LIST:
+    {
+        if (!in.varint(count))
+            return false;
+        value = Value(ValueType::LIST, count);
+        std::string_view item;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (!in.view(item))
+                return false;
+            value.listPush(item, false);
+        }
+        break;
+    }
+    case ValueType::SET:
+    {
+        if (!in.varint(count))
+            return false;
+        value = Value(ValueType::SET, count);
+        std::string_view member;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (!in.view(member))
+                return false;
+            value.setAdd(member);
+        }
+        break;
+    }
+    case ValueType::HASH:
+    {
+        if (!in.varint(count))
+            return false;
+        value = Value(ValueType::HASH, count);
+        std::string_view field, val;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (!in.view(field) || !in.view(val))
+                return false;
+            value.hashSet(field, val);
+        }
+        break;
+    }
+    default:
+        return false;
+    }
+
+    value.setHasExpiry(has_expiry);
+    return true;
+}
+
+// Steps over a value without decoding it
+static bool skipValue(Reader &in, ValueType type)
+{
+    uint64_t n;
+    uint64_t strings = 1;
+
+    switch (type)
+    {
+    case ValueType::STRING:
+        break;
+    case ValueType::INTEGER:
+        return in.varint(n);
+    case ValueType::LIST:
+    case ValueType::SET:
+        if (!in.varint(strings))
+            return false;
+        break;
+    case ValueType::HASH:
+        if (!in.varint(strings) || strings > UINT64_MAX / 2)
+            return false;
+        strings *= 2;
+        break;
+    default:
+        return false;
+    }
+
+    for (uint64_t i = 0; i < strings; i++)
+    {
+        if (!in.varint(n) || n > static_cast<uint64_t>(in.end - in.p))
+            return false;
+        in.p += n;
+    }
+    return true;
+}
+
+// Reads an entry's tag, expiry and key
+static bool readEntryHeader(Reader &in, ValueType &type, uint64_t &expire_at, std::string_view &key)
+{
+    uint8_t tag = static_cast<uint8_t>(*in.p++);
+    expire_at = 0;
+    if ((tag & 0x80) && !in.varint(expire_at))
+        return false;
+
+    if (!in.view(key))
+        return false;
+
+    type = static_cast<ValueType>(tag & 0x7f);
+    return true;
+}
+
+bool RDB::decodeBlock(const char *data, size_t length, const EntryCallback &onEntry)
+{
+    Reader in{data, data + length};
+
+    while (in.p < in.end)
+    {
+        ValueType type;
+        uint64_t expire_at;
+        std::string_view key;
+        Value value;
+        if (!readEntryHeader(in, type, expire_at, key) || !readValue(in, type, value))
+            return false;
+
+        onEntry(std::string(key), std::move(value), static_cast<int64_t>(expire_at));
+    }
+    return true;
+}
+
+bool RDB::scanBlock(const char *data, size_t length, const RawEntryCallback &onEntry)
+{
+    Reader in{data, data + length};
+
+    while (in.p < in.end)
+    {
+        ValueType type;
+        uint64_t expire_at;
+        std::string_view key;
+        if (!readEntryHeader(in, type, expire_at, key))
+            return false;
+
+        const char *value = in.p;
+        if (!skipValue(in, type))
+            return false;
+
+        onEntry(key, type, static_cast<int64_t>(expire_at), value, in.p - value);
+    }
+    return true;
+}
+
+bool RDB::decodeValue(const char *data, size_t length, ValueType type, Value &value)
+{
+    Reader in{data, data + length};
+    return readValue(in, type, value) && in.p == in.end;
+}
+
+bool RDB::readIndex(const std::string &filename, Index &out)
+{
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return false;
+
+    uint64_t size = static_cast<uint64_t>(file.tellg());
+    char header[HEADER_SIZE];
+    char trailer[TRAILER_SIZE];
+
+    file.seekg(0);
+    if (size < HEADER_SIZE + TRAILER_SIZE || !file.read(header, HEADER_SIZE) ||
+        std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0 ||
+        static_cast<uint8_t>(header[4]) < 1 || static_cast<uint8_t>(header[4]) > VERSION)
+    {
+        LOG_ERROR("Snapshot " << filename << " has an unknown header");
+        return false;
+    }
+
+    file.seekg(size - TRAILER_SIZE);
+    if (!file.read(trailer, TRAILER_SIZE) || std::memcmp(trailer + 12, TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) != 0)
+    {
+        LOG_ERROR("Snapshot " << filename << " is truncated (no trailer)");
+        return false;
+    }
+
+    uint64_t index_offset = getFixed64(trailer);
+    if (index_offset < HEADER_SIZE || index_offset > size - TRAILER_SIZE)
+    {
+        LOG_ERROR("Snapshot " << filename << " has a bad index offset");
+        return false;
+    }
+
+    std::string index(size - TRAILER_SIZE - index_offset, '\0');
+    file.seekg(index_offset);
+    if (!file.read(&index[0], index.size()) || crc32(index.data(), index.size()) != getFixed32(trailer + 8))
+    {
+        LOG_ERROR("Snapshot " << filename << " index checksum mismatch");
+        return false;
+    }
+
+    Reader in{index.data(), index.data() + index.size()};
+    uint64_t blocks;
+    if (!in.varint(blocks) || blocks > index.size())
+    {
+        LOG_ERROR("Snapshot " << filename << " index is malformed");
+        return false;
+    }
+
+    out.blocks.resize(blocks);
+    for (BlockInfo &info : out.blocks)
+    {
+        if (!in.varint(info.offset) || !in.varint(info.length) || !in.varint(info.entries) ||
+            info.offset + 8 + info.length + 4 > index_offset)
+        {
+            LOG_ERROR("Snapshot " << filename << " index is malformed");
+            return false;
+        }
+    }
+
+    out.aof_seq = 0;
+    out.file_size = size;
+    if (static_cast<uint8_t>(header[4]) >= 2 && !in.varint(out.aof_seq))
+    {
+        LOG_ERROR("Snapshot " << filename << " index is malformed");
+        return false;
+    }
+    return true;
+}
+
+uint64_t RDB::Index::entries() const
+{
+    uint64_t total = 0;
+    for (const BlockInfo &block : blocks)
+        total += block.entries;
+    return total;
+}
+
+static bool readAt(int fd, char *buf, size_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t n = pread(fd, buf, length, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        length -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Runs work(worker, block) for every block on up to `threads` threads.
+// Workers claim blocks one at a time, so a few large blocks cannot leave the
+// other threads idle for long. Stops early once any call fails.
+static bool forEachBlock(size_t blocks, size_t threads, const std::function<bool(size_t, size_t)> &work)
+{
+    std::atomic<size_t> next{0};
+    std::atomic<bool> ok{true};
+
+    auto run = [&](size_t worker) {
+        size_t b;
+        while (ok.load() && (b = next.fetch_add(1)) < blocks)
+        {
+            if (!work(worker, b))
+                ok = false;
+        }
+    };
+
+    threads = std::max<size_t>(1, std::min(threads, blocks));
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++)
+        pool.emplace_back(run, t);
+    run(0);
+    for (std::thread &thread : pool)
+        thread.join();
+
+    return ok.load();
+}
+
+// Checks a block's framing and CRC; `block` points at its payload_len field
+static bool verifyBlock(const char *block, const RDB::BlockInfo &info)
+{
+    return getFixed32(block) == info.length &&
+           RDB::crc32(block + 8, info.length) == getFixed32(block + 8 + info.length);
+}
+
+bool RDB::load(const std::string &filename, size_t threads, const WorkerEntryCallback &onEntry, Index &index)
+{
+    if (!readIndex(filename, index))
+        return false;
+
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    std::vector<std::string> buffers(std::max<size_t>(threads, 1));
+    bool ok = forEachBlock(index.blocks.size(), threads, [&](size_t worker, size_t b) {
+        const BlockInfo &info = index.blocks[b];
+        std::string &block = buffers[worker];
+        block.resize(8 + info.length + 4);
+
+        if (!readAt(fd, &block[0], block.size(), info.offset) || !verifyBlock(block.data(), info))
+        {
+            LOG_ERROR("Snapshot " << filename << " block " << b << " checksum mismatch");
+            return false;
+        }
+
+        bool decoded = decodeBlock(block.data() + 8, info.length, [&](std::string &&key, Value &&value, int64_t expire_at_ms) {
+            onEntry(worker, std::move(key), std::move(value), expire_at_ms);
+        });
+        if (!decoded)
+        {
+            LOG_ERROR("Snapshot " << filename << " block " << b << " is malformed");
+        }
+        return decoded;
+    });
+
+    ::close(fd);
+    return ok;
+}
+
+bool RDB::scan(const RDBMapping &mapping, size_t threads, const WorkerRawEntryCallback &onEntry, Index &index)
+{
+    if (!readIndex(mapping.filename(), index) || index.file_size != mapping.size())
+        return false;
+
+    return forEachBlock(index.blocks.size(), threads, [&](size_t worker, size_t b) {
+        const BlockInfo &info = index.blocks[b];
+        const char *block = mapping.data() + info.offset;
+
+        if (!verifyBlock(block, info))
+        {
+            LOG_ERROR("Snapshot " << mapping.filename() << " block " << b << " checksum mismatch");
+            return false;
+        }
+
+        bool scanned = scanBlock(block + 8, info.length, [&](std::string_view key, ValueType type, int64_t expire_at_ms,
+                                                            const char *value, size_t length) {
+            onEntry(worker, key, type, expire_at_ms, value, length);
+        });
+        if (!scanned)
+        {
+            LOG_ERROR("Snapshot " << mapping.filename() << " block " << b << " is malformed");
+        }
+        return scanned;
+    });
+}
+
+// ============== Mapping ==============
+
+RDBMapping::~RDBMapping()
+{
+    if (data_ != nullptr)
+        munmap(const_cast<char *>(data_), size_);
+}
+
+bool RDBMapping::open(const std::string &filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        LOG_ERROR("Failed to map snapshot " << filename << ": " << strerror(errno));
+        return false;
+    }
+
+    filename_ = filename;
+    data_ = static_cast<const char *>(data);
+    size_ = st.st_size;
+    return true;
+}
@@ -0,0 +1,143 @@
+#ifndef RDB_H
+#define RDB_H
+
+#include "value.h"
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary snapshot format.
+//
+//   file    := header block* index trailer
+//   header  := "TRDB" version:u8
+//   block   := payload_len:u32 entry_count:u32 payload crc32(payload):u32
+//   entry   := tag:u8 [expire_at:varint] key:str value
+//   index   := block_count:varint (offset:varint length:varint entries:varint)*
+//              aof_seq:varint
+//   trailer := index_offset:u64 crc32(index):u32 "TRDX"
+//
+// tag is the ValueType, with bit 7 set when an absolute expiry (unix time in
+// milliseconds) follows. str is a varint length followed by the bytes.
+// Values: STRING str; INTEGER zigzag varint; LIST and SET count:varint str*;
+// HASH count:varint (str str)*. Fixed-width integers are little endian.
+//
+// Entries are grouped into blocks of about BLOCK_SIZE bytes, each with its own
+// CRC. The index at the end lists every block, so a reader can check or
+// decode blocks independently. aof_seq (version 2 and later) is the first AOF
+// segment whose writes are not part of the snapshot.
+class RDBMapping;
+
+class RDB
+{
+public:
+    static constexpr char MAGIC[4] = {'T', 'R', 'D', 'B'};
+    static constexpr char TRAILER_MAGIC[4] = {'T', 'R', 'D', 'X'};
+    static constexpr uint8_t VERSION = 2;
+    static constexpr size_t HEADER_SIZE = 5;
+    static constexpr size_t TRAILER_SIZE = 16;
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+    struct BlockInfo
+    {
+        uint64_t offset;    // File offset of the block's payload_len field
+        uint64_t length;    // Payload bytes
+        uint64_t entries;
+    };
+
+    // Everything the trailer and index say about a file
+    struct Index
+    {
+        std::vector<BlockInfo> blocks;
+        uint64_t aof_seq = 0;       // 0 for version 1 files
+        uint64_t file_size = 0;
+
+        uint64_t entries() const;
+    };
+
+    // Called for every live key. expire_at_ms is 0 for keys without a TTL.
+    using EntryCallback = std::function<void(std::string &&key, Value &&value, int64_t expire_at_ms)>;
+    // Same, from one of load()'s workers; worker is below the thread count.
+    // Different workers call it concurrently.
+    using WorkerEntryCallback =
+        std::function<void(size_t worker, std::string &&key, Value &&value, int64_t expire_at_ms)>;
+    // Called for every entry by scan(); `value` and `length` locate the still
+    // encoded value, to be passed to decodeValue() later
+    using RawEntryCallback = std::function<void(std::string_view key, ValueType type, int64_t expire_at_ms,
+                                                const char *value, size_t length)>;
+    using WorkerRawEntryCallback = std::function<void(size_t worker, std::string_view key, ValueType type,
+                                                      int64_t expire_at_ms, const char *value, size_t length)>;
+
+    // True if the file starts with the binary snapshot magic
+    static bool isSnapshot(const std::string &filename);
+
+    // Reads and verifies the header, trailer and index without touching the
+    // blocks. Returns false (after logging why) if any of them is corrupt.
+    static bool readIndex(const std::string &filename, Index &index);
+
+    // Reads and verifies the whole file, calling onEntry for each entry, and
+    // fills in its index. Blocks are read and decoded by up to `threads`
+    // workers in parallel, in no particular order. Returns false (after
+    // logging why) if the file is corrupt.
+    static bool load(const std::string &filename, size_t threads, const WorkerEntryCallback &onEntry, Index &index);
+
+    // Like load(), but over a mapping of the file and without decoding any
+    // value: only keys are copied out. Checksums are still verified.
+    static bool scan(const RDBMapping &mapping, size_t threads, const WorkerRawEntryCallback &onEntry, Index &index);
+
+    // Decodes one block payload; false if it is malformed
+    static bool decodeBlock(const char *data, size_t length, const EntryCallback &onEntry);
+    // Splits one block payload into entries without decoding the values
+    static bool scanBlock(const char *data, size_t length, const RawEntryCallback &onEntry);
+    // Decodes a value found by scanBlock() into value.data, keeping the
+    // rest of `value` (such as its expiration) as it is
+    static bool decodeValue(const char *data, size_t length, ValueType type, Value &value);
+
+    static uint32_t crc32(const char *data, size_t length, uint32_t crc = 0);
+};
+
+// Read-only memory mapping of a snapshot file. Values found by RDB::scan()
+// point into it, so it must outlive them.
+class RDBMapping
+{
+public:
+    RDBMapping() = default;
+    RDBMapping(const RDBMapping &) = delete;
+    RDBMapping &operator=(const RDBMapping &) = delete;
+    ~RDBMapping();
+
+    bool open(const std::string &filename);
+
+    const std::string &filename() const { return filename_; }
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    std::string filename_;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Streams entries into a snapshot file, one block at a time
+class RDBWriter
+{
+public:
+    bool open(const std::string &filename);
+    void add(const std::string &key, const Value &value, int64_t expire_at_ms);
+    // Writes the last block, the index and the trailer, then syncs the file
+    bool finish(uint64_t aof_seq);
+
+private:
+    std::string filename_;
+    std::ofstream file_;
+    std::string block_;
+    uint64_t block_entries_ = 0;
+    uint64_t offset_ = 0;
+    std::vector<RDB::BlockInfo> index_;
+
+    void flushBlock();
+};
+
+#endif
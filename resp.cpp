@@ -1,120 +1,313 @@
 #include "resp.h"
-#include <iostream>
-#include <sstream>
+#include "log.h"
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <cctype>
 
-// Helper function to parse plain text commands (like "SET key value")
-static std::vector<std::string> parsePlainText(const std::string &data)
+// Parses a decimal length prefix between p and end. Returns -1 if malformed.
+static long long parseLength(const char *p, const char *end)
 {
-    std::vector<std::string> result;
-    
-    // Trim trailing \r\n or \n
-    std::string trimmed = data;
-    while (!trimmed.empty() && (trimmed.back() == '\r' || trimmed.back() == '\n'))
+    if (p == end)
+        return -1;
+    bool negative = false;
+    if (*p == '-')
     {
-        trimmed.pop_back();
+        negative = true;
+        p++;
+        if (p == end)
+            return -1;
     }
-    
-    std::istringstream iss(trimmed);
-    std::string word;
-    while (iss >> word)
+    long long value = 0;
+    for (; p < end; p++)
     {
-        result.push_back(word);
+        if (*p < '0' || *p > '9')
+            return -1;
+        value = value * 10 + (*p - '0');
+        if (value > (1LL << 40))
+            return -1;
     }
-    
-    return result;
+    return negative ? -value : value;
 }
 
-std::vector<std::string> RESP::parse(const std::string &data)
-{
-    std::vector<std::string> result;
-    size_t pos = 0;
+// Limits matching Redis' proto-max-bulk-len and multibulk sanity checks
+static const long long MAX_BULK_LEN = 512LL * 1024 * 1024;
+static const long long MAX_MULTIBULK_LEN = 1024 * 1024;
+static const size_t MAX_INLINE_LEN = 64 * 1024;
 
-    std::cout << "# [RESP Parser] Parsing data of length " << data.length() << std::endl;
+void RESPDecoder::feed(const char *data, size_t len)
+{
+    std::memcpy(prepare(len), data, len);
+    commit(len);
+}
 
-    // Check if this is RESP format (starts with '*') or plain text
-    if (data.empty())
+char *RESPDecoder::prepare(size_t len)
+{
+    // Drop consumed frames before growing the buffer again
+    if (pos_ > 0 && (pos_ == end_ || pos_ >= end_ / 2 || end_ + len > capacity_))
     {
-        return result;
+        std::memmove(buf_.get(), buf_.get() + pos_, end_ - pos_);
+        end_ -= pos_;
+        if (needed_ > 0)
+            needed_ -= pos_;
+        pos_ = 0;
     }
-    
-    if (data[0] != '*')
+
+    if (end_ + len > capacity_)
     {
-        // Not RESP format - parse as plain text command
-        std::cout << "# [RESP Parser] Plain text mode - parsing as natural language" << std::endl;
-        return parsePlainText(data);
+        size_t capacity = capacity_ ? capacity_ : 16384;
+        while (capacity < end_ + len)
+            capacity *= 2;
+        std::unique_ptr<char[]> grown(new char[capacity]);
+        if (end_ > 0)
+            std::memcpy(grown.get(), buf_.get(), end_);
+        buf_ = std::move(grown);
+        capacity_ = capacity;
     }
+    return buf_.get() + end_;
+}
+
+void RESPDecoder::commit(size_t len)
+{
+    end_ += len;
+}
 
-    // RESP parsing (original logic)
-    // Skip '*' and read array length
-    pos = 1;
-    size_t end = data.find("\r\n", pos);
-    if (end == std::string::npos)
+const char *RESPDecoder::findCRLF(size_t from) const
+{
+    const char *p = buf_.get() + from;
+    const char *last = buf_.get() + end_;
+    while (p < last)
     {
-        std::cout << "# [RESP Parser] No \\r\\n found after *" << std::endl;
-        return result;
+        p = static_cast<const char *>(std::memchr(p, '\r', last - p));
+        if (p == nullptr || p + 1 >= last)
+            return nullptr;
+        if (p[1] == '\n')
+            return p;
+        p++;
     }
+    return nullptr;
+}
 
-    int arrayLen = std::stoi(data.substr(pos, end - pos));
-    std::cout << "# [RESP Parser] Array length: " << arrayLen << std::endl;
-    pos = end + 2;
+RESPDecoder::Status RESPDecoder::next(std::vector<std::string_view> &command)
+{
+    command.clear();
 
-    // Parse each bulk string
-    for (int i = 0; i < arrayLen; i++)
+    while (pos_ < end_)
     {
-        std::cout << "# [RESP Parser] Parsing element " << (i + 1) << "/" << arrayLen << std::endl;
+        if (needed_ > 0 && end_ < needed_)
+            return Status::INCOMPLETE;
+        needed_ = 0;
 
-        if (pos >= data.length() || data[pos] != '$')
+        Status status = buf_[pos_] == '*' ? parseMultiBulk(command) : parseInline(command);
+        if (status != Status::COMPLETE)
+            return status;
+        if (!command.empty())
         {
-            std::cout << "# [RESP Parser] Expected $ at position " << pos << std::endl;
-            break;
+            LOG_TRACE("# [RESP Parser] Parsed " << command.size() << " tokens");
+            return Status::COMPLETE;
         }
+        // Empty line or empty array: nothing to execute, keep going
+    }
+    return Status::INCOMPLETE;
+}
+
+RESPDecoder::Status RESPDecoder::parseMultiBulk(std::vector<std::string_view> &command)
+{
+    const char *base = buf_.get();
+    size_t pos = pos_ + 1;
 
-        pos++; // Skip '$'
-        end = data.find("\r\n", pos);
-        if (end == std::string::npos)
+    const char *crlf = findCRLF(pos);
+    if (crlf == nullptr)
+        return end_ - pos > 32 ? fail("invalid multibulk length") : Status::INCOMPLETE;
+
+    long long arrayLen = parseLength(base + pos, crlf);
+    if (arrayLen > MAX_MULTIBULK_LEN || arrayLen < -1)
+        return fail("invalid multibulk length");
+    pos = crlf - base + 2;
+
+    for (long long i = 0; i < arrayLen; i++)
+    {
+        if (pos >= end_)
         {
-            std::cout << "# [RESP Parser] No \\r\\n found after $" << std::endl;
-            break;
+            command.clear();
+            return Status::INCOMPLETE;
         }
+        if (base[pos] != '$')
+            return fail(std::string("expected '$', got '") + base[pos] + "'");
+        pos++;
 
-        int bulkLen = std::stoi(data.substr(pos, end - pos));
-        std::cout << "# [RESP Parser] Bulk string length: " << bulkLen << std::endl;
-        pos = end + 2;
+        crlf = findCRLF(pos);
+        if (crlf == nullptr)
+        {
+            command.clear();
+            return end_ - pos > 32 ? fail("invalid bulk length") : Status::INCOMPLETE;
+        }
 
-        if (pos + bulkLen > data.length())
+        long long bulkLen = parseLength(base + pos, crlf);
+        if (bulkLen < 0 || bulkLen > MAX_BULK_LEN)
+            return fail("invalid bulk length");
+        pos = crlf - base + 2;
+
+        if (pos + bulkLen + 2 > end_)
         {
-            std::cout << "# [RESP Parser] Not enough data for bulk string" << std::endl;
-            break;
+            // Don't rescan this frame until the whole bulk string can be there
+            needed_ = pos + bulkLen + 2;
+            command.clear();
+            return Status::INCOMPLETE;
         }
+        if (base[pos + bulkLen] != '\r' || base[pos + bulkLen + 1] != '\n')
+            return fail("bulk string not terminated by CRLF");
 
-        std::string bulk = data.substr(pos, bulkLen);
-        std::cout << "# [RESP Parser] Extracted: \"" << bulk << "\"" << std::endl;
-        result.push_back(bulk);
-        pos += bulkLen + 2; // Skip bulk string and \r\n
+        command.emplace_back(base + pos, bulkLen);
+        pos += bulkLen + 2;
     }
 
-    std::cout << "# [RESP Parser] Parsed " << result.size() << " tokens" << std::endl;
-    return result;
+    pos_ = pos;
+    return Status::COMPLETE;
 }
 
-std::string RESP::encodeSimpleString(const std::string &str)
+RESPDecoder::Status RESPDecoder::parseInline(std::vector<std::string_view> &command)
 {
-    return "+" + str + "\r\n";
+    const char *base = buf_.get();
+    const char *nl = static_cast<const char *>(std::memchr(base + pos_, '\n', end_ - pos_));
+    if (nl == nullptr)
+        return end_ - pos_ > MAX_INLINE_LEN ? fail("too big inline request") : Status::INCOMPLETE;
+
+    // Split the line on whitespace (a trailing \r counts as whitespace)
+    const char *p = base + pos_;
+    while (p < nl)
+    {
+        while (p < nl && std::isspace(static_cast<unsigned char>(*p)))
+            p++;
+        const char *word = p;
+        while (p < nl && !std::isspace(static_cast<unsigned char>(*p)))
+            p++;
+        if (p > word)
+            command.emplace_back(word, p - word);
+    }
+
+    pos_ = nl - base + 1;
+    return Status::COMPLETE;
+}
+
+RESPDecoder::Status RESPDecoder::fail(const std::string &msg)
+{
+    error_ = "ERR Protocol error: " + msg;
+    LOG_DEBUG("# [RESP Parser] " << error_);
+    return Status::ERROR;
 }
 
-std::string RESP::encodeError(const std::string &err)
+std::vector<std::string> RESP::parse(const std::string &data)
 {
-    return "-" + err + "\r\n";
+    RESPDecoder decoder;
+    std::vector<std::string_view> views;
+    decoder.feed(data.data(), data.size());
+    decoder.next(views);
+    return std::vector<std::string>(views.begin(), views.end());
+}
+
+std::string RESP::encodeSimpleString(std::string_view str)
+{
+    std::string out;
+    out.reserve(str.size() + 3);
+    out += '+';
+    out.append(str);
+    out += "\r\n";
+    return out;
+}
+
+std::string RESP::encodeError(std::string_view err)
+{
+    std::string out;
+    out.reserve(err.size() + 3);
+    out += '-';
+    out.append(err);
+    out += "\r\n";
+    return out;
+}
+
+// ":<n>\r\n" and "$<len>\r\n<n>\r\n" for every shared integer
+struct SharedIntegers
+{
+    std::array<std::string, RESP::SHARED_INTEGERS> integers;
+    std::array<std::string, RESP::SHARED_INTEGERS> bulks;
+
+    SharedIntegers()
+    {
+        for (long long n = 0; n < RESP::SHARED_INTEGERS; n++)
+        {
+            std::string digits = std::to_string(n);
+            integers[n] = ":" + digits + "\r\n";
+            bulks[n] = "$" + std::to_string(digits.size()) + "\r\n" + digits + "\r\n";
+        }
+    }
+};
+
+static const SharedIntegers &sharedIntegers()
+{
+    static const SharedIntegers shared;
+    return shared;
 }
 
 std::string RESP::encodeInteger(long long num)
 {
-    return ":" + std::to_string(num) + "\r\n";
+    if (num >= 0 && num < SHARED_INTEGERS)
+        return sharedIntegers().integers[num];
+
+    char buf[24];
+    buf[0] = ':';
+    char *end = std::to_chars(buf + 1, buf + sizeof(buf), num).ptr;
+    std::memcpy(end, "\r\n", 2);
+    return std::string(buf, end + 2 - buf);
+}
+
+std::string RESP::encodeBulkString(std::string_view str)
+{
+    std::string out;
+    out.reserve(str.size() + 16);
+    appendBulkString(out, str);
+    return out;
 }
 
-std::string RESP::encodeBulkString(const std::string &str)
+void RESP::appendBulkString(std::string &out, std::string_view str)
 {
-    return "$" + std::to_string(str.length()) + "\r\n" + str + "\r\n";
+    char header[24];
+    header[0] = '$';
+    char *end = std::to_chars(header + 1, header + sizeof(header), str.size()).ptr;
+    std::memcpy(end, "\r\n", 2);
+    out.append(header, end + 2 - header);
+    out.append(str);
+    out += "\r\n";
+}
+
+void RESP::appendBulkInteger(std::string &out, long long num)
+{
+    if (num >= 0 && num < SHARED_INTEGERS)
+    {
+        out += sharedIntegers().bulks[num];
+        return;
+    }
+
+    // "$<len>\r\n" takes at most 5 bytes: the digits are formatted after
+    // it and the length filled in afterwards
+    char buf[32];
+    char *digits = buf + 5;
+    char *end = std::to_chars(digits, buf + sizeof(buf), num).ptr;
+    size_t length = end - digits;
+    char *start = length >= 10 ? buf : buf + 1;
+    start[0] = '$';
+    if (length >= 10)
+    {
+        start[1] = static_cast<char>('0' + length / 10);
+        start[2] = static_cast<char>('0' + length % 10);
+    }
+    else
+    {
+        start[1] = static_cast<char>('0' + length);
+    }
+    std::memcpy(digits - 2, "\r\n", 2);
+    std::memcpy(end, "\r\n", 2);
+    out.append(start, end + 2 - start);
 }
 
 std::string RESP::encodeNullBulkString()
@@ -122,9 +315,19 @@ std::string RESP::encodeNullBulkString()
     return "$-1\r\n";
 }
 
+std::string RESP::encodeNullArray()
+{
+    return "*-1\r\n";
+}
+
+std::string RESP::encodeArrayHeader(size_t count)
+{
+    return "*" + std::to_string(count) + "\r\n";
+}
+
 std::string RESP::encodeArray(const std::vector<std::string> &items)
 {
-    std::string result = "*" + std::to_string(items.size()) + "\r\n";
+    std::string result = encodeArrayHeader(items.size());
     for (const auto &item : items)
     {
         result += encodeBulkString(item);
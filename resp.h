@@ -3,20 +3,75 @@
 
 #include <string>
 #include <vector>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+// Stateful per-connection decoder. Bytes from each recv() are appended with
+// feed() (or read straight into the buffer with prepare()/commit()); next()
+// then pops one complete command at a time, keeping partial frames buffered
+// until the rest arrives. Accepts RESP arrays of bulk strings and plain text
+// (inline) commands terminated by \n.
+//
+// Arguments are returned as views into the decoder's own buffer, so nothing is
+// copied until a command actually stores a key or value. The views stay valid
+// until the next call to feed() or prepare().
+class RESPDecoder
+{
+public:
+    enum class Status
+    {
+        COMPLETE,   // A whole command was written to `command`
+        INCOMPLETE, // Need more bytes
+        ERROR       // Protocol error, the connection should be closed
+    };
+
+    void feed(const char *data, size_t len);
+    char *prepare(size_t len);      // Returns room for at least len bytes at the end
+    void commit(size_t len);        // Marks len bytes of that room as received
+    Status next(std::vector<std::string_view> &command);
+
+    const std::string &error() const { return error_; }
+    size_t buffered() const { return end_ - pos_; }
+
+private:
+    std::unique_ptr<char[]> buf_;
+    size_t capacity_ = 0;
+    size_t end_ = 0;        // Bytes received
+    size_t pos_ = 0;        // Start of the first unconsumed frame
+    size_t needed_ = 0;     // Buffer size below which the pending frame cannot complete
+    std::string error_;
+
+    const char *findCRLF(size_t from) const;
+    Status parseMultiBulk(std::vector<std::string_view> &command);
+    Status parseInline(std::vector<std::string_view> &command);
+    Status fail(const std::string &msg);
+};
 
 class RESP
 {
 public:
-    // Parse RESP command from client (e.g., "*3\r\n$3\r\nSET\r\n...")
+    // Integer replies for 0 <= n < SHARED_INTEGERS are formatted once at
+    // startup and copied from then on
+    static constexpr long long SHARED_INTEGERS = 10000;
+
+    // Parse a single RESP command from client (e.g., "*3\r\n$3\r\nSET\r\n...").
+    // One-shot helper; connections use RESPDecoder to handle partial and pipelined frames.
     static std::vector<std::string> parse(const std::string &data);
     
     // Encode responses to RESP format
-    static std::string encodeSimpleString(const std::string &str);
-    static std::string encodeError(const std::string &err);
+    static std::string encodeSimpleString(std::string_view str);
+    static std::string encodeError(std::string_view err);
     static std::string encodeInteger(long long num);
-    static std::string encodeBulkString(const std::string &str);
+    static std::string encodeBulkString(std::string_view str);
     static std::string encodeNullBulkString();
+    static std::string encodeNullArray();
     static std::string encodeArray(const std::vector<std::string> &items);
+    static std::string encodeArrayHeader(size_t count);     // Elements are appended by the caller
+
+    // Append to an existing reply instead of building a new string
+    static void appendBulkString(std::string &out, std::string_view str);
+    static void appendBulkInteger(std::string &out, long long num);    // The number's digits as a bulk string
 };
 
 #endif
\ No newline at end of file
@@ -1,16 +1,23 @@
 #include "server.h"
 #include "resp.h"
-#include <iostream>
+#include "log.h"
+#include "command.h"
+#include <algorithm>
 #include <cstring>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <sstream>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
-Server::Server(Db &db, int port) : db_(db), port_(port), running_(false)
+Server::Server(Db &db, int port, ServerMode mode, int io_threads)
+    : db_(db), port_(port), running_(false), mode_(mode), io_threads_(io_threads)
 {
     server_socket_ = -1;
+    if (io_threads_ < 1)
+        io_threads_ = 1;
 }
 
 Server::~Server()
@@ -24,22 +31,22 @@ void Server::start()
     server_socket_ = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket_ < 0)
     {
-        std::cerr << "Failed to create socket" << std::endl;
+        LOG_ERROR("Failed to create socket");
         return;
     }
 
-    std::cout << "# Socket created: " << server_socket_ << std::endl;
+    LOG_DEBUG("# Socket created: " << server_socket_);
 
     // Step 2: Set socket options (allow reuse of address)
     int opt = 1;
     if (setsockopt(server_socket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
     {
-        std::cerr << "Failed to set socket options" << std::endl;
+        LOG_ERROR("Failed to set socket options");
         close(server_socket_);
         return;
     }
 
-    std::cout << "# Socket options set (SO_REUSEADDR)" << std::endl;
+    LOG_DEBUG("# Socket options set (SO_REUSEADDR)");
 
     // Step 3: Bind socket to address and port
     struct sockaddr_in address;
@@ -49,27 +56,37 @@ void Server::start()
 
     if (bind(server_socket_, (struct sockaddr *)&address, sizeof(address)) < 0)
     {
-        std::cerr << "Failed to bind socket to port " << port_ << std::endl;
+        LOG_ERROR("Failed to bind socket to port " << port_);
         close(server_socket_);
         return;
     }
 
-    std::cout << "# Socket bound to 0.0.0.0:" << port_ << std::endl;
+    LOG_DEBUG("# Socket bound to 0.0.0.0:" << port_);
 
     // Step 4: Listen for connections (backlog = 10)
     if (listen(server_socket_, 10) < 0)
     {
-        std::cerr << "Failed to listen on socket" << std::endl;
+        LOG_ERROR("Failed to listen on socket");
         close(server_socket_);
         return;
     }
 
-    std::cout << "# Socket listening (backlog: 10)" << std::endl;
+    LOG_DEBUG("# Socket listening (backlog: 10)");
 
     running_ = true;
-    std::cout << "# TinyRedis server started on port " << port_ << std::endl;
-    std::cout << "# Ready to accept connections" << std::endl;
-    std::cout << "# Waiting for clients..." << std::endl;
+
+    if (mode_ != ServerMode::THREADED && !startEventLoops())
+    {
+        LOG_ERROR("Failed to start epoll event loops");
+        running_ = false;
+        close(server_socket_);
+        server_socket_ = -1;
+        return;
+    }
+
+    LOG_INFO("# TinyRedis server started on port " << port_);
+    LOG_INFO("# Ready to accept connections");
+    LOG_INFO("# Waiting for clients...");
 
     // Step 5: Accept connections in a loop
     while (running_)
@@ -77,14 +94,14 @@ void Server::start()
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
         
-        std::cout << "# Calling accept() - blocking until client connects..." << std::endl;
+        LOG_TRACE("# Calling accept() - blocking until client connects...");
         
         int client_socket = accept(server_socket_, (struct sockaddr *)&client_addr, &client_len);
 
         if (client_socket < 0)
         {
             if (running_)
-                std::cerr << "Failed to accept connection" << std::endl;
+                LOG_ERROR("Failed to accept connection");
             continue;
         }
 
@@ -92,636 +109,623 @@ void Server::start()
         char client_ip[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
         
-        std::cout << "# Client connected from " << client_ip 
-                  << ":" << ntohs(client_addr.sin_port) 
-                  << " (socket: " << client_socket << ")" << std::endl;
+        LOG_DEBUG("# Client connected from " << client_ip
+                  << ":" << ntohs(client_addr.sin_port)
+                  << " (socket: " << client_socket << ")");
+
+        if (mode_ != ServerMode::THREADED)
+        {
+            dispatchToLoop(client_socket);
+            continue;
+        }
 
         // Handle client in a new thread
         std::thread client_thread(&Server::handleClient, this, client_socket);
         client_thread.detach();  // Let it run independently
         
-        std::cout << "# Spawned thread for client, going back to accept()..." << std::endl;
+        LOG_TRACE("# Spawned thread for client, going back to accept()...");
     }
+
+    stopEventLoops();
 }
 
 void Server::handleClient(int client_socket)
 {
-    std::cout << "# [Thread " << std::this_thread::get_id() << "] Handling client on socket " << client_socket << std::endl;
+    LOG_DEBUG("# [Thread " << std::this_thread::get_id() << "] Handling client on socket " << client_socket);
     
-    char buffer[4096];
+    RESPDecoder decoder;
+    std::string response;
 
     while (running_)
     {
-        memset(buffer, 0, sizeof(buffer));
+        LOG_TRACE("# [Thread " << std::this_thread::get_id() << "] Waiting for data (recv)...");
         
-        std::cout << "# [Thread " << std::this_thread::get_id() << "] Waiting for data (recv)..." << std::endl;
-        
-        int bytes_read = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
+        int bytes_read = recv(client_socket, decoder.prepare(16384), 16384, 0);
 
         if (bytes_read <= 0)
         {
             if (bytes_read == 0)
-                std::cout << "# [Thread " << std::this_thread::get_id() << "] Client disconnected cleanly" << std::endl;
+                LOG_DEBUG("# [Thread " << std::this_thread::get_id() << "] Client disconnected cleanly");
             else
-                std::cout << "# [Thread " << std::this_thread::get_id() << "] recv() error: " << strerror(errno) << std::endl;
+                LOG_DEBUG("# [Thread " << std::this_thread::get_id() << "] recv() error: " << strerror(errno));
             break;
         }
 
-        std::cout << "# [Thread " << std::this_thread::get_id() << "] Received " << bytes_read << " bytes" << std::endl;
-        
-        std::string data(buffer, bytes_read);
-        
-        // Parse RESP command
-        std::vector<std::string> tokens = RESP::parse(data);
+        LOG_TRACE("# [Thread " << std::this_thread::get_id() << "] Received " << bytes_read << " bytes");
         
-        if (tokens.empty())
+        decoder.commit(bytes_read);
+
+        // Execute every complete command in the buffer and answer them with one send()
+        response.clear();
+        bool ok = processInput(decoder, response);
+
+        if (!response.empty())
         {
-            std::cout << "# [Thread " << std::this_thread::get_id() << "] Failed to parse RESP, sending error" << std::endl;
-            std::string response = RESP::encodeError("ERR invalid command format");
-            send(client_socket, response.c_str(), response.length(), 0);
-            continue;
+            LOG_TRACE("# [Thread " << std::this_thread::get_id() << "] Sending response (" << response.length() << " bytes)");
+            send(client_socket, response.c_str(), response.length(), MSG_NOSIGNAL);
         }
 
-        std::cout << "# [Thread " << std::this_thread::get_id() << "] Command: " << tokens[0];
-        if (tokens.size() > 1)
-            std::cout << " (with " << (tokens.size() - 1) << " arguments)";
-        std::cout << std::endl;
-
-        // Execute command
-        std::string response = executeCommand(tokens);
-        
-        std::cout << "# [Thread " << std::this_thread::get_id() << "] Sending response (" << response.length() << " bytes)" << std::endl;
-        
-        send(client_socket, response.c_str(), response.length(), 0);
+        if (!ok)
+            break;
     }
 
     close(client_socket);
-    std::cout << "# [Thread " << std::this_thread::get_id() << "] Socket closed, thread exiting" << std::endl;
+    LOG_DEBUG("# [Thread " << std::this_thread::get_id() << "] Socket closed, thread exiting");
 }
 
-std::string Server::executeCommand(const std::vector<std::string> &tokens)
+// Runs all complete commands buffered in the decoder, appending their replies
+// to `out`. Returns false on a protocol error; the caller should close the
+// connection after sending what is in `out`.
+bool Server::processInput(RESPDecoder &decoder, std::string &out)
 {
-    if (tokens.empty())
-        return RESP::encodeError("ERR empty command");
+    std::vector<std::string_view> tokens;
 
-    std::string cmd = tokens[0];
-    
-    // Convert to uppercase
-    for (char &c : cmd)
-        c = toupper(c);
+    while (true)
+    {
+        RESPDecoder::Status status = decoder.next(tokens);
+        if (status == RESPDecoder::Status::INCOMPLETE)
+            return true;
+        if (status == RESPDecoder::Status::ERROR)
+        {
+            out += RESP::encodeError(decoder.error());
+            return false;
+        }
 
-    std::cout << "# [executeCommand] Processing: " << cmd << std::endl;
+        LOG_TRACE("# Command: " << tokens[0] << " (with " << (tokens.size() - 1) << " arguments)");
+
+        out += executeCommand(tokens);
+    }
+}
 
-    // Handle PING command
-    if (cmd == "PING")
+std::string Server::executeCommand(const std::vector<std::string_view> &tokens)
+{
+    return dispatchCommand(db_, tokens);
+}
+
+void Server::stop()
+{
+    running_ = false;
+    if (server_socket_ >= 0)
     {
-        if (tokens.size() == 1)
-            return RESP::encodeSimpleString("PONG");
-        else
-            return RESP::encodeBulkString(tokens[1]);
+        LOG_INFO("# Closing server socket...");
+        // shutdown() wakes up a thread blocked in accept(), close() alone does not
+        shutdown(server_socket_, SHUT_RDWR);
+        close(server_socket_);
+        server_socket_ = -1;
     }
-    
-    // Handle ECHO command
-    else if (cmd == "ECHO" && tokens.size() >= 2)
+    for (auto &loop : loops_)
     {
-        return RESP::encodeBulkString(tokens[1]);
+        uint64_t one = 1;
+        if (loop->wake_fd >= 0)
+            (void)!write(loop->wake_fd, &one, sizeof(one));
     }
+}
+
+// ============== Epoll Reactor ==============
+
+static bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return false;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
 
-    // Handle SET command
-    else if (cmd == "SET" && tokens.size() >= 3)
+bool Server::startEventLoops()
+{
+    for (int i = 0; i < io_threads_; i++)
     {
-        // Join remaining tokens as value (for values with spaces)
-        std::string value;
-        for (size_t i = 2; i < tokens.size(); i++)
+        auto loop = std::make_unique<EventLoop>();
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epoll_fd < 0 || loop->wake_fd < 0)
         {
-            if (i > 2) value += " ";
-            value += tokens[i];
+            if (loop->epoll_fd >= 0) close(loop->epoll_fd);
+            if (loop->wake_fd >= 0) close(loop->wake_fd);
+            stopEventLoops();
+            return false;
         }
-        db_.set(tokens[1], value);
-        return RESP::encodeSimpleString("OK");
+
+        // The wake fd is level-triggered so a missed read is retried on the next wait
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev);
+
+        loops_.push_back(std::move(loop));
     }
 
-    // Handle GET command
-    else if (cmd == "GET" && tokens.size() >= 2)
+    if (mode_ == ServerMode::SHARDED)
     {
-        // We need to capture output - for now, use the db method and return appropriate RESP
-        // This is a workaround since db_.get() prints to stdout
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool found = db_.get(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (!found)
-            return RESP::encodeNullBulkString();
-        
-        std::string result = buffer.str();
-        // Remove trailing newline
-        if (!result.empty() && result.back() == '\n')
-            result.pop_back();
-        
-        return RESP::encodeBulkString(result);
+        // One request and one reply queue for every ordered pair of cores
+        size_t cores = loops_.size();
+        for (size_t i = 0; i < cores; i++)
+        {
+            EventLoop &loop = *loops_[i];
+            loop.index = i;
+            loop.requests_in.resize(cores);
+            loop.replies_in.resize(cores);
+            loop.requests_overflow.resize(cores);
+            loop.replies_overflow.resize(cores);
+            loop.notify.assign(cores, false);
+            for (size_t peer = 0; peer < cores; peer++)
+            {
+                if (peer == i)
+                    continue;
+                loop.requests_in[peer] = std::make_unique<SpscQueue<ShardRequest>>();
+                loop.replies_in[peer] = std::make_unique<SpscQueue<ShardReply>>();
+            }
+        }
     }
 
-    // Handle DEL command
-    else if (cmd == "DEL" && tokens.size() >= 2)
+    for (auto &loop : loops_)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool deleted = db_.del(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        return RESP::encodeInteger(deleted ? 1 : 0);
+        EventLoop *raw = loop.get();
+        loop->thread = std::thread([this, raw]() { runEventLoop(*raw); });
     }
 
-    // Handle EXISTS command
-    else if (cmd == "EXISTS" && tokens.size() >= 2)
+    if (mode_ == ServerMode::SHARDED)
+        LOG_INFO("# Started " << loops_.size() << " shard-per-core event loop(s)");
+    else
+        LOG_INFO("# Started " << loops_.size() << " epoll event loop(s)");
+    return true;
+}
+
+void Server::stopEventLoops()
+{
+    for (auto &loop : loops_)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool exists = db_.exists(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        return RESP::encodeInteger(exists ? 1 : 0);
+        uint64_t one = 1;
+        (void)!write(loop->wake_fd, &one, sizeof(one));
+    }
+    for (auto &loop : loops_)
+    {
+        if (loop->thread.joinable())
+            loop->thread.join();
+        for (auto &entry : loop->connections)
+            close(entry.first);
+        loop->connections.clear();
+        for (int fd : loop->pending)
+            close(fd);
+        loop->pending.clear();
+        close(loop->epoll_fd);
+        close(loop->wake_fd);
     }
+    loops_.clear();
+}
 
-    // Handle INCR command
-    else if (cmd == "INCR" && tokens.size() >= 2)
+void Server::dispatchToLoop(int client_socket)
+{
+    static std::atomic<size_t> next_loop{0};
+
+    if (!setNonBlocking(client_socket))
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        db_.incr(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        std::string result = buffer.str();
-        // Parse the integer from "(integer) N"
-        size_t pos = result.find(") ");
-        if (pos != std::string::npos)
-        {
-            std::string numStr = result.substr(pos + 2);
-            if (!numStr.empty() && numStr.back() == '\n')
-                numStr.pop_back();
-            try {
-                return RESP::encodeInteger(std::stoll(numStr));
-            } catch (...) {
-                return RESP::encodeError("ERR value is not an integer");
-            }
-        }
-        return RESP::encodeError("ERR WRONGTYPE");
+        LOG_ERROR("Failed to make socket " << client_socket << " non-blocking");
+        close(client_socket);
+        return;
     }
 
-    // Handle INCRBY command
-    else if (cmd == "INCRBY" && tokens.size() >= 3)
+    // Round-robin the new connection across the loops
+    EventLoop &loop = *loops_[next_loop++ % loops_.size()];
     {
-        long long amount = std::stoll(tokens[2]);
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        db_.incrby(tokens[1], amount);
-        std::cout.rdbuf(old);
-        
-        std::string result = buffer.str();
-        size_t pos = result.find(") ");
-        if (pos != std::string::npos)
-        {
-            std::string numStr = result.substr(pos + 2);
-            if (!numStr.empty() && numStr.back() == '\n')
-                numStr.pop_back();
-            try {
-                return RESP::encodeInteger(std::stoll(numStr));
-            } catch (...) {
-                return RESP::encodeError("ERR value is not an integer");
-            }
-        }
-        return RESP::encodeError("ERR WRONGTYPE");
+        std::lock_guard<std::mutex> lock(loop.pending_mutex);
+        loop.pending.push_back(client_socket);
     }
+    uint64_t one = 1;
+    (void)!write(loop.wake_fd, &one, sizeof(one));
+}
+
+void Server::runEventLoop(EventLoop &loop)
+{
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+    int timeout = -1;
 
-    // Handle DECR command
-    else if (cmd == "DECR" && tokens.size() >= 2)
+    while (running_)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        db_.decr(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        std::string result = buffer.str();
-        size_t pos = result.find(") ");
-        if (pos != std::string::npos)
+        int n = epoll_wait(loop.epoll_fd, events, MAX_EVENTS, timeout);
+        if (n < 0)
         {
-            std::string numStr = result.substr(pos + 2);
-            if (!numStr.empty() && numStr.back() == '\n')
-                numStr.pop_back();
-            try {
-                return RESP::encodeInteger(std::stoll(numStr));
-            } catch (...) {
-                return RESP::encodeError("ERR value is not an integer");
-            }
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("epoll_wait() failed: " << strerror(errno));
+            break;
         }
-        return RESP::encodeError("ERR WRONGTYPE");
-    }
 
-    // Handle DECRBY command
-    else if (cmd == "DECRBY" && tokens.size() >= 3)
-    {
-        long long amount = std::stoll(tokens[2]);
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        db_.decrby(tokens[1], amount);
-        std::cout.rdbuf(old);
-        
-        std::string result = buffer.str();
-        size_t pos = result.find(") ");
-        if (pos != std::string::npos)
+        for (int i = 0; i < n; i++)
         {
-            std::string numStr = result.substr(pos + 2);
-            if (!numStr.empty() && numStr.back() == '\n')
-                numStr.pop_back();
-            try {
-                return RESP::encodeInteger(std::stoll(numStr));
-            } catch (...) {
-                return RESP::encodeError("ERR value is not an integer");
+            Connection *conn = static_cast<Connection *>(events[i].data.ptr);
+
+            if (conn == nullptr)
+            {
+                // Drain the eventfd counter, then register any handed-over sockets
+                uint64_t value;
+                while (read(loop.wake_fd, &value, sizeof(value)) > 0)
+                {
+                }
+
+                std::vector<int> accepted;
+                {
+                    std::lock_guard<std::mutex> lock(loop.pending_mutex);
+                    accepted.swap(loop.pending);
+                }
+
+                for (int fd : accepted)
+                {
+                    auto owned = std::make_unique<Connection>(fd);
+                    owned->id = ++loop.next_conn_id;
+                    struct epoll_event ev;
+                    // EPOLLOUT is edge-triggered too, so it only fires when the socket
+                    // becomes writable again after a short write
+                    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    ev.data.ptr = owned.get();
+                    if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+                    {
+                        LOG_ERROR("epoll_ctl() failed for socket " << fd);
+                        close(fd);
+                        continue;
+                    }
+                    loop.connections[fd] = std::move(owned);
+                }
+
+                if (mode_ == ServerMode::SHARDED)
+                    drainInboxes(loop);
+                continue;
             }
+
+            uint32_t flags = events[i].events;
+            bool alive = true;
+
+            if (flags & (EPOLLERR | EPOLLHUP))
+                alive = false;
+
+            if (alive && (flags & (EPOLLIN | EPOLLRDHUP)))
+                alive = readFromConnection(loop, *conn);
+
+            if (alive && !conn->write_buf.empty())
+                alive = flushConnection(*conn);
+
+            if (!alive)
+                closeConnection(loop, conn);
         }
-        return RESP::encodeError("ERR WRONGTYPE");
-    }
 
-    // Handle EXPIRE command
-    else if (cmd == "EXPIRE" && tokens.size() >= 3)
-    {
-        long long seconds = std::stoll(tokens[2]);
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool success = db_.expire(tokens[1], seconds);
-        std::cout.rdbuf(old);
-        
-        return RESP::encodeInteger(success ? 1 : 0);
+        if (mode_ == ServerMode::SHARDED)
+        {
+            // Wake peers once per batch rather than once per forwarded command.
+            // If a peer's queue filled up, poll again shortly to retry.
+            timeout = flushOverflow(loop) ? 1 : -1;
+            notifyPeers(loop);
+        }
     }
+}
 
-    // Handle TTL command
-    else if (cmd == "TTL" && tokens.size() >= 2)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long ttl = db_.ttl(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        return RESP::encodeInteger(ttl);
-    }
+// Reads everything the socket has (edge-triggered: until EAGAIN), executes every
+// complete command received and queues the replies. Returns false once the peer
+// is gone or sent a malformed frame.
+bool Server::readFromConnection(EventLoop &loop, Connection &conn)
+{
+    const size_t READ_CHUNK = 16384;
+    bool closing = false;
 
-    // Handle PERSIST command
-    else if (cmd == "PERSIST" && tokens.size() >= 2)
+    while (!closing)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool success = db_.persist(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        return RESP::encodeInteger(success ? 1 : 0);
+        ssize_t bytes_read = recv(conn.fd, conn.decoder.prepare(READ_CHUNK), READ_CHUNK, 0);
+        if (bytes_read > 0)
+        {
+            conn.decoder.commit(bytes_read);
+            bool ok = mode_ == ServerMode::SHARDED ? processSharded(loop, conn)
+                                                   : processInput(conn.decoder, conn.write_buf);
+            if (!ok)
+                closing = true;
+            continue;
+        }
+        if (bytes_read == 0)
+        {
+            closing = true;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        return false;
     }
 
-    // Handle TYPE command
-    else if (cmd == "TYPE" && tokens.size() >= 2)
+    if (closing)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        std::string type = db_.type(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        return RESP::encodeSimpleString(type);
+        // Best effort to deliver the last replies before closing
+        flushConnection(conn);
+        return false;
     }
+    return true;
+}
 
-    // Handle APPEND command
-    else if (cmd == "APPEND" && tokens.size() >= 3)
+// Sends as much of write_buf as the socket accepts. Returns false on a fatal error.
+bool Server::flushConnection(Connection &conn)
+{
+    while (conn.write_pos < conn.write_buf.size())
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long newLen = db_.append(tokens[1], tokens[2]);
-        std::cout.rdbuf(old);
-        
-        return RESP::encodeInteger(newLen);
+        ssize_t sent = send(conn.fd, conn.write_buf.data() + conn.write_pos,
+                            conn.write_buf.size() - conn.write_pos, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            conn.write_pos += sent;
+            continue;
+        }
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;    // Wait for the next EPOLLOUT edge
+        return false;
     }
 
-    // Handle STRLEN command
-    else if (cmd == "STRLEN" && tokens.size() >= 2)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long len = db_.strlen(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        return RESP::encodeInteger(len);
-    }
+    conn.write_buf.clear();
+    conn.write_pos = 0;
+    return true;
+}
 
-    // ============== List Commands ==============
-    
-    // Handle LPUSH command
-    else if (cmd == "LPUSH" && tokens.size() >= 3)
-    {
-        std::vector<std::string> values(tokens.begin() + 2, tokens.end());
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long len = db_.lpush(tokens[1], values);
-        std::cout.rdbuf(old);
-        
-        if (len < 0) return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(len);
-    }
+void Server::closeConnection(EventLoop &loop, Connection *conn)
+{
+    int fd = conn->fd;
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    loop.connections.erase(fd);     // Destroys conn
+}
 
-    // Handle RPUSH command
-    else if (cmd == "RPUSH" && tokens.size() >= 3)
-    {
-        std::vector<std::string> values(tokens.begin() + 2, tokens.end());
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long len = db_.rpush(tokens[1], values);
-        std::cout.rdbuf(old);
-        
-        if (len < 0) return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(len);
-    }
+// ============== Shard-per-core ==============
+//
+// Every core runs one event loop and owns the keys whose Db shard maps to it.
+// A connection's commands are parsed on the core that accepted it; commands
+// whose keys belong to another core are copied into that core's SPSC request
+// queue, and the reply comes back through the matching reply queue. Replies
+// are slotted into Connection::replies by sequence number, so the client sees
+// them in request order no matter which core answered first.
+
+// Core owning all keys of the command, or -1 when the command has no keys or
+// its keys live on different cores. Such commands run on the local core (the
+// Db is still thread-safe); `barrier` is set when they may observe keys, so
+// they must wait until the connection's earlier commands have completed.
+int Server::commandOwner(const std::vector<std::string_view> &tokens, bool &barrier) const
+{
+    barrier = false;
 
-    // Handle LPOP command
-    else if (cmd == "LPOP" && tokens.size() >= 2)
+    const CommandSpec *spec = lookupCommand(tokens[0]);
+    if (spec == nullptr || spec->first_key == 0 || tokens.size() <= static_cast<size_t>(spec->first_key))
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        std::string result = db_.lpop(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (result.empty() && buffer.str().find("nil") != std::string::npos)
-            return RESP::encodeNullBulkString();
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeBulkString(result);
+        barrier = spec != nullptr && (spec->flags & CMD_ADMIN);
+        return -1;
     }
 
-    // Handle RPOP command
-    else if (cmd == "RPOP" && tokens.size() >= 2)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        std::string result = db_.rpop(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (result.empty() && buffer.str().find("nil") != std::string::npos)
-            return RESP::encodeNullBulkString();
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeBulkString(result);
-    }
+    size_t last = spec->last_key < 0 ? tokens.size() + spec->last_key : spec->last_key;
+    int owner = -1;
 
-    // Handle LLEN command
-    else if (cmd == "LLEN" && tokens.size() >= 2)
+    for (size_t i = spec->first_key; i <= last && i < tokens.size(); i += spec->key_step)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long len = db_.llen(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (len < 0) return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(len);
+        int core = static_cast<int>(db_.shardIndex(tokens[i]) % loops_.size());
+        if (owner < 0)
+        {
+            owner = core;
+        }
+        else if (owner != core)
+        {
+            barrier = true;
+            return -1;
+        }
     }
+    return owner;
+}
 
-    // Handle LRANGE command
-    else if (cmd == "LRANGE" && tokens.size() >= 4)
-    {
-        long long start = std::stoll(tokens[2]);
-        long long stop = std::stoll(tokens[3]);
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        std::vector<std::string> result = db_.lrange(tokens[1], start, stop);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeArray(result);
-    }
+// SHARDED counterpart of processInput(). Returns false when the connection
+// should be closed now; after a protocol error it instead sets `closing` and
+// waits for outstanding replies.
+bool Server::processSharded(EventLoop &loop, Connection &conn)
+{
+    std::vector<std::string_view> tokens;
 
-    // Handle LINDEX command
-    else if (cmd == "LINDEX" && tokens.size() >= 3)
+    if (!conn.deferred.empty())
     {
-        long long index = std::stoll(tokens[2]);
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        std::string result = db_.lindex(tokens[1], index);
-        std::cout.rdbuf(old);
-        
-        if (result.empty() && buffer.str().find("nil") != std::string::npos)
-            return RESP::encodeNullBulkString();
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeBulkString(result);
+        if (!conn.replies.empty())
+            return true;
+
+        tokens.assign(conn.deferred.begin(), conn.deferred.end());
+        queueReply(conn, dispatchCommand(db_, tokens));
+        conn.deferred.clear();
     }
 
-    // Handle LSET command
-    else if (cmd == "LSET" && tokens.size() >= 4)
+    while (!conn.closing)
     {
-        long long index = std::stoll(tokens[2]);
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool success = db_.lset(tokens[1], index, tokens[3]);
-        std::cout.rdbuf(old);
-        
-        if (!success)
+        RESPDecoder::Status status = conn.decoder.next(tokens);
+        if (status == RESPDecoder::Status::INCOMPLETE)
+            break;
+        if (status == RESPDecoder::Status::ERROR)
         {
-            if (buffer.str().find("WRONGTYPE") != std::string::npos)
-                return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-            if (buffer.str().find("no such key") != std::string::npos)
-                return RESP::encodeError("ERR no such key");
-            return RESP::encodeError("ERR index out of range");
+            queueReply(conn, RESP::encodeError(conn.decoder.error()));
+            conn.closing = true;
+            break;
         }
-        return RESP::encodeSimpleString("OK");
-    }
 
-    // ============== Set Commands ==============
-    
-    // Handle SADD command
-    else if (cmd == "SADD" && tokens.size() >= 3)
-    {
-        std::vector<std::string> members(tokens.begin() + 2, tokens.end());
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long added = db_.sadd(tokens[1], members);
-        std::cout.rdbuf(old);
-        
-        if (added < 0) return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(added);
-    }
+        LOG_TRACE("# Command: " << tokens[0] << " (with " << (tokens.size() - 1) << " arguments)");
 
-    // Handle SREM command
-    else if (cmd == "SREM" && tokens.size() >= 3)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long removed = db_.srem(tokens[1], tokens[2]);
-        std::cout.rdbuf(old);
-        
-        if (removed < 0) return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(removed);
-    }
+        bool barrier;
+        int owner = commandOwner(tokens, barrier);
 
-    // Handle SMEMBERS command
-    else if (cmd == "SMEMBERS" && tokens.size() >= 2)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        std::vector<std::string> members = db_.smembers(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeArray(members);
-    }
+        if (owner >= 0 && static_cast<size_t>(owner) != loop.index)
+        {
+            ShardRequest request;
+            request.fd = conn.fd;
+            request.conn_id = conn.id;
+            request.seq = conn.first_seq + conn.replies.size();
+            request.args.assign(tokens.begin(), tokens.end());
+            conn.replies.emplace_back(false, std::string());
+            forwardRequest(loop, owner, std::move(request));
+            continue;
+        }
 
-    // Handle SISMEMBER command
-    else if (cmd == "SISMEMBER" && tokens.size() >= 3)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool exists = db_.sismember(tokens[1], tokens[2]);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(exists ? 1 : 0);
-    }
+        if (barrier && !conn.replies.empty())
+        {
+            // Stop parsing; the rest stays in the decoder until this command ran
+            conn.deferred.assign(tokens.begin(), tokens.end());
+            break;
+        }
 
-    // Handle SCARD command
-    else if (cmd == "SCARD" && tokens.size() >= 2)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long size = db_.scard(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (size < 0) return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(size);
+        queueReply(conn, dispatchCommand(db_, tokens));
     }
 
-    // ============== Hash Commands ==============
-    
-    // Handle HSET command
-    else if (cmd == "HSET" && tokens.size() >= 4)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool isNew = db_.hset(tokens[1], tokens[2], tokens[3]);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        // Parse isNew from buffer output "(integer) N"
-        return RESP::encodeInteger(buffer.str().find("1") != std::string::npos ? 1 : 0);
-    }
+    return !(conn.closing && conn.replies.empty());
+}
 
-    // Handle HGET command
-    else if (cmd == "HGET" && tokens.size() >= 3)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        std::string result = db_.hget(tokens[1], tokens[2]);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("nil") != std::string::npos)
-            return RESP::encodeNullBulkString();
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeBulkString(result);
-    }
+// Appends a locally computed reply behind any that are still outstanding
+void Server::queueReply(Connection &conn, std::string reply)
+{
+    if (conn.replies.empty())
+        conn.write_buf += reply;
+    else
+        conn.replies.emplace_back(true, std::move(reply));
+}
+
+// Fills in a forwarded command's reply and releases every reply that is now
+// complete at the head of the queue
+void Server::completeReply(Connection &conn, uint64_t seq, std::string reply)
+{
+    size_t slot = seq - conn.first_seq;
+    if (slot >= conn.replies.size())
+        return;
+
+    conn.replies[slot].first = true;
+    conn.replies[slot].second = std::move(reply);
 
-    // Handle HDEL command
-    else if (cmd == "HDEL" && tokens.size() >= 3)
+    while (!conn.replies.empty() && conn.replies.front().first)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool deleted = db_.hdel(tokens[1], tokens[2]);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(deleted ? 1 : 0);
+        conn.write_buf += conn.replies.front().second;
+        conn.replies.pop_front();
+        conn.first_seq++;
     }
+}
+
+void Server::forwardRequest(EventLoop &loop, size_t owner, ShardRequest request)
+{
+    std::deque<ShardRequest> &overflow = loop.requests_overflow[owner];
+    if (!overflow.empty() || !loops_[owner]->requests_in[loop.index]->tryPush(request))
+        overflow.push_back(std::move(request));
+    loop.notify[owner] = true;
+}
+
+void Server::sendReply(EventLoop &loop, size_t origin, ShardReply reply)
+{
+    std::deque<ShardReply> &overflow = loop.replies_overflow[origin];
+    if (!overflow.empty() || !loops_[origin]->replies_in[loop.index]->tryPush(reply))
+        overflow.push_back(std::move(reply));
+    loop.notify[origin] = true;
+}
+
+// Executes requests forwarded by peers and delivers the replies they sent back
+void Server::drainInboxes(EventLoop &loop)
+{
+    std::vector<int> touched;
+    std::vector<std::string_view> tokens;
+    ShardRequest request;
+    ShardReply reply;
 
-    // Handle HGETALL command
-    else if (cmd == "HGETALL" && tokens.size() >= 2)
+    for (size_t peer = 0; peer < loops_.size(); peer++)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        auto pairs = db_.hgetall(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        
-        // Flatten pairs into array
-        std::vector<std::string> result;
-        for (const auto& p : pairs)
+        if (peer == loop.index)
+            continue;
+
+        SpscQueue<ShardRequest> &requests = *loop.requests_in[peer];
+        while (requests.tryPop(request))
         {
-            result.push_back(p.first);
-            result.push_back(p.second);
+            tokens.assign(request.args.begin(), request.args.end());
+
+            ShardReply answer;
+            answer.fd = request.fd;
+            answer.conn_id = request.conn_id;
+            answer.seq = request.seq;
+            answer.data = dispatchCommand(db_, tokens);
+            sendReply(loop, peer, std::move(answer));
         }
-        return RESP::encodeArray(result);
-    }
 
-    // Handle HKEYS command
-    else if (cmd == "HKEYS" && tokens.size() >= 2)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        std::vector<std::string> keys = db_.hkeys(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeArray(keys);
+        SpscQueue<ShardReply> &replies = *loop.replies_in[peer];
+        while (replies.tryPop(reply))
+        {
+            auto it = loop.connections.find(reply.fd);
+            if (it == loop.connections.end() || it->second->id != reply.conn_id)
+                continue;   // Client went away meanwhile
+            completeReply(*it->second, reply.seq, std::move(reply.data));
+            touched.push_back(reply.fd);
+        }
     }
 
-    // Handle HVALS command
-    else if (cmd == "HVALS" && tokens.size() >= 2)
-    {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        std::vector<std::string> vals = db_.hvals(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeArray(vals);
-    }
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
 
-    // Handle HLEN command
-    else if (cmd == "HLEN" && tokens.size() >= 2)
+    for (int fd : touched)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        long long len = db_.hlen(tokens[1]);
-        std::cout.rdbuf(old);
-        
-        if (len < 0) return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(len);
+        Connection *conn = loop.connections[fd].get();
+
+        // Run a deferred command if its turn has come, then send what is ready
+        bool alive = processSharded(loop, *conn);
+        if (!conn->write_buf.empty() && !flushConnection(*conn))
+            alive = false;
+        if (!alive)
+            closeConnection(loop, conn);
     }
+}
 
-    // Handle HEXISTS command
-    else if (cmd == "HEXISTS" && tokens.size() >= 3)
+// Retries queue pushes that found a peer's queue full. Returns true while
+// some are still waiting.
+bool Server::flushOverflow(EventLoop &loop)
+{
+    bool backlog = false;
+
+    for (size_t peer = 0; peer < loops_.size(); peer++)
     {
-        std::stringstream buffer;
-        std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
-        bool exists = db_.hexists(tokens[1], tokens[2]);
-        std::cout.rdbuf(old);
-        
-        if (buffer.str().find("WRONGTYPE") != std::string::npos)
-            return RESP::encodeError("WRONGTYPE Operation against a key holding the wrong kind of value");
-        return RESP::encodeInteger(exists ? 1 : 0);
-    }
+        std::deque<ShardRequest> &requests = loop.requests_overflow[peer];
+        while (!requests.empty() && loops_[peer]->requests_in[loop.index]->tryPush(requests.front()))
+        {
+            requests.pop_front();
+            loop.notify[peer] = true;
+        }
 
-    return RESP::encodeError("ERR unknown command '" + tokens[0] + "'");
+        std::deque<ShardReply> &replies = loop.replies_overflow[peer];
+        while (!replies.empty() && loops_[peer]->replies_in[loop.index]->tryPush(replies.front()))
+        {
+            replies.pop_front();
+            loop.notify[peer] = true;
+        }
+
+        backlog |= !requests.empty() || !replies.empty();
+    }
+    return backlog;
 }
 
-void Server::stop()
+void Server::notifyPeers(EventLoop &loop)
 {
-    running_ = false;
-    if (server_socket_ >= 0)
+    for (size_t peer = 0; peer < loops_.size(); peer++)
     {
-        std::cout << "# Closing server socket..." << std::endl;
-        close(server_socket_);
-        server_socket_ = -1;
+        if (!loop.notify[peer])
+            continue;
+        loop.notify[peer] = false;
+        uint64_t one = 1;
+        (void)!write(loops_[peer]->wake_fd, &one, sizeof(one));
     }
-}
\ No newline at end of file
+}
@@ -2,9 +2,81 @@
 #define SERVER_H
 
 #include "db.h"
+#include "resp.h"
+#include "spsc_queue.h"
+#include <deque>
 #include <string>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+// How client connections are served
+enum class ServerMode
+{
+    THREADED,   // One detached thread per connection, blocking recv/send
+    EPOLL,      // Fixed pool of edge-triggered epoll event loops
+    SHARDED     // One event loop per core, each owning one keyspace partition
+};
+
+// SHARDED mode: a command forwarded to the core that owns its keys
+struct ShardRequest
+{
+    int fd = -1;
+    uint64_t conn_id = 0;               // Guards against the fd being reused
+    uint64_t seq = 0;                   // Position of the reply on the connection
+    std::vector<std::string> args;
+};
+
+// SHARDED mode: the owning core's reply, sent back to the connection's core
+struct ShardReply
+{
+    int fd = -1;
+    uint64_t conn_id = 0;
+    uint64_t seq = 0;
+    std::string data;
+};
+
+// Per-connection state for the epoll reactor
+struct Connection
+{
+    int fd;
+    RESPDecoder decoder;    // Bytes received but not yet executed
+    std::string write_buf;  // Encoded replies not yet sent
+    size_t write_pos;       // How much of write_buf has been sent
+
+    // SHARDED mode only. Replies not yet moved to write_buf, in request order;
+    // entries for forwarded commands stay empty until the owner answers.
+    uint64_t id = 0;
+    uint64_t first_seq = 0;                         // seq of replies.front()
+    std::deque<std::pair<bool, std::string>> replies; // (ready, data)
+    std::vector<std::string> deferred;              // Command waiting for replies to drain
+    bool closing = false;                           // Close once replies are sent
+
+    explicit Connection(int socket) : fd(socket), write_pos(0) {}
+};
+
+// One epoll instance driven by one thread
+struct EventLoop
+{
+    int epoll_fd = -1;
+    int wake_fd = -1;                       // eventfd used to hand over sockets / stop
+    std::thread thread;
+    std::mutex pending_mutex;
+    std::vector<int> pending;               // Accepted sockets waiting to be registered
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+
+    // SHARDED mode only, indexed by the peer core
+    size_t index = 0;
+    uint64_t next_conn_id = 0;
+    std::vector<std::unique_ptr<SpscQueue<ShardRequest>>> requests_in;   // Peer -> this core
+    std::vector<std::unique_ptr<SpscQueue<ShardReply>>> replies_in;      // Peer -> this core
+    std::vector<std::deque<ShardRequest>> requests_overflow;            // Peer's queue was full
+    std::vector<std::deque<ShardReply>> replies_overflow;
+    std::vector<bool> notify;                                           // Peer needs a wake-up
+};
 
 class Server
 {
@@ -15,15 +87,40 @@ private:
     int port_;
     std::atomic<bool> running_;
 
+    ServerMode mode_;
+    int io_threads_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+
     void handleClient(int client_socket);
-    std::string executeCommand(const std::vector<std::string> &tokens);
+    bool processInput(RESPDecoder &decoder, std::string &out);
+    std::string executeCommand(const std::vector<std::string_view> &tokens);
+
+    // ============== Epoll Reactor ==============
+    bool startEventLoops();
+    void stopEventLoops();
+    void dispatchToLoop(int client_socket);
+    void runEventLoop(EventLoop &loop);
+    bool readFromConnection(EventLoop &loop, Connection &conn);
+    bool flushConnection(Connection &conn);
+    void closeConnection(EventLoop &loop, Connection *conn);
+
+    // ============== Shard-per-core ==============
+    int commandOwner(const std::vector<std::string_view> &tokens, bool &barrier) const;
+    bool processSharded(EventLoop &loop, Connection &conn);
+    void queueReply(Connection &conn, std::string reply);
+    void completeReply(Connection &conn, uint64_t seq, std::string reply);
+    void forwardRequest(EventLoop &loop, size_t owner, ShardRequest request);
+    void sendReply(EventLoop &loop, size_t origin, ShardReply reply);
+    void drainInboxes(EventLoop &loop);
+    bool flushOverflow(EventLoop &loop);
+    void notifyPeers(EventLoop &loop);
 
 public:
-    Server(Db &db, int port = 6379);
+    Server(Db &db, int port = 6379, ServerMode mode = ServerMode::THREADED, int io_threads = 4);
     ~Server();
 
     void start();
     void stop();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,71 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Capacity is rounded up to a power of two. The producer only writes
+// tail_ and the consumer only writes head_; each side keeps a cached copy of
+// the other's index so the shared cache lines are touched only when the queue
+// looks full (producer) or empty (consumer).
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity = 4096)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask_ = size - 1;
+        slots_.reset(new T[size]);
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Producer side. Returns false (leaving item untouched) when full.
+    bool tryPush(T &item)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_)
+                return false;
+        }
+        slots_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false when empty.
+    bool tryPop(T &out)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_)
+                return false;
+        }
+        out = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::unique_ptr<T[]> slots_;
+    size_t mask_;
+
+    alignas(64) std::atomic<size_t> head_{0};   // Next slot to pop, written by the consumer
+    size_t tail_cache_ = 0;                     // Consumer's view of tail_
+
+    alignas(64) std::atomic<size_t> tail_{0};   // Next slot to push, written by the producer
+    size_t head_cache_ = 0;                     // Producer's view of head_
+};
+
+#endif
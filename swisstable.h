@@ -0,0 +1,547 @@
+#ifndef SWISSTABLE_H
+#define SWISSTABLE_H
+
+#include "hash.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Open-addressing hash table from strings to T in the style of Abseil's
+// Swiss tables, for the keyspace. Entries live inline in one array of
+// slots, each with its key's full hash, next to an array of one control
+// byte per slot: empty, deleted, or full with 7 bits of the hash. Lookups
+// compare 16 control bytes at once (one SSE2 compare where the target has
+// it) and only look at slots whose byte matches, so a miss rarely touches a
+// slot, and a hit usually touches one.
+//
+// Resizing is incremental, as in Dict: a second table is allocated and
+// entries move over a group of 16 slots at a time, one group per insert,
+// erase or non-const find, plus whatever rehashStep() is given from the
+// cron thread.
+//
+// Unlike Dict, entries move. Iterators and references are invalidated by
+// any insert, erase, non-const find or rehashStep(); take them afresh
+// after one. first must never be modified through an iterator.
+template <typename T>
+class SwissTable
+{
+    struct Slot;
+    struct Table;
+
+public:
+    using value_type = std::pair<std::string, T>;
+
+    template <bool Const>
+    class Iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = SwissTable::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type *, value_type *>;
+        using reference = std::conditional_t<Const, const value_type &, value_type &>;
+
+        Iterator() = default;
+        // iterator converts to const_iterator
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        Iterator(const Iterator<false> &other)
+            : table_(other.table_), tables_(other.tables_), index_(other.index_), slot_(other.slot_)
+        {
+        }
+
+        reference operator*() const { return slot_->entry; }
+        pointer operator->() const { return &slot_->entry; }
+
+        Iterator &operator++()
+        {
+            index_++;
+            settle();
+            return *this;
+        }
+
+        template <bool C>
+        bool operator==(const Iterator<C> &other) const { return slot_ == other.slot_; }
+        template <bool C>
+        bool operator!=(const Iterator<C> &other) const { return slot_ != other.slot_; }
+
+    private:
+        friend class SwissTable;
+        friend class Iterator<!Const>;
+
+        int table_ = 2;
+        const Table *tables_ = nullptr;
+        size_t index_ = 0;
+        Slot *slot_ = nullptr;
+
+        Iterator(const Table *tables, int table, size_t index)
+            : table_(table), tables_(tables), index_(index), slot_(tables[table].slots + index)
+        {
+        }
+
+        // Moves to the first full slot at or after index_, or to the end
+        void settle()
+        {
+            for (; table_ < 2; table_++, index_ = 0)
+            {
+                const Table &table = tables_[table_];
+                for (; index_ < table.capacity; index_++)
+                {
+                    if (table.ctrl[index_] & FULL)
+                    {
+                        slot_ = table.slots + index_;
+                        return;
+                    }
+                }
+            }
+            slot_ = nullptr;
+        }
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    SwissTable() = default;
+    SwissTable(const SwissTable &) = delete;
+    SwissTable &operator=(const SwissTable &) = delete;
+    ~SwissTable() { clear(); }
+
+    size_t size() const { return tables_[0].used + tables_[1].used; }
+    bool empty() const { return size() == 0; }
+    bool rehashing() const { return tables_[1].ctrl != nullptr; }
+
+    iterator begin()
+    {
+        iterator it;
+        it.tables_ = tables_;
+        it.table_ = 0;
+        it.settle();
+        return it;
+    }
+    iterator end() { return iterator(); }
+    const_iterator begin() const
+    {
+        const_iterator it;
+        it.tables_ = tables_;
+        it.table_ = 0;
+        it.settle();
+        return it;
+    }
+    const_iterator end() const { return const_iterator(); }
+
+    iterator find(std::string_view key)
+    {
+        rehashStep(1);
+        int table;
+        size_t index;
+        if (!locate(key, hashString(key), table, index))
+            return end();
+        return iterator(tables_, table, index);
+    }
+
+    const_iterator find(std::string_view key) const
+    {
+        int table;
+        size_t index;
+        if (!locate(key, hashString(key), table, index))
+            return end();
+        return const_iterator(tables_, table, index);
+    }
+
+    size_t count(std::string_view key) const { return find(key) != end() ? 1 : 0; }
+
+    // First entry whose key's hashString() is hash and for which
+    // pred(entry) holds, or end(); for callers that kept a hash rather than
+    // the key. Several keys may share a hash.
+    template <typename Pred>
+    iterator findHash(size_t hash, Pred &&pred)
+    {
+        int table;
+        size_t index;
+        if (!locateIf(hash, pred, table, index))
+            return end();
+        return iterator(tables_, table, index);
+    }
+
+    // Inserts key with T(args...) unless it is already there. key may be a
+    // std::string rvalue, which is moved in.
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&...args)
+    {
+        rehashStep(1);
+        std::string_view view(key);
+        size_t hash = hashString(view);
+        int table;
+        size_t index;
+        if (locate(view, hash, table, index))
+            return {iterator(tables_, table, index), false};
+
+        table = prepareInsert();
+        Table &target = tables_[table];
+        index = claim(target, hash);
+        new (&target.slots[index]) Slot(hash, std::forward<K>(key), std::forward<Args>(args)...);
+        return {iterator(tables_, table, index), true};
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> emplace(K &&key, Args &&...args)
+    {
+        return try_emplace(std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    template <typename K, typename M>
+    std::pair<iterator, bool> insert_or_assign(K &&key, M &&mapped)
+    {
+        auto result = try_emplace(std::forward<K>(key), std::forward<M>(mapped));
+        if (!result.second)
+            result.first->second = std::forward<M>(mapped);
+        return result;
+    }
+
+    template <typename K>
+    T &operator[](K &&key)
+    {
+        return try_emplace(std::forward<K>(key)).first->second;
+    }
+
+    size_t erase(std::string_view key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    void erase(iterator it)
+    {
+        Table &table = tables_[it.table_];
+        size_t index = it.index_;
+        table.slots[index].~Slot();
+        table.used--;
+
+        // A group that still has an empty slot never made a probe move on
+        // to the next group, so the slot can be empty again; otherwise it
+        // must stay a tombstone for the probes that passed through
+        if (match(table.ctrl + (index & ~(GROUP - 1)), EMPTY) != 0)
+        {
+            table.ctrl[index] = EMPTY;
+            table.growth_left++;
+        }
+        else
+        {
+            table.ctrl[index] = DELETED;
+        }
+        shrinkIfSparse();
+    }
+
+    void clear()
+    {
+        for (Table &table : tables_)
+            release(table);
+        migrate_group_ = 0;
+    }
+
+    // Sizes the table for n entries in one go, finishing any rehash first.
+    // For bulk loads, where a pause is expected.
+    void reserve(size_t n)
+    {
+        finishRehash();
+        size_t capacity = capacityFor(n);
+        if (capacity <= tables_[0].capacity)
+            return;
+        startResize(capacity);
+        finishRehash();
+    }
+
+    // Moves up to n groups into the new table, looking at no more than
+    // 10 * n empty ones; returns whether a rehash is still in progress
+    bool rehashStep(size_t n)
+    {
+        if (!rehashing())
+            return false;
+
+        Table &from = tables_[0];
+        Table &to = tables_[1];
+        size_t groups = from.capacity / GROUP;
+        size_t empty_visits = n * 10;
+        while (n > 0 && from.used > 0 && migrate_group_ < groups)
+        {
+            uint8_t *ctrl = from.ctrl + migrate_group_ * GROUP;
+            uint32_t full = matchFull(ctrl);
+            if (full == 0)
+            {
+                migrate_group_++;
+                if (--empty_visits == 0)
+                    return true;
+                continue;
+            }
+            for (; full != 0; full &= full - 1)
+            {
+                size_t index = migrate_group_ * GROUP + __builtin_ctz(full);
+                Slot &slot = from.slots[index];
+                size_t target = claim(to, slot.hash);
+                new (&to.slots[target]) Slot(std::move(slot));
+                slot.~Slot();
+                // Probes for keys still in this table may pass through here
+                from.ctrl[index] = DELETED;
+                from.used--;
+            }
+            migrate_group_++;
+            n--;
+        }
+
+        if (from.used > 0)
+            return true;
+        std::free(from.ctrl);
+        from = to;
+        to = Table();
+        migrate_group_ = 0;
+        return false;
+    }
+
+    // Calls f(entry) for the entries in group `cursor` of either table and
+    // returns the next cursor, 0 once past the last group. A full pass from
+    // 0 sees every entry that stayed put; a rehash meanwhile may cause some
+    // to be seen twice or missed.
+    template <typename F>
+    size_t scan(size_t cursor, F &&f)
+    {
+        for (Table &table : tables_)
+        {
+            if (cursor >= table.capacity / GROUP)
+                continue;
+            for (uint32_t full = matchFull(table.ctrl + cursor * GROUP); full != 0; full &= full - 1)
+                f(table.slots[cursor * GROUP + __builtin_ctz(full)].entry);
+        }
+        cursor++;
+        return cursor < std::max(tables_[0].capacity, tables_[1].capacity) / GROUP ? cursor : 0;
+    }
+
+private:
+    static constexpr size_t GROUP = 16;
+    // Control bytes. EMPTY is zero so that a calloc'd table starts empty.
+    static constexpr uint8_t EMPTY = 0x00;
+    static constexpr uint8_t DELETED = 0x01;
+    static constexpr uint8_t FULL = 0x80;   // Ored with the hash's low 7 bits
+
+    struct Slot
+    {
+        size_t hash;
+        value_type entry;
+
+        template <typename K, typename... Args>
+        Slot(size_t hash, K &&key, Args &&...args)
+            : hash(hash), entry(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                                std::forward_as_tuple(std::forward<Args>(args)...))
+        {
+        }
+        Slot(Slot &&other) = default;
+    };
+
+    // ctrl and slots share one allocation, ctrl first
+    struct Table
+    {
+        uint8_t *ctrl = nullptr;
+        Slot *slots = nullptr;
+        size_t capacity = 0;        // A power of two, at least GROUP; or 0
+        size_t used = 0;
+        size_t growth_left = 0;     // Empty slots that may still be filled
+    };
+
+    // tables_[1] is only allocated during a rehash, and groups of
+    // tables_[0] below migrate_group_ hold no entries then
+    Table tables_[2];
+    size_t migrate_group_ = 0;
+
+    // ============== Group matching ==============
+
+    // Bit i is set for each byte of the 16-byte group equal to byte
+    static uint32_t match(const uint8_t *group, uint8_t byte)
+    {
+#ifdef __SSE2__
+        __m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i *>(group));
+        return static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(byte)))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP; i++)
+            mask |= static_cast<uint32_t>(group[i] == byte) << i;
+        return mask;
+#endif
+    }
+
+    static uint32_t matchFull(const uint8_t *group)
+    {
+#ifdef __SSE2__
+        __m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i *>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP; i++)
+            mask |= static_cast<uint32_t>(group[i] >> 7) << i;
+        return mask;
+#endif
+    }
+
+    static uint32_t matchFree(const uint8_t *group) { return ~matchFull(group) & 0xffff; }
+
+    static uint8_t controlFor(size_t hash) { return FULL | (hash & 0x7f); }
+
+    // ============== Probing ==============
+    // A key's probe visits groups h, h + 1, h + 3, h + 6, ... (mod the group
+    // count), which reaches every group of a power-of-two table once
+
+    bool locate(std::string_view key, size_t hash, int &table, size_t &index) const
+    {
+        return locateIf(hash, [key](const value_type &entry) { return entry.first == key; }, table, index);
+    }
+
+    // Probes for a slot with hash whose entry satisfies pred
+    template <typename Pred>
+    bool locateIf(size_t hash, Pred &&pred, int &table, size_t &index) const
+    {
+        uint8_t control = controlFor(hash);
+        for (table = 0; table < 2; table++)
+        {
+            const Table &t = tables_[table];
+            if (t.capacity == 0)
+                continue;
+            size_t mask = t.capacity / GROUP - 1;
+            size_t group = (hash >> 7) & mask;
+            for (size_t step = 0; step <= mask; step++)
+            {
+                const uint8_t *ctrl = t.ctrl + group * GROUP;
+                for (uint32_t bits = match(ctrl, control); bits != 0; bits &= bits - 1)
+                {
+                    size_t i = group * GROUP + __builtin_ctz(bits);
+                    const Slot &slot = t.slots[i];
+                    if (slot.hash == hash && pred(slot.entry))
+                    {
+                        index = i;
+                        return true;
+                    }
+                }
+                if (match(ctrl, EMPTY) != 0)
+                    break;
+                group = (group + step + 1) & mask;
+            }
+        }
+        return false;
+    }
+
+    // Takes the first free slot on hash's probe and marks it full; the
+    // caller constructs the Slot. The table must have growth_left.
+    size_t claim(Table &table, size_t hash)
+    {
+        size_t mask = table.capacity / GROUP - 1;
+        size_t group = (hash >> 7) & mask;
+        uint32_t free;
+        for (size_t step = 0; (free = matchFree(table.ctrl + group * GROUP)) == 0; step++)
+            group = (group + step + 1) & mask;
+
+        size_t index = group * GROUP + __builtin_ctz(free);
+        if (table.ctrl[index] == EMPTY)
+            table.growth_left--;
+        table.ctrl[index] = controlFor(hash);
+        table.used++;
+        return index;
+    }
+
+    // ============== Resizing ==============
+
+    // Smallest table that holds n entries at a load factor of 7/8
+    static size_t capacityFor(size_t n)
+    {
+        size_t capacity = GROUP;
+        while (capacity - capacity / 8 < n)
+            capacity <<= 1;
+        return capacity;
+    }
+
+    static void release(Table &table)
+    {
+        for (size_t i = 0; i < table.capacity; i++)
+        {
+            if (table.ctrl[i] & FULL)
+                table.slots[i].~Slot();
+        }
+        std::free(table.ctrl);
+        table = Table();
+    }
+
+    void startResize(size_t capacity)
+    {
+        // calloc: a large table comes straight from mmap as zero pages, that
+        // is, all EMPTY, instead of being cleared up front
+        Table table;
+        table.ctrl = static_cast<uint8_t *>(std::calloc(1, capacity + capacity * sizeof(Slot)));
+        if (table.ctrl == nullptr)
+            throw std::bad_alloc();
+        table.slots = reinterpret_cast<Slot *>(table.ctrl + capacity);
+        table.capacity = capacity;
+        table.growth_left = capacity - capacity / 8;
+
+        if (tables_[0].used == 0)
+        {
+            // Nothing to move
+            std::free(tables_[0].ctrl);
+            tables_[0] = table;
+            return;
+        }
+        tables_[1] = table;
+        migrate_group_ = 0;
+    }
+
+    void finishRehash()
+    {
+        while (rehashStep(1024))
+        {
+        }
+    }
+
+    // Which table the next new entry goes into, resizing first if needed.
+    // During a rehash the new table always keeps room for whatever is left
+    // in the old one, so that the rehash can always finish.
+    int prepareInsert()
+    {
+        if (rehashing())
+        {
+            if (tables_[1].growth_left > tables_[0].used)
+                return 1;
+            finishRehash();
+        }
+
+        const Table &table = tables_[0];
+        if (table.growth_left == 0)
+        {
+            // Full of entries: double. Full of tombstones: rehash at the
+            // same size to clear them.
+            size_t capacity = table.capacity == 0                   ? GROUP
+                              : table.used > table.capacity * 7 / 16 ? table.capacity * 2
+                                                                     : table.capacity;
+            startResize(capacity);
+        }
+        return rehashing() ? 1 : 0;
+    }
+
+    // Down to a quarter full at most, once under an eighth
+    void shrinkIfSparse()
+    {
+        const Table &table = tables_[0];
+        if (!rehashing() && table.capacity > GROUP && table.used * 8 < table.capacity)
+            startResize(capacityFor(2 * table.used));
+    }
+};
+
+#endif
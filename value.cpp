@@ -1,63 +1,644 @@
 #include "value.h"
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 
-Value::Value() : type(ValueType::STRING), data(std::string()), expiration(std::nullopt)
+// A RAW string's heap buffer starts with its capacity
+static constexpr size_t RAW_HEADER = sizeof(uint32_t);
+
+static PackLimits pack_limits;
+
+static char *allocRaw(size_t capacity)
+{
+    char *ptr = static_cast<char *>(std::malloc(RAW_HEADER + capacity));
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    uint32_t cap = static_cast<uint32_t>(capacity);
+    std::memcpy(ptr, &cap, RAW_HEADER);
+    return ptr;
+}
+
+size_t Value::rawCapacity(const char *ptr)
+{
+    uint32_t cap;
+    std::memcpy(&cap, ptr, RAW_HEADER);
+    return cap;
+}
+
+Value::Value()
+{
+    emb_.encoding = EMBSTR;
+    emb_.flags = 0;
+    emb_.length = 0;
+}
+
+Value::Value(std::string_view s)
 {
+    head_.flags = 0;
+    setString(s);
 }
 
-Value::Value(const std::string& s) : type(ValueType::STRING), data(s), expiration(std::nullopt)
+Value::Value(long long i)
 {
+    num_.encoding = INT;
+    num_.flags = 0;
+    num_.n = i;
 }
 
-Value::Value(long long i) : type(ValueType::INTEGER), data(i), expiration(std::nullopt)
+Value::Value(ValueType type, size_t size_hint)
 {
+    head_.flags = 0;
+    if (type == ValueType::STRING)
+    {
+        emb_.encoding = EMBSTR;
+        emb_.length = 0;
+    }
+    else if (type == ValueType::INTEGER)
+    {
+        num_.encoding = INT;
+        num_.n = 0;
+    }
+    else if (type == ValueType::SET && size_hint <= pack_limits.max_intset_entries)
+    {
+        // Until a member turns out not to be an integer
+        ints_.encoding = INTSET;
+        new (&ints_.set) IntSet();
+    }
+    else if (size_hint <= pack_limits.max_entries)
+    {
+        pack_.encoding = LISTPACK;
+        pack_.type = type;
+        new (&pack_.lp) Listpack();
+    }
+    else if (type == ValueType::LIST)
+    {
+        obj_.encoding = QUICKLIST;
+        obj_.ptr = new Quicklist(pack_limits.list_node_bytes, pack_limits.list_compress_depth);
+    }
+    else if (type == ValueType::SET)
+    {
+        obj_.encoding = SET;
+        obj_.ptr = new RedisSet(size_hint);
+    }
+    else
+    {
+        obj_.encoding = HASH;
+        obj_.ptr = new RedisHash(size_hint);
+    }
 }
 
-Value::Value(const RedisList& l) : type(ValueType::LIST), data(l), expiration(std::nullopt)
+// Every encoding is trivially relocatable: a move copies the 16 bytes and
+// leaves an empty string behind
+Value::Value(Value &&other) noexcept
 {
+    std::memcpy(static_cast<void *>(this), &other, sizeof(Value));
+    other.emb_.encoding = EMBSTR;
+    other.emb_.flags = 0;
+    other.emb_.length = 0;
 }
 
-Value::Value(const RedisSet& s) : type(ValueType::SET), data(s), expiration(std::nullopt)
+Value &Value::operator=(Value &&other) noexcept
 {
+    if (this != &other)
+    {
+        release();
+        std::memcpy(static_cast<void *>(this), &other, sizeof(Value));
+        other.emb_.encoding = EMBSTR;
+        other.emb_.flags = 0;
+        other.emb_.length = 0;
+    }
+    return *this;
 }
 
-Value::Value(const RedisHash& h) : type(ValueType::HASH), data(h), expiration(std::nullopt)
+Value::Value(const Value &other)
 {
+    copyFrom(other);
 }
 
-bool Value::isExpired() const
+Value &Value::operator=(const Value &other)
 {
-    if(!expiration.has_value())
+    if (this != &other)
     {
+        Value copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+Value::~Value()
+{
+    release();
+}
+
+Value Value::fromEncoded(ValueType type, const char *data, size_t length)
+{
+    Value value;
+    value.raw_.encoding = ENCODED;
+    value.raw_.flags = 0;
+    value.raw_.type = type;
+    value.raw_.length = static_cast<uint32_t>(length);
+    value.raw_.ptr = const_cast<char *>(data);
+    return value;
+}
+
+Value Value::fromString(std::string_view s)
+{
+    long long n;
+    if (parseInteger(s, n))
+        return Value(n);
+    return Value(s);
+}
+
+bool Value::parseInteger(std::string_view s, long long &out)
+{
+    if (s.empty() || s.size() > MAX_INTEGER_DIGITS)
         return false;
+
+    // from_chars already rejects '+' and spaces; leading zeros and "-0"
+    // would not survive a round trip
+    size_t digits = s[0] == '-' ? 1 : 0;
+    if (s.size() > digits + 1 && s[digits] == '0')
+        return false;
+    if (s == "-0")
+        return false;
+
+    const char *end = s.data() + s.size();
+    auto result = std::from_chars(s.data(), end, out);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+void Value::release()
+{
+    switch (head_.encoding)
+    {
+    case RAW:
+        std::free(raw_.ptr);
+        break;
+    case LISTPACK:
+        pack_.lp.~Listpack();
+        break;
+    case INTSET:
+        ints_.set.~IntSet();
+        break;
+    case QUICKLIST:
+        delete static_cast<Quicklist *>(obj_.ptr);
+        break;
+    case SET:
+        delete static_cast<RedisSet *>(obj_.ptr);
+        break;
+    case HASH:
+        delete static_cast<RedisHash *>(obj_.ptr);
+        break;
+    default:
+        break;
+    }
+}
+
+void Value::copyFrom(const Value &other)
+{
+    switch (other.head_.encoding)
+    {
+    case RAW:
+        head_.flags = other.head_.flags;
+        setString(other.str());
+        break;
+    case LISTPACK:
+        pack_.encoding = LISTPACK;
+        pack_.flags = other.pack_.flags;
+        pack_.type = other.pack_.type;
+        new (&pack_.lp) Listpack(other.pack_.lp);
+        break;
+    case INTSET:
+        ints_.encoding = INTSET;
+        ints_.flags = other.ints_.flags;
+        new (&ints_.set) IntSet(other.ints_.set);
+        break;
+    case QUICKLIST:
+        obj_.encoding = QUICKLIST;
+        obj_.flags = other.obj_.flags;
+        obj_.ptr = new Quicklist(other.list());
+        break;
+    case SET:
+        obj_.encoding = SET;
+        obj_.flags = other.obj_.flags;
+        obj_.ptr = new RedisSet(other.set());
+        break;
+    case HASH:
+        obj_.encoding = HASH;
+        obj_.flags = other.obj_.flags;
+        obj_.ptr = new RedisHash(other.hash());
+        break;
+    default:
+        // EMBSTR, INT and ENCODED own nothing
+        std::memcpy(static_cast<void *>(this), &other, sizeof(Value));
+        break;
+    }
+}
+
+// Stores s as this value's string; the flags are kept, whatever was stored
+// before must already be released
+void Value::setString(std::string_view s)
+{
+    if (s.size() <= EMBSTR_MAX)
+    {
+        emb_.encoding = EMBSTR;
+        emb_.length = static_cast<uint8_t>(s.size());
+        std::memcpy(emb_.data, s.data(), s.size());
+        return;
+    }
+
+    raw_.encoding = RAW;
+    raw_.length = static_cast<uint32_t>(s.size());
+    raw_.ptr = allocRaw(s.size());
+    std::memcpy(raw_.ptr + RAW_HEADER, s.data(), s.size());
+}
+
+ValueType Value::type() const
+{
+    switch (head_.encoding)
+    {
+    case INT:
+        return ValueType::INTEGER;
+    case QUICKLIST:
+        return ValueType::LIST;
+    case SET:
+        return ValueType::SET;
+    case HASH:
+        return ValueType::HASH;
+    case LISTPACK:
+        return pack_.type;
+    case INTSET:
+        return ValueType::SET;
+    case ENCODED:
+        return raw_.type;
+    default:
+        return ValueType::STRING;
+    }
+}
+
+std::string_view Value::str() const
+{
+    if (head_.encoding == EMBSTR)
+        return std::string_view(emb_.data, emb_.length);
+    return std::string_view(raw_.ptr + RAW_HEADER, raw_.length);
+}
+
+char *Value::resize(size_t length)
+{
+    size_t old_length = str().size();
+
+    if (head_.encoding == EMBSTR && length <= EMBSTR_MAX)
+    {
+        if (length > old_length)
+            std::memset(emb_.data + old_length, 0, length - old_length);
+        emb_.length = static_cast<uint8_t>(length);
+        return emb_.data;
+    }
+
+    if (head_.encoding == EMBSTR)
+    {
+        // Outgrown the inline buffer
+        char *ptr = allocRaw(length);
+        std::memcpy(ptr + RAW_HEADER, emb_.data, old_length);
+        raw_.encoding = RAW;
+        raw_.ptr = ptr;
+    }
+    else if (length > rawCapacity(raw_.ptr))
+    {
+        // Double while small, then grow by a megabyte at a time, so that
+        // repeated APPENDs are amortized O(1)
+        const size_t STEP = 1024 * 1024;
+        size_t capacity = length < STEP ? length * 2 : length + STEP;
+        char *ptr = static_cast<char *>(std::realloc(raw_.ptr, RAW_HEADER + capacity));
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        uint32_t cap = static_cast<uint32_t>(capacity);
+        std::memcpy(ptr, &cap, RAW_HEADER);
+        raw_.ptr = ptr;
+    }
+
+    if (length > old_length)
+        std::memset(raw_.ptr + RAW_HEADER + old_length, 0, length - old_length);
+    raw_.length = static_cast<uint32_t>(length);
+    return raw_.ptr + RAW_HEADER;
+}
+
+void Value::setInteger(long long n)
+{
+    if (head_.encoding != INT)
+    {
+        uint8_t flags = head_.flags;
+        release();
+        num_.encoding = INT;
+        num_.flags = flags;
+    }
+    num_.n = n;
+}
+
+std::string_view Value::text(IntegerBuffer &buf) const
+{
+    if (head_.encoding != INT)
+        return str();
+    auto result = std::to_chars(buf, buf + sizeof(buf), num_.n);
+    return std::string_view(buf, result.ptr - buf);
+}
+
+void Value::makeString()
+{
+    if (head_.encoding != INT)
+        return;
+    IntegerBuffer buf;
+    setString(text(buf));
+}
+
+void Value::append(std::string_view s)
+{
+    size_t old_length = str().size();
+    char *data = resize(old_length + s.size());
+    std::memcpy(data + old_length, s.data(), s.size());
+}
+
+// ============== Collections ==============
+
+const PackLimits &Value::packLimits()
+{
+    return pack_limits;
+}
+
+void Value::setPackLimits(const PackLimits &limits)
+{
+    pack_limits = limits;
+}
+
+bool Value::fits(size_t entries, std::string_view a, std::string_view b) const
+{
+    size_t per_element = pack_.type == ValueType::HASH ? 2 : 1;
+    return pack_.lp.size() / per_element + entries <= pack_limits.max_entries &&
+           a.size() <= pack_limits.max_value && b.size() <= pack_limits.max_value;
+}
+
+void Value::unpack()
+{
+    Listpack lp(std::move(pack_.lp));
+    pack_.lp.~Listpack();
+    ValueType type = pack_.type;
+
+    switch (type)
+    {
+    case ValueType::LIST:
+    {
+        auto *list = new Quicklist(pack_limits.list_node_bytes, pack_limits.list_compress_depth);
+        for (size_t pos = lp.begin(); pos != lp.end(); pos = lp.next(pos))
+            list->push(lp.get(pos), false);
+        obj_.encoding = QUICKLIST;
+        obj_.ptr = list;
+        break;
+    }
+    case ValueType::SET:
+    {
+        auto *set = new RedisSet();
+        set->reserve(lp.size());
+        for (size_t pos = lp.begin(); pos != lp.end(); pos = lp.next(pos))
+            set->emplace(lp.get(pos));
+        obj_.encoding = SET;
+        obj_.ptr = set;
+        break;
+    }
+    default:
+    {
+        auto *hash = new RedisHash();
+        hash->reserve(lp.size() / 2);
+        for (size_t pos = lp.begin(); pos != lp.end();)
+        {
+            size_t value = lp.next(pos);
+            hash->emplace(lp.get(pos), lp.get(value));
+            pos = lp.next(value);
+        }
+        obj_.encoding = HASH;
+        obj_.ptr = hash;
+        break;
+    }
+    }
+}
+
+void Value::unpackIntSet(size_t extra, std::string_view member)
+{
+    IntSet ints(std::move(ints_.set));
+    ints_.set.~IntSet();
+
+    bool fits = ints.size() + extra <= pack_limits.max_entries && member.size() <= pack_limits.max_value &&
+                MAX_INTEGER_DIGITS <= pack_limits.max_value;
+    char buf[MAX_INTEGER_DIGITS];
+    if (fits)
+    {
+        pack_.encoding = LISTPACK;
+        pack_.type = ValueType::SET;
+        new (&pack_.lp) Listpack();
+        for (size_t i = 0; i < ints.size(); i++)
+        {
+            auto result = std::to_chars(buf, buf + sizeof(buf), ints.get(i));
+            pack_.lp.pushBack(std::string_view(buf, result.ptr - buf));
+        }
+        return;
+    }
+
+    auto *set = new RedisSet(ints.size() + extra);
+    for (size_t i = 0; i < ints.size(); i++)
+    {
+        auto result = std::to_chars(buf, buf + sizeof(buf), ints.get(i));
+        set->emplace(std::string_view(buf, result.ptr - buf));
+    }
+    obj_.encoding = SET;
+    obj_.ptr = set;
+}
+
+size_t Value::listLength() const
+{
+    return head_.encoding == LISTPACK ? pack_.lp.size() : list().size();
+}
+
+void Value::listPush(std::string_view item, bool front)
+{
+    if (head_.encoding == LISTPACK && !fits(1, item))
+        unpack();
+
+    if (head_.encoding == LISTPACK)
+    {
+        if (front)
+            pack_.lp.pushFront(item);
+        else
+            pack_.lp.pushBack(item);
+    }
+    else
+    {
+        list().push(item, front);
+    }
+}
+
+std::string Value::listPop(bool front)
+{
+    if (head_.encoding == LISTPACK)
+    {
+        Listpack &lp = pack_.lp;
+        size_t pos = front ? lp.begin() : lp.prev(lp.end());
+        std::string item(lp.get(pos));
+        lp.erase(pos);
+        return item;
+    }
+
+    return list().pop(front);
+}
+
+std::string Value::listIndex(size_t index) const
+{
+    if (head_.encoding == LISTPACK)
+        return std::string(pack_.lp.get(pack_.lp.seek(static_cast<long long>(index))));
+    return list().index(index);
+}
+
+void Value::listSet(size_t index, std::string_view item)
+{
+    if (head_.encoding == LISTPACK && !fits(0, item))
+        unpack();
+
+    if (head_.encoding == LISTPACK)
+        pack_.lp.replace(pack_.lp.seek(static_cast<long long>(index)), item);
+    else
+        list().set(index, item);
+}
+
+size_t Value::setSize() const
+{
+    if (head_.encoding == INTSET)
+        return ints_.set.size();
+    return head_.encoding == LISTPACK ? pack_.lp.size() : set().size();
+}
+
+bool Value::setAdd(std::string_view member)
+{
+    if (head_.encoding == INTSET)
+    {
+        long long n;
+        bool integer = parseInteger(member, n);
+        if (integer && ints_.set.contains(n))
+            return false;
+        if (integer && ints_.set.size() < pack_limits.max_intset_entries)
+            return ints_.set.add(n);
+        unpackIntSet(1, member);
+    }
+
+    if (head_.encoding == LISTPACK)
+    {
+        if (pack_.lp.find(member, pack_.lp.begin()) != pack_.lp.end())
+            return false;
+        if (fits(1, member))
+        {
+            pack_.lp.pushBack(member);
+            return true;
+        }
+        unpack();
+    }
+    return set().emplace(member).second;
+}
+
+bool Value::setRemove(std::string_view member)
+{
+    if (head_.encoding == INTSET)
+    {
+        long long n;
+        return parseInteger(member, n) && ints_.set.remove(n);
     }
-    return std::chrono::steady_clock::now() >= expiration.value();
+    if (head_.encoding == LISTPACK)
+    {
+        size_t pos = pack_.lp.find(member, pack_.lp.begin());
+        if (pos == pack_.lp.end())
+            return false;
+        pack_.lp.erase(pos);
+        return true;
+    }
+    return set().erase(member) > 0;
 }
 
-void Value::setExpiration(long long seconds)
+bool Value::setHas(std::string_view member) const
 {
-    auto now = std::chrono::steady_clock::now();
-    expiration = now + std::chrono::seconds(seconds);
+    if (head_.encoding == INTSET)
+    {
+        long long n;
+        return parseInteger(member, n) && ints_.set.contains(n);
+    }
+    if (head_.encoding == LISTPACK)
+        return pack_.lp.find(member, pack_.lp.begin()) != pack_.lp.end();
+    return set().count(member) > 0;
 }
 
-void Value::persist()
+size_t Value::hashLength() const
 {
-    expiration = std::nullopt;
+    return head_.encoding == LISTPACK ? pack_.lp.size() / 2 : hash().size();
 }
 
-long long Value::getTTL() const
+bool Value::hashSet(std::string_view field, std::string_view value)
 {
-    if (!expiration.has_value()) {
-        return -1;
+    if (head_.encoding == LISTPACK)
+    {
+        Listpack &lp = pack_.lp;
+        size_t pos = lp.find(field, lp.begin(), 2);
+        bool found = pos != lp.end();
+        if (fits(found ? 0 : 1, field, value))
+        {
+            if (found)
+            {
+                lp.replace(lp.next(pos), value);
+            }
+            else
+            {
+                lp.pushBack(field);
+                lp.pushBack(value);
+            }
+            return !found;
+        }
+        unpack();
     }
-    
-    auto now = std::chrono::steady_clock::now();
-    if (now >= expiration.value()) {
-        return -2;
+    auto [it, inserted] = hash().try_emplace(field, value);
+    if (!inserted)
+        it->second.assign(value.data(), value.size());
+    return inserted;
+}
+
+bool Value::hashGet(std::string_view field, std::string_view &value) const
+{
+    if (head_.encoding == LISTPACK)
+    {
+        const Listpack &lp = pack_.lp;
+        size_t pos = lp.find(field, lp.begin(), 2);
+        if (pos == lp.end())
+            return false;
+        value = lp.get(lp.next(pos));
+        return true;
     }
-    
-    auto duration = std::chrono::duration_cast<std::chrono::seconds>(
-        expiration.value() - now
-    );
-    
-    return duration.count();
-}
\ No newline at end of file
+
+    auto it = hash().find(field);
+    if (it == hash().end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+bool Value::hashDelete(std::string_view field)
+{
+    if (head_.encoding == LISTPACK)
+    {
+        size_t pos = pack_.lp.find(field, pack_.lp.begin(), 2);
+        if (pos == pack_.lp.end())
+            return false;
+        pack_.lp.erase(pos, 2);
+        return true;
+    }
+    return hash().erase(field) > 0;
+}
+
+bool Value::hashHas(std::string_view field) const
+{
+    std::string_view value;
+    return hashGet(field, value);
+}
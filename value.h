@@ -1,15 +1,16 @@
 #ifndef VALUE_H
 #define VALUE_H
-#include <chrono>
-#include <optional>
+#include "listpack.h"
+#include "intset.h"
+#include "quicklist.h"
+#include "dict.h"
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
 #include <string>
-#include <variant>
-#include <vector>
-#include <deque>
-#include <unordered_set>
-#include <unordered_map>
+#include <string_view>
 
-enum class ValueType
+enum class ValueType : uint8_t
 {
     STRING,
     INTEGER,
@@ -19,58 +20,309 @@ enum class ValueType
 };
 
 // Type aliases for complex types
-using RedisList = std::deque<std::string>;
-using RedisSet = std::unordered_set<std::string>;
-using RedisHash = std::unordered_map<std::string, std::string>;
+using RedisSet = Dict<NoValue>;
+using RedisHash = Dict<std::string>;
 
-struct Value
+// Lists, sets and hashes stay packed in a Listpack until they outgrow
+// either limit, then move to their full container for good. Sets whose
+// members are all integers are kept in an IntSet instead, up to their own
+// limit. Lists move to a Quicklist, whose nodes are listpacks of up to
+// list_node_bytes. Process-wide, see Value::setPackLimits().
+struct PackLimits
 {
-    ValueType type;
-    
-    // Data storage using variant for memory efficiency
-    std::variant<
-        std::string,                    // STRING
-        long long,                      // INTEGER
-        RedisList,                      // LIST
-        RedisSet,                       // SET
-        RedisHash                       // HASH
-    > data;
-
-    std::optional<std::chrono::time_point<std::chrono::steady_clock>> expiration;
-
-    bool isExpired() const;
-    void setExpiration(long long seconds);
-    void persist();
-    long long getTTL() const;
-
-    // Accessors for convenience - String/Integer
-    std::string& str() { return std::get<std::string>(data); }
-    const std::string& str() const { return std::get<std::string>(data); }
-    long long& integer() { return std::get<long long>(data); }
-    long long integer() const { return std::get<long long>(data); }
-    
-    // Accessors for List
-    RedisList& list() { return std::get<RedisList>(data); }
-    const RedisList& list() const { return std::get<RedisList>(data); }
-    
-    // Accessors for Set
-    RedisSet& set() { return std::get<RedisSet>(data); }
-    const RedisSet& set() const { return std::get<RedisSet>(data); }
-    
-    // Accessors for Hash
-    RedisHash& hash() { return std::get<RedisHash>(data); }
-    const RedisHash& hash() const { return std::get<RedisHash>(data); }
-
-    // Constructors
-    Value();
-    Value(const std::string &s);
+    size_t max_entries = 128;   // Elements, or fields for a hash
+    size_t max_value = 64;      // Bytes in any element, field or value
+    size_t max_intset_entries = 512;    // Members of a set of integers
+    size_t list_node_bytes = 8192;
+    size_t list_compress_depth = 0;     // Raw nodes at each end; 0 compresses none
+};
+
+// A value still in its snapshot encoding, inside a memory-mapped snapshot
+// file (see Db's lazy loading). The data is decoded on first access.
+struct EncodedValue
+{
+    const char *data;
+    size_t length;
+};
+
+// One key's value in 16 bytes. The first byte says how the value is stored;
+// the type is derived from it rather than kept alongside:
+//
+//   EMBSTR    strings of up to EMBSTR_MAX bytes, stored inline
+//   RAW       longer strings, in a heap buffer the Value owns
+//   INT       integers, inline: INCR results, and strings SET in an
+//             integer's canonical form (see fromString())
+//   LISTPACK  a small list, set or hash, packed (see PackLimits)
+//   INTSET    a set of integers, as a sorted array
+//   QUICKLIST a pointer to a Quicklist, for longer lists
+//   SET, HASH a pointer to a Dict
+//   ENCODED   a lazily loaded value of any type (see EncodedValue)
+//
+// Expiration times live in a side table owned by Db, since most keys have
+// none; the Value only carries a flag saying whether it has an entry there.
+class Value
+{
+public:
+    static constexpr size_t EMBSTR_MAX = 13;
+    static constexpr size_t MAX_STRING = 512 * 1024 * 1024;    // As in Redis
+    static constexpr size_t MAX_INTEGER_DIGITS = 20;             // "-9223372036854775808"
+
+    // Room for formatting an INTEGER value, see text()
+    using IntegerBuffer = char[MAX_INTEGER_DIGITS];
+
+    Value();                            // Empty string
+    Value(std::string_view s);
+    Value(const std::string &s) : Value(std::string_view(s)) {}
+    Value(const char *s) : Value(std::string_view(s)) {}
     Value(long long i);
-    Value(const RedisList &l);
-    Value(const RedisSet &s);
-    Value(const RedisHash &h);
-    Value(const Value &other) = default;
-    Value &operator=(const Value &other) = default;
-    ~Value() = default;
+    // An empty value of the given type. Lists, sets and hashes start packed,
+    // unless size_hint says they will outgrow PackLimits::max_entries.
+    explicit Value(ValueType type, size_t size_hint = 0);
+    Value(Value &&other) noexcept;
+    Value &operator=(Value &&other) noexcept;
+    Value(const Value &other);
+    Value &operator=(const Value &other);
+    ~Value();
+
+    // A value found by RDB::scan(), decoded later by RDB::decodeValue()
+    static Value fromEncoded(ValueType type, const char *data, size_t length);
+    // A string stored as an INTEGER when formatting the number gives back
+    // exactly the same bytes, as for SET
+    static Value fromString(std::string_view s);
+
+    // Parses s only if it is a number's canonical form: optional '-', no
+    // leading zeros, spaces or '+', within range
+    static bool parseInteger(std::string_view s, long long &out);
+
+    ValueType type() const;
+
+    // Strings (STRING type only)
+    std::string_view str() const;
+    void append(std::string_view s);
+    // Grows (with zero bytes) or shrinks the string; returns its bytes for
+    // writing in place
+    char *resize(size_t length);
+
+    // Integers (INTEGER type only)
+    long long integer() const { return num_.n; }
+    // Replaces a STRING or INTEGER value with n, keeping the flags
+    void setInteger(long long n);
+
+    // The bytes of a STRING or INTEGER value, as GET returns them. Integers
+    // are formatted into buf, which must outlive the view.
+    std::string_view text(IntegerBuffer &buf) const;
+    // Turns an INTEGER into the equivalent STRING, for in-place edits
+    void makeString();
+
+    // Lists (LIST type only). Indexes must be in range.
+    size_t listLength() const;
+    void listPush(std::string_view item, bool front);
+    std::string listPop(bool front);        // The list must not be empty
+    std::string listIndex(size_t index) const;
+    void listSet(size_t index, std::string_view item);
+    // Calls f(item) for items start..stop inclusive. The view is only
+    // valid during the call; copy it to keep it.
+    template <typename F>
+    void listRange(size_t start, size_t stop, F &&f) const;
+
+    // Sets (SET type only)
+    size_t setSize() const;
+    bool setAdd(std::string_view member);       // False if already there
+    bool setRemove(std::string_view member);    // False if not there
+    bool setHas(std::string_view member) const;
+
+    // Hashes (HASH type only)
+    size_t hashLength() const;
+    bool hashSet(std::string_view field, std::string_view value);   // True if the field is new
+    bool hashGet(std::string_view field, std::string_view &value) const;
+    bool hashDelete(std::string_view field);
+    bool hashHas(std::string_view field) const;
+
+    // Calls f(member) for every list item (in order) or set member. The view
+    // is only valid during the call (integers, for one, are formatted into a
+    // buffer reused for the next); copy it to keep it.
+    template <typename F>
+    void forEachMember(F &&f) const;
+    // Calls f(field, value) for every field of a hash
+    template <typename F>
+    void forEachField(F &&f) const;
+
+    static const PackLimits &packLimits();
+    // Applies to values packed from then on; call before any are created
+    static void setPackLimits(const PackLimits &limits);
+
+    bool isEncoded() const { return head_.encoding == ENCODED; }
+    EncodedValue encoded() const { return {raw_.ptr, raw_.length}; }
+
+    // Set by Db while the key has an entry in its expiration table. Moves
+    // and copies carry it along.
+    bool hasExpiry() const { return (head_.flags & HAS_EXPIRY) != 0; }
+    void setHasExpiry(bool on) { head_.flags = on ? (head_.flags | HAS_EXPIRY) : (head_.flags & ~HAS_EXPIRY); }
+
+private:
+    enum Encoding : uint8_t
+    {
+        EMBSTR,
+        RAW,
+        INT,
+        LISTPACK,
+        INTSET,
+        QUICKLIST,
+        SET,
+        HASH,
+        ENCODED
+    };
+    enum Flags : uint8_t
+    {
+        HAS_EXPIRY = 1
+    };
+
+    // Every member starts with the same two bytes, so head_ can always be
+    // read, whichever member was written last
+    struct Head
+    {
+        uint8_t encoding;
+        uint8_t flags;
+    };
+    struct Embedded
+    {
+        uint8_t encoding;
+        uint8_t flags;
+        uint8_t length;
+        char data[EMBSTR_MAX];
+    };
+    // RAW: ptr is a heap buffer holding the capacity, then the bytes.
+    // ENCODED: ptr points into the snapshot mapping; type is the value's.
+    struct Raw
+    {
+        uint8_t encoding;
+        uint8_t flags;
+        ValueType type;
+        uint8_t unused;
+        uint32_t length;
+        char *ptr;
+    };
+    struct Number
+    {
+        uint8_t encoding;
+        uint8_t flags;
+        long long n;
+    };
+    struct Object
+    {
+        uint8_t encoding;
+        uint8_t flags;
+        void *ptr;
+    };
+    // LISTPACK: type says whether lp holds a list, a set or a hash
+    struct Packed
+    {
+        uint8_t encoding;
+        uint8_t flags;
+        ValueType type;
+        Listpack lp;
+    };
+    struct Integers
+    {
+        uint8_t encoding;
+        uint8_t flags;
+        IntSet set;
+    };
+
+    union
+    {
+        Head head_;
+        Embedded emb_;
+        Raw raw_;
+        Number num_;
+        Object obj_;
+        Packed pack_;
+        Integers ints_;
+    };
+
+    Quicklist &list() { return *static_cast<Quicklist *>(obj_.ptr); }
+    const Quicklist &list() const { return *static_cast<const Quicklist *>(obj_.ptr); }
+    RedisSet &set() { return *static_cast<RedisSet *>(obj_.ptr); }
+    const RedisSet &set() const { return *static_cast<const RedisSet *>(obj_.ptr); }
+    RedisHash &hash() { return *static_cast<RedisHash *>(obj_.ptr); }
+    const RedisHash &hash() const { return *static_cast<const RedisHash *>(obj_.ptr); }
+
+    void release();
+    void copyFrom(const Value &other);
+    void setString(std::string_view s);
+    // Moves a packed value into its full container
+    void unpack();
+    // Moves an IntSet into a Listpack if `extra` more members (as long as
+    // member) would fit in one, or else into a RedisSet
+    void unpackIntSet(size_t extra, std::string_view member);
+    // True if the packed value can take `entries` more entries of these sizes
+    bool fits(size_t entries, std::string_view a, std::string_view b = {}) const;
+    static size_t rawCapacity(const char *ptr);
 };
 
+static_assert(sizeof(Value) == 16, "Value should stay two words");
+
+template <typename F>
+void Value::listRange(size_t start, size_t stop, F &&f) const
+{
+    if (head_.encoding == LISTPACK)
+    {
+        const Listpack &lp = pack_.lp;
+        size_t pos = lp.seek(static_cast<long long>(start));
+        for (size_t i = start; i <= stop; i++, pos = lp.next(pos))
+            f(lp.get(pos));
+        return;
+    }
+    list().range(start, stop, f);
+}
+
+template <typename F>
+void Value::forEachMember(F &&f) const
+{
+    if (head_.encoding == LISTPACK)
+    {
+        const Listpack &lp = pack_.lp;
+        for (size_t pos = lp.begin(); pos != lp.end(); pos = lp.next(pos))
+            f(lp.get(pos));
+    }
+    else if (head_.encoding == INTSET)
+    {
+        char buf[MAX_INTEGER_DIGITS];
+        const IntSet &set = ints_.set;
+        for (size_t i = 0; i < set.size(); i++)
+        {
+            auto result = std::to_chars(buf, buf + sizeof(buf), set.get(i));
+            f(std::string_view(buf, result.ptr - buf));
+        }
+    }
+    else if (head_.encoding == QUICKLIST)
+    {
+        if (list().size() > 0)
+            list().range(0, list().size() - 1, f);
+    }
+    else
+    {
+        for (const auto &member : set())
+            f(std::string_view(member.first));
+    }
+}
+
+template <typename F>
+void Value::forEachField(F &&f) const
+{
+    if (head_.encoding == LISTPACK)
+    {
+        const Listpack &lp = pack_.lp;
+        for (size_t pos = lp.begin(); pos != lp.end();)
+        {
+            size_t value = lp.next(pos);
+            f(lp.get(pos), lp.get(value));
+            pos = lp.next(value);
+        }
+        return;
+    }
+    for (const auto &field : hash())
+        f(std::string_view(field.first), std::string_view(field.second));
+}
+
 #endif